@@ -0,0 +1,306 @@
+#include "assembler.h"
+
+#include <algorithm>
+#include <charconv>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#include "util.h"
+
+
+namespace vm {
+
+namespace {
+
+/** size of the blocks read from streams */
+constexpr size_t read_size = 64 * 1024;
+
+
+/**
+ * id of a built-in instruction, if the vm has it.
+ */
+std::optional<op_id_t> builtin_id(const vm_state& vm, opcode code) {
+    for (const auto& [op_id, builtin] : vm.instructions->builtin_opcodes) {
+        if (builtin == code) {
+            return op_id;
+        }
+    }
+    return std::nullopt;
+}
+
+
+/**
+ * call `fun` for each line of the text, without the line breaks.
+ * a line break at the very end doesn't start another line.
+ */
+template<typename Fun>
+void for_each_line(std::string_view text, Fun&& fun) {
+    while (not text.empty()) {
+        size_t line_end = text.find('\n');
+        if (line_end == std::string_view::npos) {
+            fun(text);
+            return;
+        }
+        fun(text.substr(0, line_end));
+        text.remove_prefix(line_end + 1);
+    }
+}
+
+
+/**
+ * does the line hold no instruction?
+ */
+bool is_blank(std::string_view line) {
+    return std::all_of(std::begin(line), std::end(line), util::is_space);
+}
+
+
+/**
+ * a piece of program text for the parallel assembler.
+ */
+struct text_chunk {
+    std::string_view text;
+
+    /** number of lines before the chunk */
+    size_t first_line = 0;
+    /** index of the chunk's first instruction in the code */
+    size_t first_op = 0;
+    /** number of instructions in the chunk */
+    size_t ops = 0;
+
+    /** error from assembling the chunk */
+    std::exception_ptr error;
+};
+
+
+/**
+ * split the text after line breaks into chunks of about `chunk_size` bytes.
+ */
+std::vector<text_chunk> split_lines(std::string_view text, size_t chunk_size) {
+    std::vector<text_chunk> chunks;
+    size_t begin = 0;
+    while (begin < text.size()) {
+        size_t end = text.find('\n', begin + chunk_size - 1);
+        end = (end == std::string_view::npos) ? text.size() : end + 1;
+        chunks.emplace_back().text = text.substr(begin, end - begin);
+        begin = end;
+    }
+    return chunks;
+}
+
+
+invalid_instruction line_error(size_t line_number, std::string_view what, std::string_view word) {
+    std::string msg = "line " + std::to_string(line_number) + ": ";
+    msg += what;
+    msg += ": ";
+    msg += word;
+    return invalid_instruction{msg};
+}
+
+} // namespace
+
+
+std::optional<op_t> assemble_line(const vm_state& vm, std::string_view line, size_t line_number) {
+    std::string_view op_name = util::next_word(line);
+    if (op_name.empty()) {
+        return std::nullopt;
+    }
+
+    // look up instruction id
+    auto find_op_id = vm.instructions->ids.find(op_name);
+    if (find_op_id == std::end(vm.instructions->ids)) {
+        throw line_error(line_number, "unknown instruction", op_name);
+    }
+    op_id_t op_id = find_op_id->second;
+
+    // parse the argument
+    item_t argument{0};
+    std::string_view arg_text = util::next_word(line);
+    if (not arg_text.empty()) {
+        // from_chars doesn't accept a plus sign
+        std::string_view digits = arg_text;
+        if (digits.size() > 1 and digits.front() == '+' and digits[1] != '-') {
+            digits.remove_prefix(1);
+        }
+        auto [end, error] = std::from_chars(digits.data(), digits.data() + digits.size(), argument);
+        if (error == std::errc::result_out_of_range) {
+            throw line_error(line_number, "argument out of range", arg_text);
+        }
+        if (error != std::errc{} or end != digits.data() + digits.size()) {
+            throw line_error(line_number, "invalid argument", arg_text);
+        }
+    }
+
+    // only support instruction and one argument
+    if (std::string_view extra = util::next_word(line); not extra.empty()) {
+        throw line_error(line_number, "more than one instruction argument", extra);
+    }
+
+    return op_t{op_id, argument};
+}
+
+
+assembler::assembler(const vm_state& vm)
+    : vm{vm},
+      call_id{builtin_id(vm, opcode::call)},
+      ret_id{builtin_id(vm, opcode::ret)},
+      jmp_id{builtin_id(vm, opcode::jmp)} {
+}
+
+
+void assembler::feed(std::string_view chunk) {
+    if (not this->partial.empty()) {
+        size_t line_end = chunk.find('\n');
+        if (line_end == std::string_view::npos) {
+            this->partial.append(chunk);
+            return;
+        }
+        this->partial.append(chunk.substr(0, line_end));
+        this->add_line(this->partial);
+        this->partial.clear();
+        chunk.remove_prefix(line_end + 1);
+    }
+
+    size_t line_end;
+    while ((line_end = chunk.find('\n')) != std::string_view::npos) {
+        this->add_line(chunk.substr(0, line_end));
+        chunk.remove_prefix(line_end + 1);
+    }
+    this->partial.assign(chunk);
+}
+
+
+code_t assembler::finish() {
+    if (not this->partial.empty()) {
+        this->add_line(this->partial);
+        this->partial.clear();
+    }
+    return std::move(this->code);
+}
+
+
+void assembler::add_line(std::string_view line) {
+    this->lines++;
+    if (auto op = assemble_line(this->vm, line, this->lines)) {
+        this->code.push_back(*op);
+        if (op->first == this->ret_id) {
+            this->eliminate_tail_call();
+        }
+    }
+}
+
+
+void assembler::eliminate_tail_call() {
+    if (this->code.size() < 2 or not this->jmp_id) {
+        return;
+    }
+    op_id_t& op_id = this->code[this->code.size() - 2].first;
+    if (op_id == this->call_id) {
+        op_id = *this->jmp_id;
+    }
+}
+
+
+parallel_assembler::parallel_assembler(const vm_state& vm, size_t threads, size_t chunk_size)
+    : vm{vm},
+      pool{threads},
+      chunk_size{std::max<size_t>(1, chunk_size)},
+      call_id{builtin_id(vm, opcode::call)},
+      ret_id{builtin_id(vm, opcode::ret)},
+      jmp_id{builtin_id(vm, opcode::jmp)} {
+}
+
+
+size_t parallel_assembler::threads() const {
+    return this->pool.size();
+}
+
+
+code_t parallel_assembler::assemble(std::string_view program) {
+    std::vector<text_chunk> chunks = split_lines(program, this->chunk_size);
+
+    // count lines and instructions of each chunk
+    this->pool.parallel_for(chunks.size(), [&](size_t index, size_t) {
+        text_chunk& chunk = chunks[index];
+        for_each_line(chunk.text, [&](std::string_view line) {
+            chunk.first_line++;
+            chunk.ops += not is_blank(line);
+        });
+    });
+
+    // prefix sums give each chunk its place
+    size_t lines = 0;
+    size_t ops = 0;
+    for (text_chunk& chunk : chunks) {
+        lines += std::exchange(chunk.first_line, lines);
+        chunk.first_op = ops;
+        ops += chunk.ops;
+    }
+
+    code_t code(ops);
+    this->pool.parallel_for(chunks.size(), [&](size_t index, size_t) {
+        text_chunk& chunk = chunks[index];
+        op_t* const begin = code.data() + chunk.first_op;
+        op_t* out = begin;
+        size_t line_number = chunk.first_line;
+        try {
+            for_each_line(chunk.text, [&](std::string_view line) {
+                line_number++;
+                if (auto op = assemble_line(this->vm, line, line_number)) {
+                    *out = *op;
+                    if (op->first == this->ret_id and out != begin
+                        and out[-1].first == this->call_id and this->jmp_id) {
+                        out[-1].first = *this->jmp_id;
+                    }
+                    out++;
+                }
+            });
+        }
+        catch (...) {
+            chunk.error = std::current_exception();
+        }
+    });
+
+    for (const text_chunk& chunk : chunks) {
+        if (chunk.error) {
+            std::rethrow_exception(chunk.error);
+        }
+    }
+
+    // tail calls across chunk boundaries
+    for (const text_chunk& chunk : chunks) {
+        size_t first = chunk.first_op;
+        if (chunk.ops > 0 and first > 0
+            and code[first].first == this->ret_id and code[first - 1].first == this->call_id and this->jmp_id) {
+            code[first - 1].first = *this->jmp_id;
+        }
+    }
+    return code;
+}
+
+
+code_t parallel_assembler::assemble_file(const std::string& path) {
+    util::mapped_file file{path};
+    return this->assemble(file.data());
+}
+
+
+code_t assemble(const vm_state& vm, std::istream& input) {
+    assembler assembler{vm};
+    std::string buffer(read_size, '\0');
+    while (input.read(buffer.data(), static_cast<std::streamsize>(buffer.size())) or input.gcount() > 0) {
+        assembler.feed({buffer.data(), static_cast<size_t>(input.gcount())});
+    }
+    return assembler.finish();
+}
+
+
+code_t assemble_file(const vm_state& vm, const std::string& path) {
+    util::mapped_file file{path};
+    assembler assembler{vm};
+    assembler.feed(file.data());
+    return assembler.finish();
+}
+
+} // namespace vm
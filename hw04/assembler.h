@@ -0,0 +1,148 @@
+#pragma once
+
+#include <cstddef>
+#include <istream>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "pool.h"
+#include "vm.h"
+
+
+namespace vm {
+
+/**
+ * assemble one line of program text, i.e. an instruction name
+ * and an optional argument separated by spaces or tabs.
+ *
+ * the line is tokenized in place, nothing is allocated unless it is invalid.
+ * errors are raised as `invalid_instruction` naming the line number.
+ *
+ * @param vm: which vm to use for assembling instructions
+ * @param line: the program line, without its line break
+ * @param line_number: position of the line in the program, for error messages
+ *
+ * @return the instruction, or nothing for a blank line
+ */
+std::optional<op_t> assemble_line(const vm_state& vm, std::string_view line, size_t line_number);
+
+
+/**
+ * assembler for program text that arrives in pieces,
+ * e.g. read block-wise from a file or socket.
+ *
+ * chunks may end anywhere, even within a line.
+ * only a line that is split between two chunks is copied.
+ *
+ * tail calls are turned into jumps: for `CALL f; RET` the callee can return
+ * to our caller directly, so `CALL f` becomes `JMP f`. the RET stays,
+ * it may still be a jump target. recursion in tail position then runs
+ * in constant return stack space.
+ */
+class assembler {
+public:
+    /**
+     * @param vm: which vm to use for assembling instructions,
+     *            must outlive the assembler
+     */
+    explicit assembler(const vm_state& vm);
+
+    /**
+     * assemble all lines the chunk completes, and keep its
+     * incomplete last line until the next chunk arrives.
+     */
+    void feed(std::string_view chunk);
+
+    /**
+     * assemble the remaining incomplete line.
+     *
+     * @return the code for all fed chunks
+     */
+    code_t finish();
+
+private:
+    void add_line(std::string_view line);
+
+    /** turn a CALL just before a RET into a JMP */
+    void eliminate_tail_call();
+
+    const vm_state& vm;
+    code_t code;
+
+    /** ids of the instructions involved in tail calls */
+    std::optional<op_id_t> call_id;
+    std::optional<op_id_t> ret_id;
+    std::optional<op_id_t> jmp_id;
+
+    /** start of a line that continues in the next chunk */
+    std::string partial;
+
+    /** number of lines assembled so far */
+    size_t lines = 0;
+};
+
+
+/**
+ * assembler for very large programs that uses several threads.
+ *
+ * the text is split at line breaks into chunks. a first parallel pass
+ * counts the lines and instructions of each chunk, so every chunk knows
+ * its first line number and where its instructions go in the result.
+ * the second pass assembles the chunks directly into their slices.
+ *
+ * the result is the same as from `assemble`, including tail call elimination.
+ * of several invalid lines, the error for the first one is reported.
+ */
+class parallel_assembler {
+public:
+    /** default for the approximate size of a chunk in bytes */
+    static constexpr size_t default_chunk_size = 256 * 1024;
+
+    /**
+     * @param vm: which vm to use for assembling instructions,
+     *            must outlive the assembler
+     * @param threads: number of worker threads, 0 for one per hardware thread
+     * @param chunk_size: approximate size of the chunks in bytes
+     */
+    explicit parallel_assembler(const vm_state& vm, size_t threads = 0,
+                                size_t chunk_size = default_chunk_size);
+
+    /** number of worker threads */
+    size_t threads() const;
+
+    /**
+     * assemble a whole program text.
+     */
+    code_t assemble(std::string_view program);
+
+    /**
+     * assemble the program text stored in a file, which is mapped into memory.
+     */
+    code_t assemble_file(const std::string& path);
+
+private:
+    const vm_state& vm;
+    work_stealing_pool pool;
+    size_t chunk_size;
+
+    /** ids of the instructions involved in tail calls */
+    std::optional<op_id_t> call_id;
+    std::optional<op_id_t> ret_id;
+    std::optional<op_id_t> jmp_id;
+};
+
+
+/**
+ * assemble the program text read from a stream.
+ */
+code_t assemble(const vm_state& vm, std::istream& input);
+
+
+/**
+ * assemble the program text stored in a file.
+ * the file is mapped into memory, not copied.
+ */
+code_t assemble_file(const vm_state& vm, const std::string& path);
+
+} // namespace vm
@@ -0,0 +1,86 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <tuple>
+#include <utility>
+
+#include "dispatch.h"
+
+
+namespace vm {
+
+namespace {
+
+/**
+ * execute code on a worker's vm and reset the vm afterwards.
+ */
+batch_result execute(vm_state& vm, const threaded_code_t& code,
+                     std::span<const item_t> initial_stack = {}) {
+    batch_result result;
+    try {
+        for (item_t item : initial_stack) {
+            vm.stack.push(item);
+        }
+        std::tie(result.tos, result.output) = run_threaded(vm, code);
+    }
+    catch (...) {
+        result.error = std::current_exception();
+    }
+
+    vm.pc = 0;
+    vm.stack.clear();
+    vm.calls.clear();
+    vm.memory.clear();
+    vm.output = output_sink{};
+    return result;
+}
+
+} // namespace
+
+
+batch_executor::batch_executor(const vm_state& vm, size_t threads)
+    : pool{threads} {
+
+    vm_state prototype;
+    prototype.instructions = vm.instructions;
+    prototype.stack = operand_stack{vm.stack.max_depth()};
+    prototype.calls = return_stack{vm.calls.max_depth()};
+    prototype.memory = linear_memory{vm.memory.max_size()};
+    this->workers.resize(this->pool.size(), prototype);
+}
+
+
+size_t batch_executor::threads() const {
+    return this->pool.size();
+}
+
+
+std::vector<batch_result> batch_executor::run(std::span<const code_t> programs) {
+    std::vector<batch_result> results(programs.size());
+
+    this->pool.parallel_for(programs.size(), [&](size_t index, size_t worker) {
+        vm_state& vm = this->workers[worker];
+        results[index] = execute(vm, compile_threaded(vm, programs[index]));
+    });
+    return results;
+}
+
+
+std::vector<batch_result> batch_executor::run(code_view_t program,
+                                              std::span<const std::vector<item_t>> initial_stacks) {
+    std::vector<batch_result> results(initial_stacks.size());
+    if (initial_stacks.empty()) {
+        return results;
+    }
+
+    // compile once, verified for the smallest initial stack
+    size_t entry_depth = std::ranges::min(initial_stacks, {}, [](const auto& stack) { return stack.size(); }).size();
+    threaded_code_t code = compile_threaded(this->workers.front(), program, entry_depth);
+
+    this->pool.parallel_for(initial_stacks.size(), [&](size_t index, size_t worker) {
+        results[index] = execute(this->workers[worker], code, initial_stacks[index]);
+    });
+    return results;
+}
+
+} // namespace vm
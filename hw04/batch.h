@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "pool.h"
+#include "vm.h"
+
+
+namespace vm {
+
+/**
+ * outcome of one run in a batch.
+ */
+struct batch_result {
+    /** last TOS item */
+    item_t tos = 0;
+
+    /** result string from WRITE instructions */
+    std::string output;
+
+    /** what the run threw, e.g. `div_by_zero`. then tos and output are empty. */
+    std::exception_ptr error;
+};
+
+
+/**
+ * executes many programs, or one program on many inputs, in parallel.
+ *
+ * all runs share the instruction table of the vm the executor was
+ * created from. each worker thread has its own execution state,
+ * which is reset between runs, so a run costs no vm setup.
+ * programs are executed with `run_threaded`.
+ */
+class batch_executor {
+public:
+    /**
+     * @param vm: the vm the programs were assembled for.
+     *            its stack and memory limits are used, its execution state is not.
+     * @param threads: number of worker threads, 0 for one per hardware thread
+     */
+    explicit batch_executor(const vm_state& vm, size_t threads = 0);
+
+    /** number of worker threads */
+    size_t threads() const;
+
+    /**
+     * run each program once, from an empty stack.
+     *
+     * @return the result of each program, in the same order
+     */
+    std::vector<batch_result> run(std::span<const code_t> programs);
+
+    /**
+     * run one program once per initial stack.
+     * the last item of an initial stack is the TOS.
+     *
+     * @return the result of each run, in the order of the initial stacks
+     */
+    std::vector<batch_result> run(code_view_t program,
+                                  std::span<const std::vector<item_t>> initial_stacks);
+
+private:
+    work_stealing_pool pool;
+
+    /** execution state of each worker */
+    std::vector<vm_state> workers;
+};
+
+} // namespace vm
@@ -0,0 +1,763 @@
+#include "hw04.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+
+namespace vm {
+
+/**
+ * simple benchmarks for the VM.
+ * build with optimizations (CMAKE_BUILD_TYPE=Release) for meaningful numbers.
+ */
+namespace bench {
+
+/**
+ * run a function and return how many seconds it took.
+ */
+double measure(const std::function<void()>& fun) {
+    auto start = std::chrono::steady_clock::now();
+    fun();
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    return duration.count();
+}
+
+
+/**
+ * print one benchmark result line.
+ */
+void report(std::string_view name, size_t instructions, double seconds) {
+    std::cout << "  " << name << ": "
+              << seconds * 1000 << " ms, "
+              << static_cast<double>(instructions) / seconds / 1e6 << " M instructions/s"
+              << std::endl;
+}
+
+
+/**
+ * a tight loop counting down from `iterations` to zero.
+ *
+ * executes 5 instructions per iteration.
+ */
+std::string countdown_program(size_t iterations) {
+    return ("LOAD_CONST " + std::to_string(iterations) + "\n"
+            "LOAD_CONST -1\n"
+            "ADD\n"
+            "DUP\n"
+            "JMPZ 6\n"
+            "JMP 1\n"
+            "EXIT\n");
+}
+
+/**
+ * fill an array with 1..n, then sum it up in another memory cell.
+ *
+ * executes about 20 instructions per array item.
+ */
+std::string array_program(size_t n) {
+    std::string count = std::to_string(n);
+    return ("LOAD_CONST " + count + "\n"
+            "LOAD_CONST 1\n"
+            "ADD\n"
+            "ALLOC\n"
+            "POP\n"
+            // fill: memory[i - 1] = i
+            "LOAD_CONST " + count + "\n"
+            "DUP\n"
+            "DUP\n"
+            "STORE -1\n"
+            "LOAD_CONST -1\n"
+            "ADD\n"
+            "DUP\n"
+            "JMPZ 14\n"
+            "JMP 6\n"
+            // sum into memory[n]
+            "POP\n"
+            "LOAD_CONST " + count + "\n"
+            "DUP\n"
+            "LOAD -1\n"
+            "LOAD_CONST " + count + "\n"
+            "LOAD 0\n"
+            "ADD\n"
+            "LOAD_CONST " + count + "\n"
+            "STORE 0\n"
+            "LOAD_CONST -1\n"
+            "ADD\n"
+            "DUP\n"
+            "JMPZ 28\n"
+            "JMP 16\n"
+            "LOAD_CONST " + count + "\n"
+            "LOAD 0\n"
+            "EXIT\n");
+}
+
+
+/**
+ * compare the dispatch engines on a tight loop.
+ * instructions/s are given in instructions of the unoptimized program.
+ */
+void dispatch() {
+    constexpr size_t iterations = 10'000'000;
+    constexpr size_t instructions = 5 * iterations + 2;
+    std::string program = countdown_program(iterations);
+
+    std::cout << "dispatch: countdown loop, " << instructions << " instructions" << std::endl;
+
+    {
+        vm_state state = create_vm();
+        code_t code = assemble(state, program);
+        report("run", instructions, measure([&] { run(state, code); }));
+    }
+    {
+        vm_state state = create_vm();
+        code_t code = assemble(state, program);
+        profile profiled;
+        report("run (profiled)", instructions, measure([&] { run(state, code, profiled); }));
+    }
+    {
+        vm_state state = create_vm();
+        code_t code = assemble(state, program);
+        trace_buffer trace;
+        report("run (traced)", instructions, measure([&] { run(state, code, trace); }));
+    }
+    {
+        vm_state state = create_vm();
+        threaded_code_t code = compile_threaded(state, assemble(state, program));
+        code.verified = false;
+        report("run_threaded (checked)", instructions, measure([&] { run_threaded(state, code); }));
+    }
+    {
+        // countdown_program(iterations), assembled at compile time
+        static_assert(iterations == 10'000'000);
+        static constexpr auto code = vm::assemble<"LOAD_CONST 10000000\n"
+                                                  "LOAD_CONST -1\n"
+                                                  "ADD\n"
+                                                  "DUP\n"
+                                                  "JMPZ 6\n"
+                                                  "JMP 1\n"
+                                                  "EXIT\n">();
+        vm_state state = create_vm();
+        report("run<program>", instructions, measure([&] { run<code>(state); }));
+    }
+    {
+        vm_state state = create_vm();
+        threaded_code_t code = compile_threaded(state, assemble(state, program));
+        report("run_threaded (verified)", instructions, measure([&] { run_threaded(state, code); }));
+    }
+    {
+        vm_state state = create_vm();
+        threaded_code_t code = compile_threaded(state, optimize(state, assemble(state, program)));
+        report("run_threaded (optimized)", instructions, measure([&] { run_threaded(state, code); }));
+    }
+    {
+        vm_state state = create_vm();
+        jit_program code{state, optimize(state, assemble(state, program))};
+        report(code.is_native() ? "jit" : "jit (not available)", instructions,
+               measure([&] { code.run(state); }));
+    }
+}
+
+/**
+ * a long straight-line program with `lines` instructions.
+ */
+std::string long_program(size_t lines) {
+    std::string program;
+    program.reserve(lines * 16);
+    program += "LOAD_CONST 0\n";
+    for (size_t i = 1; i + 1 < lines; i += 2) {
+        program += "LOAD_CONST " + std::to_string(i) + "\nADD\n";
+    }
+    program += "EXIT\n";
+    return program;
+}
+
+
+/**
+ * compare program startup: assembling text vs. mapping bytecode.
+ */
+void bytecode() {
+    constexpr size_t lines = 1'000'000;
+    std::string program = long_program(lines);
+    std::string path = (std::filesystem::temp_directory_path() / "benchhw04.vmbc").string();
+
+    std::cout << "bytecode: loading " << lines << " instructions ("
+              << program.size() / 1024 << " KiB of text)" << std::endl;
+
+    vm_state state = create_vm();
+    code_t code;
+    double seconds = measure([&] { code = assemble(state, program); });
+    report("assemble", lines, seconds);
+
+    bytecode::save(state, code, path);
+    seconds = measure([&] {
+        mapped_program mapped{state, path};
+        run(state, mapped.code());
+    });
+    report("map + run", lines, seconds);
+    seconds = measure([&] {
+        code = assemble(state, program);
+        state.pc = 0;
+        run(state, code);
+    });
+    report("assemble + run", lines, seconds);
+
+    std::filesystem::remove(path);
+}
+
+
+/**
+ * output-heavy program: writes every counter value of a countdown loop.
+ */
+void output() {
+    constexpr size_t iterations = 2'000'000;
+    constexpr size_t instructions = 9 * iterations + 2;
+    std::string program = ("LOAD_CONST " + std::to_string(iterations) + "\n"
+                           "WRITE\n"
+                           "LOAD_CONST 10\n"
+                           "WRITE_CHAR\n"
+                           "POP\n"
+                           "LOAD_CONST -1\n"
+                           "ADD\n"
+                           "DUP\n"
+                           "JMPZ 10\n"
+                           "JMP 1\n"
+                           "EXIT\n");
+
+    std::cout << "output: " << iterations << " lines written" << std::endl;
+
+    {
+        vm_state state = create_vm();
+        code_t code = assemble(state, program);
+        size_t size = 0;
+        report("collected result", instructions, measure([&] { size = std::get<1>(run(state, code)).size(); }));
+        std::cout << "  (" << size / 1024 << " KiB of output)" << std::endl;
+    }
+    {
+        vm_state state = create_vm();
+        std::ostringstream stream;
+        state.output = output_sink::to_stream(stream);
+        code_t code = assemble(state, program);
+        report("to_stream", instructions, measure([&] { run(state, code); }));
+    }
+    {
+        vm_state state = create_vm();
+        std::string buffer;
+        state.output = output_sink::to_buffer(buffer);
+        code_t code = assemble(state, program);
+        report("to_buffer", instructions, measure([&] { run(state, code); }));
+    }
+}
+
+
+/**
+ * batch execution of many small programs, on 1 to all hardware threads.
+ */
+void batch() {
+    constexpr size_t programs = 20'000;
+    constexpr size_t iterations = 1'000;
+    constexpr size_t instructions = programs * (5 * iterations + 2);
+
+    vm_state state = create_vm();
+    std::vector<code_t> codes;
+    for (size_t i = 0; i < programs; i++) {
+        codes.push_back(assemble(state, countdown_program(iterations + i % 10)));
+    }
+    code_t countdown = assemble(state,
+                                "LOAD_CONST -1\n"
+                                "ADD\n"
+                                "DUP\n"
+                                "JMPZ 5\n"
+                                "JMP 0\n"
+                                "EXIT\n");
+    std::vector<std::vector<item_t>> stacks;
+    for (size_t i = 0; i < programs; i++) {
+        stacks.push_back({static_cast<item_t>(iterations + i % 10)});
+    }
+
+    size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "batch: " << programs << " countdown programs, up to "
+              << max_threads << " threads" << std::endl;
+
+    // powers of two, and all threads
+    for (size_t threads = 1; ; threads = std::min(threads * 2, max_threads)) {
+        batch_executor executor{state, threads};
+        std::string name = std::to_string(threads) + " threads";
+        report(name + ", programs", instructions, measure([&] { executor.run(codes); }));
+        report(name + ", initial stacks", instructions, measure([&] { executor.run(countdown, stacks); }));
+        if (threads == max_threads) {
+            break;
+        }
+    }
+}
+
+
+/**
+ * cooperative scheduling: many vms interleaved with `step`,
+ * compared to running them one after another.
+ */
+void step() {
+    constexpr size_t vms = 1'000;
+    constexpr size_t iterations = 10'000;
+    constexpr size_t instructions = vms * (5 * iterations + 2);
+
+    vm_state state = create_vm();
+    threaded_code_t code = compile_threaded(state, assemble(state, countdown_program(iterations)));
+
+    std::cout << "step: " << vms << " countdown programs" << std::endl;
+
+    report("run_threaded, sequential", instructions, measure([&] {
+        for (size_t i = 0; i < vms; i++) {
+            vm_state vm = state;
+            run_threaded(vm, code);
+        }
+    }));
+
+    for (size_t budget : {100, 1'000, 10'000}) {
+        report("step, budget " + std::to_string(budget), instructions, measure([&] {
+            std::vector<vm_state> running(vms, state);
+            while (not running.empty()) {
+                for (size_t i = 0; i < running.size();) {
+                    if (vm::step(running[i], code, budget).exited) {
+                        std::swap(running[i], running.back());
+                        running.pop_back();
+                    }
+                    else {
+                        i++;
+                    }
+                }
+            }
+        }));
+    }
+}
+
+
+/**
+ * forking a warmed-up vm, compared to building its state again.
+ */
+void snapshot() {
+    constexpr size_t forks = 100'000;
+    constexpr size_t depth = 10'000;
+
+    vm_state state = create_vm();
+    for (size_t i = 0; i < depth; i++) {
+        state.stack.push(static_cast<item_t>(i));
+        state.output.write(static_cast<item_t>(i));
+    }
+    code_t tail = assemble(state,
+                           "ADD\n"
+                           "WRITE\n"
+                           "EXIT\n");
+
+    std::cout << "snapshot: " << forks << " forks of a vm with " << depth << " stack items and "
+              << state.output.pending().size() / 1024 << " KiB of output" << std::endl;
+
+    vm_snapshot warm = vm::snapshot(state);
+    double seconds = measure([&] {
+        for (size_t i = 0; i < forks; i++) {
+            vm_state forked = fork(warm);
+        }
+    });
+    std::cout << "  fork: " << seconds / forks * 1e9 << " ns" << std::endl;
+
+    seconds = measure([&] {
+        for (size_t i = 0; i < forks; i++) {
+            vm_state forked = fork(warm);
+            forked.pc = 0;
+            run(forked, tail);
+        }
+    });
+    std::cout << "  fork + run tail: " << seconds / forks * 1e9 << " ns" << std::endl;
+}
+
+
+/**
+ * array-heavy program on the linear memory.
+ */
+void memory() {
+    constexpr size_t items = 1'000'000;
+    constexpr size_t instructions = 20 * items;
+    std::string program = array_program(items);
+
+    std::cout << "memory: fill and sum an array of " << items << " items" << std::endl;
+
+    {
+        vm_state state = create_vm();
+        code_t code = assemble(state, program);
+        report("run", instructions, measure([&] { run(state, code); }));
+    }
+    {
+        vm_state state = create_vm();
+        threaded_code_t code = compile_threaded(state, assemble(state, program));
+        report("run_threaded", instructions, measure([&] { run_threaded(state, code); }));
+    }
+    {
+        vm_state state = create_vm();
+        jit_program code{state, optimize(state, assemble(state, program))};
+        report(code.is_native() ? "jit" : "jit (not available)", instructions,
+               measure([&] { code.run(state); }));
+    }
+}
+
+
+/**
+ * subroutine calls: recursion that returns through every frame,
+ * and recursion in tail position, which the assembler turns into jumps.
+ */
+void call() {
+    constexpr size_t depth = 10'000;
+    constexpr size_t repeat = 500;
+    // sum(n) = n == 0 ? 0 : n + sum(n - 1)
+    std::string recursive = ("LOAD_CONST " + std::to_string(depth) + "\n"
+                             "CALL 3\n"
+                             "EXIT\n"
+                             "DUP\n"
+                             "JMPZ 10\n"
+                             "DUP\n"
+                             "LOAD_CONST -1\n"
+                             "ADD\n"
+                             "CALL 3\n"
+                             "ADD\n"
+                             "RET\n");
+
+    // count(n) = n == 0 ? 0 : count(n - 1)
+    std::string tail = ("LOAD_CONST " + std::to_string(depth * 2) + "\n"
+                        "CALL 3\n"
+                        "EXIT\n"
+                        "DUP\n"
+                        "JMPZ 8\n"
+                        "LOAD_CONST -1\n"
+                        "ADD\n"
+                        "CALL 3\n"
+                        "RET\n");
+
+    std::cout << "call: recursion " << depth << " deep, " << repeat << " times" << std::endl;
+
+    // 8 instructions per level of recursion, 5 per tail call
+    const std::tuple<std::string_view, std::string, size_t> programs[] = {
+        {"recursive", recursive, 8 * depth * repeat},
+        {"tail call", tail, 5 * 2 * depth * repeat},
+    };
+    for (const auto& [name, program, instructions] : programs) {
+        vm_state state = create_vm();
+        threaded_code_t code = compile_threaded(state, assemble(state, program));
+        report(std::string{name} + " (run_threaded)", instructions, measure([&] {
+            for (size_t i = 0; i < repeat; i++) {
+                state.pc = 0;
+                state.stack.clear();
+                run_threaded(state, code);
+            }
+        }));
+    }
+}
+
+
+/**
+ * one scoring formula over many input tuples, in lockstep lanes
+ * compared to one interpreter run per tuple.
+ */
+void lanes() {
+    constexpr size_t tuples = 4'000'000;
+    // score = a + (b + c) / 3, or 1000 if that is zero
+    const std::string program = ("ADD\n"
+                                 "LOAD_CONST 3\n"
+                                 "DIV\n"
+                                 "ADD\n"
+                                 "DUP\n"
+                                 "JMPZ 7\n"
+                                 "EXIT\n"
+                                 "LOAD_CONST 1000\n"
+                                 "ADD\n"
+                                 "EXIT\n");
+    // 7 instructions per tuple, 3 more if the score is zero
+    constexpr size_t instructions = 7 * tuples;
+
+    std::vector<item_t> inputs;
+    std::vector<std::vector<item_t>> stacks;
+    for (size_t i = 0; i < tuples; i++) {
+        std::vector<item_t> tuple{static_cast<item_t>(i % 13) - 6, static_cast<item_t>(i % 7), static_cast<item_t>(i % 11)};
+        inputs.insert(std::end(inputs), std::begin(tuple), std::end(tuple));
+        stacks.push_back(std::move(tuple));
+    }
+
+    std::cout << "lanes: scoring formula over " << tuples << " tuples" << std::endl;
+
+    vm_state state = create_vm();
+    code_t code = assemble(state, program);
+    {
+        lane_program lanes{state, code, 3};
+        report(lanes.is_vectorized() ? "lanes" : "lanes (not vectorized)", instructions,
+               measure([&] { lanes.run(inputs); }));
+    }
+    {
+        batch_executor executor{state, 1};
+        report("batch, 1 thread", instructions, measure([&] { executor.run(code, stacks); }));
+    }
+}
+
+
+/**
+ * a large straight-line program, in the regular and the packed encodings.
+ * the program doesn't fit into the caches, so its size matters.
+ */
+void packed() {
+    constexpr size_t lines = 8'000'000;
+    constexpr size_t repeat = 5;
+    constexpr size_t instructions = lines * repeat;
+
+    // sums stay within 32 bits
+    std::string program = "LOAD_CONST 0\n";
+    for (size_t i = 1; i + 1 < lines; i += 2) {
+        program += "LOAD_CONST " + std::to_string(i % 100) + "\nADD\n";
+    }
+    program += "EXIT\n";
+
+    vm_state state = create_vm();
+    code_t code = assemble(state, program);
+    threaded_code_t threaded = compile_threaded(state, code);
+    packed_code_t narrow = pack<int32_t>(state, code);
+    basic_packed_code<int64_t> wide = pack<int64_t>(state, code);
+
+    std::cout << "packed: " << lines << " instructions, "
+              << threaded.ops.size() * sizeof(threaded_op) / (1024 * 1024) << " MiB threaded, "
+              << wide.bytes() / (1024 * 1024) << " MiB packed 64 bit, "
+              << narrow.bytes() / (1024 * 1024) << " MiB packed 32 bit" << std::endl;
+
+    report("run_threaded", instructions, measure([&] {
+        for (size_t i = 0; i < repeat; i++) {
+            vm_state vm = create_vm();
+            run_threaded(vm, threaded);
+        }
+    }));
+    report("run_packed, 64 bit", instructions, measure([&] {
+        for (size_t i = 0; i < repeat; i++) {
+            basic_vm_state<int64_t> vm;
+            run_packed(vm, wide);
+        }
+    }));
+    report("run_packed, 32 bit", instructions, measure([&] {
+        for (size_t i = 0; i < repeat; i++) {
+            basic_vm_state<int32_t> vm;
+            run_packed(vm, narrow);
+        }
+    }));
+}
+
+
+/**
+ * stack code against its register form.
+ * besides the time, both report how many instructions they dispatched.
+ * the programs of the hw04 tests are too short to time a single run,
+ * they are repeated on the same vm.
+ */
+void registers() {
+    constexpr size_t iterations = 10'000'000;
+    constexpr size_t items = 1'000'000;
+    constexpr size_t test_repeat = 1'000'000;
+
+    struct benchmark_program {
+        std::string_view name;
+        std::string text;
+        size_t repeat;
+    };
+
+    const std::vector<benchmark_program> programs = {
+        {"countdown", countdown_program(iterations), 1},
+        {"array", array_program(items), 1},
+        {"test write_2", "LOAD_CONST 10\n"
+                         "LOAD_CONST 20\n"
+                         "WRITE\n"
+                         "POP\n"
+                         "WRITE\n"
+                         "EXIT\n", test_repeat},
+        {"test write_char_2", "LOAD_CONST 36\n"
+                              "LOAD_CONST 1337\n"
+                              "LOAD_CONST 101\n"
+                              "WRITE_CHAR\n"
+                              "POP\n"
+                              "WRITE\n"
+                              "POP\n"
+                              "WRITE_CHAR\n"
+                              "EXIT\n", test_repeat},
+        {"test jmp_3", "JMP 5\n"
+                       "LOAD_CONST 123\n"
+                       "LOAD_CONST 912\n"
+                       "JMP 7\n"
+                       "LOAD_CONST 852\n"
+                       "JMP 2\n"
+                       "LOAD_CONST 601\n"
+                       "EXIT\n", test_repeat},
+        {"test jmpz_2", "LOAD_CONST 701\n"
+                        "LOAD_CONST 20\n"
+                        "EQ\n"
+                        "JMPZ 6\n"
+                        "LOAD_CONST 8001\n"
+                        "JMP 7\n"
+                        "LOAD_CONST 6231\n"
+                        "EXIT\n", test_repeat},
+        {"test memory", "LOAD_CONST 11\n"
+                        "ALLOC\n"
+                        "POP\n"
+                        "LOAD_CONST 10\n"
+                        "DUP\n"
+                        "DUP\n"
+                        "STORE -1\n"
+                        "LOAD_CONST -1\n"
+                        "ADD\n"
+                        "DUP\n"
+                        "JMPZ 12\n"
+                        "JMP 4\n"
+                        "POP\n"
+                        "LOAD_CONST 10\n"
+                        "DUP\n"
+                        "LOAD -1\n"
+                        "LOAD_CONST 10\n"
+                        "LOAD 0\n"
+                        "ADD\n"
+                        "LOAD_CONST 10\n"
+                        "STORE 0\n"
+                        "LOAD_CONST -1\n"
+                        "ADD\n"
+                        "DUP\n"
+                        "JMPZ 26\n"
+                        "JMP 14\n"
+                        "LOAD_CONST 10\n"
+                        "LOAD 0\n"
+                        "EXIT\n", test_repeat / 10},
+    };
+
+    vm_state state = create_vm();
+    for (const auto& [name, program, repeat] : programs) {
+        code_t code = assemble(state, program);
+        threaded_code_t threaded = compile_threaded(state, code);
+        register_program translated{state, code};
+
+        profile stack_profile;
+        {
+            vm_state vm = create_vm();
+            run(vm, code, stack_profile);
+        }
+        size_t stack_dispatches = 0;
+        for (size_t count : stack_profile.hotness) {
+            stack_dispatches += count;
+        }
+        size_t register_dispatches = 0;
+        {
+            vm_state vm = create_vm();
+            translated.run(vm, register_dispatches);
+        }
+
+        std::cout << "registers, " << name << ": "
+                  << code.size() << " stack instructions, "
+                  << translated.ops().size() << " register instructions, "
+                  << stack_dispatches << " vs " << register_dispatches << " dispatches";
+        if (repeat > 1) {
+            std::cout << ", " << repeat << " runs";
+        }
+        std::cout << std::endl;
+
+        // each run starts over on the same vm
+        auto repeated = [&](const auto& run_once) {
+            return measure([&] {
+                vm_state vm = create_vm();
+                for (size_t i = 0; i < repeat; i++) {
+                    vm.pc = 0;
+                    vm.stack.clear();
+                    vm.memory.clear();
+                    vm.output = output_sink{};
+                    run_once(vm);
+                }
+            });
+        };
+
+        // instructions/s are given in executed stack instructions
+        report("run_threaded", stack_dispatches * repeat, repeated([&](vm_state& vm) {
+            run_threaded(vm, threaded);
+        }));
+        report("register_program", stack_dispatches * repeat, repeated([&](vm_state& vm) {
+            translated.run(vm);
+        }));
+    }
+}
+
+
+/**
+ * assembler throughput on multi-megabyte programs, from memory, a stream and a file,
+ * and with the parallel assembler.
+ */
+void assembler() {
+    constexpr size_t lines = 4'000'000;
+    std::string program = long_program(lines);
+    std::string path = (std::filesystem::temp_directory_path() / "benchhw04.vm").string();
+    {
+        std::ofstream out{path, std::ios::binary | std::ios::trunc};
+        out << program;
+    }
+
+    double megabytes = static_cast<double>(program.size()) / (1024 * 1024);
+    std::cout << "assembler: " << lines << " instructions ("
+              << megabytes << " MiB of text)" << std::endl;
+
+    auto report_throughput = [&](std::string_view name, double seconds) {
+        std::cout << "  " << name << ": "
+                  << seconds * 1000 << " ms, "
+                  << megabytes / seconds << " MiB/s" << std::endl;
+    };
+
+    vm_state state = create_vm();
+    report_throughput("string", measure([&] { assemble(state, program); }));
+    report_throughput("istream", measure([&] {
+        std::istringstream input{program};
+        assemble(state, input);
+    }));
+    report_throughput("file", measure([&] { assemble_file(state, path); }));
+
+    for (size_t threads : {2u, 4u, std::max(1u, std::thread::hardware_concurrency())}) {
+        parallel_assembler parallel{state, threads};
+        report_throughput("parallel, " + std::to_string(threads) + " threads",
+                          measure([&] { parallel.assemble(program); }));
+    }
+
+    std::filesystem::remove(path);
+}
+
+} // namespace bench
+} // namespace vm
+
+
+int main(int argc, char** argv) {
+    const std::vector<std::pair<std::string_view, std::function<void()>>> benchmarks = {
+        {"dispatch", vm::bench::dispatch},
+        {"bytecode", vm::bench::bytecode},
+        {"output", vm::bench::output},
+        {"batch", vm::bench::batch},
+        {"step", vm::bench::step},
+        {"snapshot", vm::bench::snapshot},
+        {"memory", vm::bench::memory},
+        {"call", vm::bench::call},
+        {"lanes", vm::bench::lanes},
+        {"packed", vm::bench::packed},
+        {"registers", vm::bench::registers},
+        {"assembler", vm::bench::assembler},
+    };
+
+    // run all benchmarks, or only the ones given as arguments
+    for (const auto& [name, benchmark] : benchmarks) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; i++) {
+            selected |= name == argv[i];
+        }
+        if (selected) {
+            benchmark();
+        }
+    }
+    return 0;
+}
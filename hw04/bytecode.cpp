@@ -0,0 +1,251 @@
+#include "bytecode.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+namespace vm {
+
+namespace {
+
+struct file_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t name_count;
+    uint64_t names_size;
+    uint64_t code_count;
+};
+
+struct file_instruction {
+    uint64_t op_id;
+    int64_t arg;
+};
+
+constexpr char magic[4] = {'V', 'M', 'B', 'C'};
+constexpr size_t alignment = 16;
+
+static_assert(sizeof(file_header) % alignment == 0);
+// the instructions are used in place as op_t
+static_assert(sizeof(op_t) == sizeof(file_instruction));
+static_assert(offsetof(op_t, first) == offsetof(file_instruction, op_id));
+static_assert(offsetof(op_t, second) == offsetof(file_instruction, arg));
+static_assert(alignof(op_t) <= alignment);
+
+
+size_t padded(size_t size) {
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+
+/**
+ * the contents of a bytecode file, still pointing into the file data.
+ */
+struct parsed_file {
+    std::vector<std::pair<op_id_t, std::string_view>> names;
+
+    /** the instructions, not necessarily aligned for op_t */
+    const char* code;
+    size_t code_count;
+};
+
+
+parsed_file parse(const char* data, size_t size) {
+    auto truncated = [] {
+        return invalid_instruction{"bytecode: truncated file"};
+    };
+
+    if (size < sizeof(file_header)) {
+        throw truncated();
+    }
+    file_header header;
+    std::memcpy(&header, data, sizeof(header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) {
+        throw invalid_instruction{"bytecode: not a bytecode file"};
+    }
+    if (header.version != bytecode::version) {
+        throw invalid_instruction{"bytecode: unsupported version " + std::to_string(header.version)};
+    }
+
+    size_t names_begin = sizeof(file_header);
+    size_t code_begin = names_begin + header.names_size;
+    if (header.names_size % alignment != 0 or header.names_size > size - names_begin
+        or header.code_count > (size - code_begin) / sizeof(file_instruction)) {
+        throw truncated();
+    }
+
+    parsed_file result;
+    size_t offset = names_begin;
+    for (uint64_t i = 0; i < header.name_count; i++) {
+        uint64_t entry[2];
+        if (code_begin - offset < sizeof(entry)) {
+            throw truncated();
+        }
+        std::memcpy(entry, data + offset, sizeof(entry));
+        offset += sizeof(entry);
+
+        auto& [op_id, length] = entry;
+        if (code_begin - offset < length) {
+            throw truncated();
+        }
+        result.names.emplace_back(op_id, std::string_view{data + offset, length});
+        offset += length;
+    }
+
+    result.code = data + code_begin;
+    result.code_count = header.code_count;
+    return result;
+}
+
+
+/**
+ * check the file's `code` against the vm, and translate its op_ids if they differ.
+ *
+ * @return true if the file can be used as it is
+ */
+bool resolve(const vm_state& vm, const parsed_file& file, code_view_t code, code_t& translated) {
+    std::unordered_map<op_id_t, op_id_t> op_ids;
+    bool same_ids = true;
+    for (const auto& [file_id, name] : file.names) {
+        auto vm_id = vm.instructions->ids.find(name);
+        if (vm_id == std::end(vm.instructions->ids)) {
+            throw invalid_instruction{"unknown instruction: " + std::string{name}};
+        }
+        op_ids.emplace(file_id, vm_id->second);
+        same_ids &= file_id == vm_id->second;
+    }
+
+    auto unnamed = [](op_id_t op_id) {
+        return invalid_instruction{"bytecode: no name for op_id " + std::to_string(op_id)};
+    };
+
+    if (same_ids) {
+        for (const auto& [op_id, arg] : code) {
+            if (not op_ids.contains(op_id)) {
+                throw unnamed(op_id);
+            }
+        }
+        return true;
+    }
+
+    translated.reserve(code.size());
+    for (const auto& [op_id, arg] : code) {
+        auto vm_id = op_ids.find(op_id);
+        if (vm_id == std::end(op_ids)) {
+            throw unnamed(op_id);
+        }
+        translated.emplace_back(vm_id->second, arg);
+    }
+    return false;
+}
+
+} // namespace
+
+
+namespace bytecode {
+
+void save(const vm_state& vm, code_view_t code, const std::string& path) {
+    std::vector<op_id_t> used;
+    for (const auto& [op_id, arg] : code) {
+        if (std::find(std::begin(used), std::end(used), op_id) == std::end(used)) {
+            used.push_back(op_id);
+        }
+    }
+
+    std::string names;
+    for (op_id_t op_id : used) {
+        auto name = vm.instructions->names.find(op_id);
+        if (name == std::end(vm.instructions->names)) {
+            throw invalid_instruction{"unknown op_id: " + std::to_string(op_id)};
+        }
+        uint64_t entry[2] = {op_id, name->second.size()};
+        names.append(reinterpret_cast<const char*>(entry), sizeof(entry));
+        names.append(name->second);
+    }
+    names.resize(padded(names.size()), '\0');
+
+    file_header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.name_count = used.size();
+    header.names_size = names.size();
+    header.code_count = code.size();
+
+    // streams don't report why they failed, errno isn't reliably set
+    auto failed = [&](std::string_view what) {
+        return std::system_error{std::make_error_code(std::io_errc::stream), std::string{what} + path};
+    };
+
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+    if (not out) {
+        throw failed("can't open ");
+    }
+    auto write = [&](const void* data, size_t size) {
+        out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        if (not out) {
+            throw failed("can't write ");
+        }
+    };
+
+    write(&header, sizeof(header));
+    write(names.data(), names.size());
+    for (const auto& [op_id, arg] : code) {
+        file_instruction instruction{op_id, arg};
+        write(&instruction, sizeof(instruction));
+    }
+    out.close();
+    if (not out) {
+        throw failed("can't write ");
+    }
+}
+
+} // namespace bytecode
+
+
+mapped_program::mapped_program(const vm_state& vm, const std::string& path)
+    : file{path} {
+
+    std::string_view data = file.data();
+    parsed_file parsed = parse(data.data(), data.size());
+
+    // a mapping is page aligned, file contents in a plain buffer
+    // may not be aligned for op_t and are only read through a copy
+    code_t aligned;
+    code_view_t code;
+    if (file.mapped()) {
+        code = {reinterpret_cast<const op_t*>(parsed.code), parsed.code_count};
+    }
+    else {
+        aligned.reserve(parsed.code_count);
+        for (size_t pc = 0; pc < parsed.code_count; pc++) {
+            file_instruction instruction;
+            std::memcpy(&instruction, parsed.code + pc * sizeof(instruction), sizeof(instruction));
+            aligned.emplace_back(instruction.op_id, instruction.arg);
+        }
+        code = aligned;
+    }
+
+    bool usable = resolve(vm, parsed, code, translated);
+    if (usable and not file.mapped()) {
+        translated = std::move(aligned);
+        usable = false;
+    }
+    instructions = usable ? code : code_view_t{translated};
+}
+
+
+code_view_t mapped_program::code() const {
+    return instructions;
+}
+
+
+bool mapped_program::in_place() const {
+    return file.mapped() and instructions.data() != translated.data();
+}
+
+} // namespace vm
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "util.h"
+#include "vm.h"
+
+
+namespace vm {
+
+/**
+ * binary serialization of assembled code.
+ *
+ * layout, in host byte order:
+ *   header:       magic "VMBC", uint32 version, uint64 name count,
+ *                 uint64 name table bytes, uint64 instruction count
+ *   name table:   per entry uint64 op_id, uint64 length, name bytes;
+ *                 padded with zeros to a multiple of 16 bytes
+ *   instructions: per instruction uint64 op_id, int64 argument
+ *
+ * the instructions have the memory layout of `op_t`,
+ * so a mapped file can be executed without copying it.
+ * the name table lists the instructions the code uses,
+ * so it can be loaded into any vm that knows them.
+ */
+namespace bytecode {
+
+constexpr uint32_t version = 1;
+
+/**
+ * write code assembled for a vm to a bytecode file.
+ *
+ * @param vm: the vm the code was assembled for
+ * @param code: the assembled program
+ * @param path: file to write
+ *
+ * throws `std::system_error` if the file can't be written.
+ */
+void save(const vm_state& vm, code_view_t code, const std::string& path);
+
+} // namespace bytecode
+
+
+/**
+ * a bytecode file, mapped into memory for a vm.
+ *
+ * if the file uses the same op_ids as the vm, its instructions are executed
+ * right from the mapping. otherwise they are translated to the vm's op_ids
+ * into a copy.
+ *
+ * loading throws `invalid_instruction` for malformed files or instructions
+ * unknown to the vm, and `std::system_error` if the file can't be read.
+ */
+class mapped_program {
+public:
+    mapped_program(const vm_state& vm, const std::string& path);
+
+    /**
+     * the program's instructions, to be passed to `run`.
+     */
+    code_view_t code() const;
+
+    /**
+     * are the instructions executed directly from the mapped file?
+     */
+    bool in_place() const;
+
+private:
+    util::mapped_file file;
+
+    /** instructions translated to the vm's op_ids, if needed */
+    code_t translated;
+
+    code_view_t instructions;
+};
+
+} // namespace vm
@@ -0,0 +1,354 @@
+#include "dispatch.h"
+
+#include <iterator>
+#include <utility>
+
+#include "dispatch_common.h"
+#include "ops.h"
+#include "verify.h"
+
+
+namespace vm {
+
+namespace {
+
+/**
+ * does the instruction end a block, i.e. may it not continue at pc + 1?
+ */
+bool ends_block(opcode code) {
+    switch (code) {
+    case opcode::exit:
+    case opcode::jmp:
+    case opcode::jmpz:
+    case opcode::dup_jmpz:
+    case opcode::eq_jmpz:
+    case opcode::call:
+    case opcode::ret:
+    case opcode::custom:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+std::tuple<item_t, std::string> result(vm_state& vm) {
+    item_t tos{0};
+    if (not vm.stack.empty())
+        tos = std::as_const(vm.stack).top();
+    return {tos, vm.output.result()};
+}
+
+} // namespace
+
+
+threaded_code_t compile_threaded(const vm_state& vm, code_view_t code, size_t entry_depth) {
+    threaded_code_t compiled;
+    compiled.instructions = vm.instructions;
+    compiled.ops.reserve(code.size());
+
+    for (const auto& [op_id, arg] : code) {
+        auto builtin = vm.instructions->builtin_opcodes.find(op_id);
+        if (builtin != std::end(vm.instructions->builtin_opcodes)) {
+            compiled.ops.push_back({builtin->second, arg});
+            continue;
+        }
+
+        auto action = vm.instructions->actions.find(op_id);
+        if (action == std::end(vm.instructions->actions)) {
+            throw invalid_instruction{"unknown op_id: " + std::to_string(op_id)};
+        }
+        compiled.ops.push_back({opcode::custom, arg, &action->second});
+    }
+
+    // length of the rest of the block, from each pc to the next control transfer
+    compiled.block_length.resize(compiled.ops.size());
+    for (size_t pc = compiled.ops.size(); pc-- > 0;) {
+        bool last = ends_block(compiled.ops[pc].code) or pc + 1 == compiled.ops.size();
+        compiled.block_length[pc] = last ? 1 : 1 + compiled.block_length[pc + 1];
+    }
+
+    compiled.checked = verify(vm, code, entry_depth);
+    compiled.verified = compiled.checked.safe;
+    compiled.entry_depth = compiled.checked.entry_depth;
+    compiled.max_depth = compiled.checked.max_depth;
+
+    return compiled;
+}
+
+
+namespace {
+
+/**
+ * instructions left to execute in a `step`.
+ */
+struct budget_t {
+    size_t remaining;
+
+    /** set when the engine stopped because the next block didn't fit */
+    bool suspended = false;
+};
+
+
+VM_ENGINE_BEGIN
+
+/**
+ * the dispatch loop.
+ * without `checked`, the code must be verified and start at pc 0.
+ * with `budgeted`, each block is charged to the budget when it is entered,
+ * and the engine returns early if it doesn't fit.
+ */
+template<bool checked, bool budgeted = false>
+std::tuple<item_t, std::string> execute(vm_state& vm, const threaded_code_t& code,
+                                        budget_t* budget = nullptr) {
+    const threaded_op* const code_begin = code.ops.data();
+    const size_t code_size = code.ops.size();
+    const threaded_op* op = nullptr;
+    detail::pc_sync<vm_state> pc{vm, vm.pc};
+
+    if constexpr (not checked) {
+        // the unchecked stack operations don't unshare copied stacks
+        vm.stack.detach();
+    }
+
+#if VM_COMPUTED_GOTO
+    // same order as the `opcode` enum
+    static void* const handlers[] = {
+        &&do_print, &&do_load_const, &&do_exit, &&do_pop, &&do_add,
+        &&do_div, &&do_eq, &&do_neq, &&do_dup, &&do_jmp, &&do_jmpz,
+        &&do_write, &&do_write_char, &&do_load_const_add, &&do_dup_jmpz,
+        &&do_eq_jmpz, &&do_load_const_write_char,
+        &&do_load, &&do_store, &&do_alloc, &&do_call, &&do_ret, &&do_custom,
+    };
+    static_assert(std::size(handlers) == static_cast<size_t>(opcode::custom) + 1);
+
+#define VM_CASE(name) do_##name
+#define VM_DISPATCH() goto *handlers[static_cast<size_t>(op->code)]
+#else
+#define VM_CASE(name) case opcode::name
+#define VM_DISPATCH() goto dispatch
+#endif
+
+// fetch the instruction at pc and jump to its handler
+#define VM_NEXT()                               \
+    do {                                        \
+        if (checked and pc.value >= code_size)  \
+            goto segfault;                      \
+        op = &code_begin[pc.value++];           \
+        VM_DISPATCH();                          \
+    } while (false)
+
+// charge the block starting at pc, after a control transfer
+#define VM_CHARGE()                                                 \
+    do {                                                            \
+        if constexpr (budgeted) {                                   \
+            if (pc.value >= code_size)                              \
+                goto segfault;                                      \
+            size_t cost = code.block_length[pc.value];              \
+            if (cost > budget->remaining) {                         \
+                budget->suspended = true;                           \
+                return {};                                          \
+            }                                                       \
+            budget->remaining -= cost;                              \
+        }                                                           \
+    } while (false)
+
+    VM_CHARGE();
+    VM_NEXT();
+
+#if !VM_COMPUTED_GOTO
+dispatch:
+    switch (op->code) {
+#endif
+
+    VM_CASE(print):
+        ops::print<checked>(vm);
+        VM_NEXT();
+
+    VM_CASE(load_const):
+        ops::load_const<checked>(vm, op->arg);
+        VM_NEXT();
+
+    VM_CASE(exit):
+        ops::exit<checked>(vm);
+        return result(vm);
+
+    VM_CASE(pop):
+        ops::pop<checked>(vm);
+        VM_NEXT();
+
+    VM_CASE(add):
+        ops::add<checked>(vm);
+        VM_NEXT();
+
+    VM_CASE(div):
+        ops::div<checked>(vm);
+        VM_NEXT();
+
+    VM_CASE(eq):
+        ops::eq<checked>(vm);
+        VM_NEXT();
+
+    VM_CASE(neq):
+        ops::neq<checked>(vm);
+        VM_NEXT();
+
+    VM_CASE(dup):
+        ops::dup<checked>(vm);
+        VM_NEXT();
+
+    VM_CASE(jmp):
+        pc.value = static_cast<size_t>(op->arg);
+        VM_CHARGE();
+        VM_NEXT();
+
+    VM_CASE(jmpz):
+        if (ops::jmpz<checked>(vm))
+            pc.value = static_cast<size_t>(op->arg);
+        VM_CHARGE();
+        VM_NEXT();
+
+    VM_CASE(write):
+        ops::write<checked>(vm);
+        VM_NEXT();
+
+    VM_CASE(write_char):
+        ops::write_char<checked>(vm);
+        VM_NEXT();
+
+    VM_CASE(load_const_add):
+        ops::load_const_add<checked>(vm, op->arg);
+        VM_NEXT();
+
+    VM_CASE(dup_jmpz):
+        if (ops::dup_jmpz<checked>(vm))
+            pc.value = static_cast<size_t>(op->arg);
+        VM_CHARGE();
+        VM_NEXT();
+
+    VM_CASE(eq_jmpz):
+        if (ops::eq_jmpz<checked>(vm))
+            pc.value = static_cast<size_t>(op->arg);
+        VM_CHARGE();
+        VM_NEXT();
+
+    VM_CASE(load_const_write_char):
+        ops::load_const_write_char<checked>(vm, op->arg);
+        VM_NEXT();
+
+    VM_CASE(load):
+        ops::load<checked>(vm, op->arg);
+        VM_NEXT();
+
+    VM_CASE(store):
+        ops::store<checked>(vm, op->arg);
+        VM_NEXT();
+
+    VM_CASE(alloc):
+        ops::alloc<checked>(vm);
+        VM_NEXT();
+
+    VM_CASE(call):
+        ops::call(vm, pc.value);
+        pc.value = static_cast<size_t>(op->arg);
+        VM_CHARGE();
+        VM_NEXT();
+
+    VM_CASE(ret):
+        pc.value = ops::ret(vm);
+        VM_CHARGE();
+        VM_NEXT();
+
+    VM_CASE(custom):
+        // registered actions see and may modify the real program counter
+        vm.pc = pc.value;
+        if (not (*op->action)(vm, op->arg)) {
+            pc.value = vm.pc;
+            return result(vm);
+        }
+        pc.value = vm.pc;
+        VM_CHARGE();
+        VM_NEXT();
+
+#if !VM_COMPUTED_GOTO
+    }
+#endif
+
+#undef VM_CHARGE
+#undef VM_NEXT
+#undef VM_DISPATCH
+#undef VM_CASE
+
+segfault:
+    throw vm_segfault{"seg fault!"};
+}
+
+VM_ENGINE_END
+
+
+/**
+ * execute one instruction that doesn't transfer control,
+ * for the part of a block that `execute` couldn't fit into the budget.
+ */
+void execute_straight(vm_state& vm, const threaded_op& op) {
+    switch (op.code) {
+    case opcode::print:                 ops::print(vm); break;
+    case opcode::load_const:            ops::load_const(vm, op.arg); break;
+    case opcode::pop:                   ops::pop(vm); break;
+    case opcode::add:                   ops::add(vm); break;
+    case opcode::div:                   ops::div(vm); break;
+    case opcode::eq:                    ops::eq(vm); break;
+    case opcode::neq:                   ops::neq(vm); break;
+    case opcode::dup:                   ops::dup(vm); break;
+    case opcode::write:                 ops::write(vm); break;
+    case opcode::write_char:            ops::write_char(vm); break;
+    case opcode::load_const_add:        ops::load_const_add(vm, op.arg); break;
+    case opcode::load_const_write_char: ops::load_const_write_char(vm, op.arg); break;
+    case opcode::load:                  ops::load(vm, op.arg); break;
+    case opcode::store:                 ops::store(vm, op.arg); break;
+    case opcode::alloc:                 ops::alloc(vm); break;
+    default:
+        throw invalid_instruction{"control transfer inside a block"};
+    }
+}
+
+
+} // namespace
+
+
+std::tuple<item_t, std::string> run_threaded(vm_state& vm, const threaded_code_t& code) {
+    if (code.verified and vm.pc == 0
+        and vm.stack.size() >= code.entry_depth
+        and vm.stack.max_depth() - vm.stack.size() >= code.max_depth - code.entry_depth) {
+        return detail::flush_on_error(vm.output, [&] { return execute<false>(vm, code); });
+    }
+    return detail::flush_on_error(vm.output, [&] { return execute<true>(vm, code); });
+}
+
+
+
+step_result step(vm_state& vm, const threaded_code_t& code, size_t budget) {
+    return detail::flush_on_error(vm.output, [&] {
+        budget_t remaining{budget};
+        step_result result;
+        result.result = execute<true, true>(vm, code, &remaining);
+
+        if (not remaining.suspended) {
+            result.exited = true;
+            result.executed = budget - remaining.remaining;
+            return result;
+        }
+
+        // the next block is longer than the remaining budget:
+        // use it up on the block's leading instructions, none of them jumps
+        // pc is advanced first, a failing instruction leaves it after itself like the engines do
+        for (; remaining.remaining > 0; remaining.remaining--) {
+            size_t pc = vm.pc++;
+            execute_straight(vm, code.ops[pc]);
+        }
+        result.executed = budget;
+        return result;
+    });
+}
+
+} // namespace vm
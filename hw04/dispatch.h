@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "verify.h"
+#include "vm.h"
+
+
+namespace vm {
+
+/**
+ * one pre-resolved instruction of threaded code.
+ *
+ * built-in instructions are dispatched by their `opcode`,
+ * everything else calls the registered action directly,
+ * so no map lookup is left for execution time.
+ */
+struct threaded_op {
+    opcode code;
+    item_t arg;
+
+    /** the instruction's action, only set for `opcode::custom` */
+    const op_action_t* action = nullptr;
+};
+
+
+/**
+ * code prepared for `run_threaded`.
+ *
+ * it references the actions of the vm it was created with,
+ * so it must only be run on that vm or copies of it.
+ */
+struct threaded_code_t {
+    std::vector<threaded_op> ops;
+
+    /** keeps the referenced actions alive */
+    std::shared_ptr<const instruction_table> instructions;
+
+    /**
+     * the code passed `verify`, so it may run without stack and pc checks.
+     */
+    bool verified = false;
+
+    /**
+     * for verified code: stack depth assumed at the start,
+     * and the maximum depth reached from there.
+     */
+    size_t entry_depth = 0;
+    size_t max_depth = 0;
+
+    /**
+     * the whole result of `verify`,
+     * so the tiers that translate the code further don't verify it again.
+     */
+    verification checked;
+
+    /**
+     * number of instructions from each pc up to the end of its block,
+     * i.e. up to and including the next instruction that may jump or stop.
+     * `step` charges its budget with this whenever control is transferred.
+     */
+    std::vector<size_t> block_length;
+};
+
+
+/**
+ * resolve all instructions of assembled code to a flat dispatch array.
+ *
+ * the code is also checked with `verify`, if it is proven safe
+ * `run_threaded` can use its unchecked fast path.
+ *
+ * @param vm: the vm the code was assembled for
+ * @param code: the assembled program
+ * @param entry_depth: how many items are at least on the stack when the program starts
+ *
+ * @return the code ready to be executed by `run_threaded`
+ */
+threaded_code_t compile_threaded(const vm_state& vm, code_view_t code, size_t entry_depth = 0);
+
+
+/**
+ * execute threaded code.
+ *
+ * behaves exactly like `run`, but dispatches built-in instructions
+ * with computed gotos (or a switch where those are not available).
+ *
+ * verified code that starts at pc 0 with enough stack room
+ * runs without any stack depth or program counter checks.
+ *
+ * @return the execution results: {last TOS item, result string from WRITE instructions}
+ */
+std::tuple<item_t, std::string> run_threaded(vm_state& vm, const threaded_code_t& code);
+
+
+
+/**
+ * outcome of `step`.
+ */
+struct step_result {
+    /** the program ran until it stopped, `result` is what `run` would return */
+    bool exited = false;
+
+    /** number of instructions executed by this step */
+    size_t executed = 0;
+
+    /** the execution results, only set if the program exited */
+    std::tuple<item_t, std::string> result;
+};
+
+
+/**
+ * execute at most `budget` instructions of threaded code.
+ *
+ * if the program doesn't stop within the budget, the vm is left suspended
+ * and the next `step` continues where this one ended.
+ * so many programs can share a thread, each getting a bounded slice.
+ *
+ * the budget is charged a whole block at a time when control enters it,
+ * not per instruction. only a block that doesn't fit into the rest
+ * of the budget is executed instruction by instruction.
+ * the checks of `run_threaded`'s checked mode always apply.
+ *
+ * @param vm: the vm to run on, or to resume
+ * @param code: the program, compiled with `compile_threaded`
+ * @param budget: maximum number of instructions to execute
+ */
+step_result step(vm_state& vm, const threaded_code_t& code, size_t budget);
+
+} // namespace vm
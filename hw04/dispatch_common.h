@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+
+
+/*
+ * shared by the interpreter engines, not part of the public interface.
+ */
+
+// computed gotos ("labels as values") are a GNU extension,
+// other compilers get the portable switch dispatch.
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO 1
+
+// wrap the engines that use computed gotos, so -Wpedantic stays
+// silent about them but not about the rest of the file.
+#define VM_ENGINE_BEGIN                  \
+    _Pragma("GCC diagnostic push")       \
+    _Pragma("GCC diagnostic ignored \"-Wpedantic\"")
+#define VM_ENGINE_END _Pragma("GCC diagnostic pop")
+#else
+#define VM_COMPUTED_GOTO 0
+#define VM_ENGINE_BEGIN
+#define VM_ENGINE_END
+#endif
+
+
+namespace vm::detail {
+
+/** the position of the threaded engines is the program counter itself */
+struct same_pc {
+    size_t operator()(size_t pc) const {
+        return pc;
+    }
+};
+
+
+/**
+ * the engines keep their position in a local while running,
+ * this writes the vm's program counter from it when leaving, including by exception.
+ *
+ * @tparam VM: the vm state type
+ * @tparam Position: what the engine tracks, e.g. the pc or an instruction pointer
+ * @tparam ToPc: converts the position to the program counter
+ */
+template<typename VM, typename Position = size_t, typename ToPc = same_pc>
+struct pc_sync {
+    VM& vm;
+    Position value;
+    [[no_unique_address]] ToPc to_pc = {};
+
+    ~pc_sync() {
+        vm.pc = to_pc(value);
+    }
+};
+
+} // namespace vm::detail
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdexcept>
+
+
+namespace vm {
+
+//// exception types, thrown in various error situations.
+
+/**
+ * exception thrown when the VM attempts to divide by zero.
+ */
+struct div_by_zero : std::runtime_error {
+    using std::runtime_error::runtime_error; //inheritance of std::runtime_error constructor (I guess...)
+};
+
+
+/**
+ * exception thrown when an invalid memory address is requested.
+ */
+struct vm_segfault : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+
+/**
+ * exception thrown when the stack content is not as expected.
+ */
+struct vm_stackfail : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+
+/**
+ * exception thrown when a instruction could not be decoded.
+ */
+struct invalid_instruction : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+} // namespace vm
@@ -2,3 +2,20 @@
 
 #include "vm.h"
 #include "util.h"
+#include "output.h"
+#include "assembler.h"
+#include "dispatch.h"
+#include "verify.h"
+#include "optimize.h"
+#include "jit.h"
+#include "bytecode.h"
+#include "pool.h"
+#include "batch.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "memory.h"
+#include "trace.h"
+#include "lanes.h"
+#include "packed.h"
+#include "static_program.h"
+#include "registers.h"
@@ -0,0 +1,488 @@
+#include "jit.h"
+
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <initializer_list>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ops.h"
+#include "verify.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define VM_JIT 1
+#include <sys/mman.h>
+#else
+#define VM_JIT 0
+#endif
+
+
+namespace vm {
+
+namespace {
+
+/**
+ * shared between the machine code and the C++ helpers it calls.
+ * the machine code accesses the members by their offsets.
+ */
+struct jit_context {
+    /** next free stack slot, kept in rbx while the machine code runs */
+    item_t* sp;
+    vm_state* vm;
+    /** program counter when the machine code returned */
+    size_t pc;
+    /** what a helper has thrown */
+    std::exception_ptr error;
+};
+
+static_assert(std::is_standard_layout_v<jit_context>);
+constexpr uint8_t context_sp = offsetof(jit_context, sp);
+constexpr uint8_t context_pc = offsetof(jit_context, pc);
+
+static_assert(sizeof(item_t) == 8, "the machine code works on 64 bit stack items");
+
+
+/** value returned by the machine code */
+enum jit_status : int {
+    status_exit = 0,
+    status_div_by_zero = 1,
+    status_exception = 2,
+};
+
+
+/**
+ * give the vm's operand stack the size the machine code left it at.
+ */
+void sync_stack(jit_context* ctx) {
+    ctx->vm->stack.resize(static_cast<size_t>(ctx->sp - ctx->vm->stack.data()));
+}
+
+
+/**
+ * instructions with side effects are run in C++ by these helpers.
+ * exceptions can't pass through the machine code, so they are stored
+ * and rethrown once the machine code has returned.
+ */
+template<void (*op)(vm_state&)>
+int jit_helper(jit_context* ctx, size_t pc) noexcept {
+    try {
+        sync_stack(ctx);
+        op(*ctx->vm);
+        return status_exit;
+    }
+    catch (...) {
+        ctx->error = std::current_exception();
+        ctx->pc = pc;
+        return status_exception;
+    }
+}
+
+
+/**
+ * like `jit_helper`, for instructions that take their argument.
+ */
+template<void (*op)(vm_state&, const item_t)>
+int jit_helper_arg(jit_context* ctx, size_t pc, item_t arg) noexcept {
+    try {
+        sync_stack(ctx);
+        op(*ctx->vm, arg);
+        return status_exit;
+    }
+    catch (...) {
+        ctx->error = std::current_exception();
+        ctx->pc = pc;
+        return status_exception;
+    }
+}
+
+
+/**
+ * minimal x86-64 machine code assembler.
+ *
+ * register usage:
+ *   rbx: pointer to the next free stack slot
+ *   r12: the jit_context
+ *   rax, rcx, rdx, rsi, rdi: scratch
+ */
+class x86_emitter {
+public:
+    std::vector<uint8_t> code;
+
+    void bytes(std::initializer_list<uint8_t> data) {
+        // not `insert`, gcc's -Wstringop-overflow misjudges it for short lists
+        for (uint8_t byte : data) {
+            code.push_back(byte);
+        }
+    }
+
+    void imm32(int32_t value) {
+        auto data = reinterpret_cast<const uint8_t*>(&value);
+        code.insert(std::end(code), data, data + sizeof(value));
+    }
+
+    void imm64(int64_t value) {
+        auto data = reinterpret_cast<const uint8_t*>(&value);
+        code.insert(std::end(code), data, data + sizeof(value));
+    }
+
+    /** emit a rel32 displacement to be resolved by `patch` later */
+    size_t rel32() {
+        size_t position = code.size();
+        imm32(0);
+        return position;
+    }
+
+    /** let the rel32 at `position` point to `target` */
+    void patch(size_t position, size_t target) {
+        auto rel = static_cast<int32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(position + 4));
+        std::memcpy(&code[position], &rel, sizeof(rel));
+    }
+
+    /** push the item in rax */
+    void push_rax() {
+        bytes({0x48, 0x89, 0x03});                      // mov [rbx], rax
+        bytes({0x48, 0x83, 0xC3, 0x08});                // add rbx, 8
+    }
+
+    void push_const(item_t value) {
+        if (value >= std::numeric_limits<int32_t>::min() and value <= std::numeric_limits<int32_t>::max()) {
+            bytes({0x48, 0xC7, 0x03});                  // mov qword [rbx], imm32
+            imm32(static_cast<int32_t>(value));
+            bytes({0x48, 0x83, 0xC3, 0x08});            // add rbx, 8
+        }
+        else {
+            bytes({0x48, 0xB8});                        // mov rax, imm64
+            imm64(value);
+            push_rax();
+        }
+    }
+
+    void drop(uint8_t count) {
+        bytes({0x48, 0x83, 0xEB, static_cast<uint8_t>(8 * count)});  // sub rbx, 8 * count
+    }
+
+    /** jmp to the epilogue with the given status and pc */
+    size_t leave(jit_status status, size_t pc) {
+        bytes({0x49, 0xC7, 0x44, 0x24, context_pc});   // mov qword [r12 + pc], imm32
+        imm32(static_cast<int32_t>(pc));
+        bytes({0xB8});                                  // mov eax, imm32
+        imm32(status);
+        bytes({0xE9});                                  // jmp rel32
+        return rel32();
+    }
+
+    /** call a helper, jmp to the epilogue if it failed */
+    size_t call(int (*helper)(jit_context*, size_t), size_t pc) {
+        return call_helper(reinterpret_cast<uintptr_t>(helper), pc);
+    }
+
+    /** call a helper with the instruction argument */
+    size_t call(int (*helper)(jit_context*, size_t, item_t), size_t pc, item_t arg) {
+        bytes({0x48, 0xBA});                            // mov rdx, imm64
+        imm64(arg);
+        return call_helper(reinterpret_cast<uintptr_t>(helper), pc);
+    }
+
+private:
+    size_t call_helper(uintptr_t helper, size_t pc) {
+        bytes({0x49, 0x89, 0x1C, 0x24});                // mov [r12 + sp], rbx
+        bytes({0x4C, 0x89, 0xE7});                      // mov rdi, r12
+        bytes({0xBE});                                  // mov esi, imm32
+        imm32(static_cast<int32_t>(pc));
+        bytes({0x48, 0xB8});                            // mov rax, imm64
+        imm64(static_cast<int64_t>(helper));
+        bytes({0xFF, 0xD0});                            // call rax
+        bytes({0x85, 0xC0});                            // test eax, eax
+        bytes({0x0F, 0x85});                            // jnz rel32
+        return rel32();
+    }
+};
+
+
+/**
+ * translate verified code to machine code.
+ * the generated function is `int (jit_context*)` and returns a `jit_status`.
+ *
+ * instructions the verification found unreachable are left out:
+ * they are never executed, and their jump targets were not checked.
+ */
+std::vector<uint8_t> translate(const threaded_code_t& program, const verification& checked) {
+    static_assert(context_sp == 0);
+
+    x86_emitter x86;
+
+    // prologue. three pushes keep the stack 16 byte aligned for calls.
+    x86.bytes({0x53});                                  // push rbx
+    x86.bytes({0x41, 0x54});                            // push r12
+    x86.bytes({0x55});                                  // push rbp
+    x86.bytes({0x49, 0x89, 0xFC});                      // mov r12, rdi
+    x86.bytes({0x49, 0x8B, 0x1C, 0x24});                // mov rbx, [r12 + sp]
+
+    // machine code offset of each vm instruction
+    std::vector<size_t> labels(program.ops.size());
+    // rel32 positions that jump to a vm instruction
+    std::vector<std::pair<size_t, size_t>> jumps;
+    // rel32 positions that jump to the epilogue
+    std::vector<size_t> exits;
+
+    for (size_t pc = 0; pc < program.ops.size(); pc++) {
+        const auto& op = program.ops[pc];
+        labels[pc] = x86.code.size();
+        if (not checked.depth[pc]) {
+            continue;
+        }
+        // the program counter after this instruction, as the interpreter sets it
+        const size_t next_pc = pc + 1;
+
+        switch (op.code) {
+        case opcode::load_const:
+            x86.push_const(op.arg);
+            break;
+
+        case opcode::pop:
+            x86.drop(1);
+            break;
+
+        case opcode::dup:
+            x86.bytes({0x48, 0x8B, 0x43, 0xF8});        // mov rax, [rbx - 8]
+            x86.push_rax();
+            break;
+
+        case opcode::add:
+            x86.bytes({0x48, 0x8B, 0x43, 0xF8});        // mov rax, [rbx - 8]
+            x86.bytes({0x48, 0x01, 0x43, 0xF0});        // add [rbx - 16], rax
+            x86.drop(1);
+            break;
+
+        case opcode::div: {
+            x86.bytes({0x48, 0x8B, 0x4B, 0xF8});        // mov rcx, [rbx - 8]
+            x86.bytes({0x48, 0x85, 0xC9});              // test rcx, rcx
+            x86.bytes({0x0F, 0x85});                    // jnz rel32
+            size_t nonzero = x86.rel32();
+            exits.push_back(x86.leave(status_div_by_zero, next_pc));
+            x86.patch(nonzero, x86.code.size());
+
+            // INT64_MIN / -1 traps in idiv, negation gives the wrapped result
+            x86.bytes({0x48, 0x83, 0xF9, 0xFF});        // cmp rcx, -1
+            x86.bytes({0x75, 0x06});                    // jne +6
+            x86.bytes({0x48, 0xF7, 0x5B, 0xF0});        // neg qword [rbx - 16]
+            x86.bytes({0xEB, 0x0D});                    // jmp +13
+            x86.bytes({0x48, 0x8B, 0x43, 0xF0});        // mov rax, [rbx - 16]
+            x86.bytes({0x48, 0x99});                    // cqo
+            x86.bytes({0x48, 0xF7, 0xF9});              // idiv rcx
+            x86.bytes({0x48, 0x89, 0x43, 0xF0});        // mov [rbx - 16], rax
+            x86.drop(1);
+            break;
+        }
+
+        case opcode::eq:
+        case opcode::neq:
+            x86.bytes({0x48, 0x8B, 0x43, 0xF8});        // mov rax, [rbx - 8]
+            x86.bytes({0x48, 0x39, 0x43, 0xF0});        // cmp [rbx - 16], rax
+            if (op.code == opcode::eq) {
+                x86.bytes({0x0F, 0x94, 0xC0});          // sete al
+            }
+            else {
+                x86.bytes({0x0F, 0x95, 0xC0});          // setne al
+            }
+            x86.bytes({0x0F, 0xB6, 0xC0});              // movzx eax, al
+            x86.bytes({0x48, 0x89, 0x43, 0xF0});        // mov [rbx - 16], rax
+            x86.drop(1);
+            break;
+
+        case opcode::jmp:
+            x86.bytes({0xE9});                          // jmp rel32
+            jumps.emplace_back(x86.rel32(), static_cast<size_t>(op.arg));
+            break;
+
+        case opcode::jmpz:
+            x86.drop(1);
+            x86.bytes({0x48, 0x83, 0x3B, 0x00});        // cmp qword [rbx], 0
+            x86.bytes({0x0F, 0x84});                    // je rel32
+            jumps.emplace_back(x86.rel32(), static_cast<size_t>(op.arg));
+            break;
+
+        case opcode::exit:
+            exits.push_back(x86.leave(status_exit, next_pc));
+            break;
+
+        case opcode::print:
+            exits.push_back(x86.call(jit_helper<ops::print<false>>, next_pc));
+            break;
+
+        case opcode::write:
+            exits.push_back(x86.call(jit_helper<ops::write<false>>, next_pc));
+            break;
+
+        case opcode::write_char:
+            exits.push_back(x86.call(jit_helper<ops::write_char<false>>, next_pc));
+            break;
+
+        case opcode::load_const_add:
+            x86.bytes({0x48, 0xB8});                    // mov rax, imm64
+            x86.imm64(op.arg);
+            x86.bytes({0x48, 0x01, 0x43, 0xF8});        // add [rbx - 8], rax
+            break;
+
+        case opcode::dup_jmpz:
+            x86.bytes({0x48, 0x83, 0x7B, 0xF8, 0x00});  // cmp qword [rbx - 8], 0
+            x86.bytes({0x0F, 0x84});                    // je rel32
+            jumps.emplace_back(x86.rel32(), static_cast<size_t>(op.arg));
+            break;
+
+        case opcode::eq_jmpz:
+            x86.bytes({0x48, 0x8B, 0x43, 0xF8});        // mov rax, [rbx - 8]
+            x86.drop(2);
+            x86.bytes({0x48, 0x39, 0x03});              // cmp [rbx], rax
+            x86.bytes({0x0F, 0x85});                    // jne rel32
+            jumps.emplace_back(x86.rel32(), static_cast<size_t>(op.arg));
+            break;
+
+        case opcode::load_const_write_char:
+            x86.push_const(op.arg);
+            exits.push_back(x86.call(jit_helper<ops::write_char<false>>, next_pc));
+            break;
+
+        // memory accesses go through helpers, which check the address
+        case opcode::load:
+            exits.push_back(x86.call(jit_helper_arg<ops::load<false>>, next_pc, op.arg));
+            break;
+
+        case opcode::store:
+            exits.push_back(x86.call(jit_helper_arg<ops::store<false>>, next_pc, op.arg));
+            x86.drop(2);
+            break;
+
+        case opcode::alloc:
+            exits.push_back(x86.call(jit_helper<ops::alloc<false>>, next_pc));
+            break;
+
+        case opcode::call:
+        case opcode::ret:
+        case opcode::custom:
+            // verified code has no subroutines or custom instructions
+            return {};
+        }
+    }
+
+    // epilogue, eax holds the status
+    size_t epilogue = x86.code.size();
+    x86.bytes({0x49, 0x89, 0x1C, 0x24});                // mov [r12 + sp], rbx
+    x86.bytes({0x5D});                                  // pop rbp
+    x86.bytes({0x41, 0x5C});                            // pop r12
+    x86.bytes({0x5B});                                  // pop rbx
+    x86.bytes({0xC3});                                  // ret
+
+    for (auto [position, target] : jumps) {
+        x86.patch(position, labels[target]);
+    }
+    for (size_t position : exits) {
+        x86.patch(position, epilogue);
+    }
+
+    return std::move(x86.code);
+}
+
+} // namespace
+
+
+jit_program::jit_program(const vm_state& vm, code_view_t code)
+    : interpreted{compile_threaded(vm, code)} {
+
+#if VM_JIT
+    // pcs are encoded as imm32
+    if (not interpreted.verified or code.size() >= std::numeric_limits<int32_t>::max()) {
+        return;
+    }
+
+    std::vector<uint8_t> native = translate(interpreted, interpreted.checked);
+    if (native.empty()) {
+        return;
+    }
+
+    void* memory = mmap(nullptr, native.size(), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return;
+    }
+    std::memcpy(memory, native.data(), native.size());
+    if (mprotect(memory, native.size(), PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, native.size());
+        return;
+    }
+
+    machine_code = memory;
+    machine_code_size = native.size();
+#endif
+}
+
+
+jit_program::~jit_program() {
+#if VM_JIT
+    if (machine_code) {
+        munmap(machine_code, machine_code_size);
+    }
+#endif
+}
+
+
+jit_program::jit_program(jit_program&& other) noexcept
+    : interpreted{std::move(other.interpreted)},
+      machine_code{std::exchange(other.machine_code, nullptr)},
+      machine_code_size{std::exchange(other.machine_code_size, 0)} {}
+
+
+jit_program& jit_program::operator=(jit_program&& other) noexcept {
+    std::swap(interpreted, other.interpreted);
+    std::swap(machine_code, other.machine_code);
+    std::swap(machine_code_size, other.machine_code_size);
+    return *this;
+}
+
+
+bool jit_program::is_native() const {
+    return machine_code != nullptr;
+}
+
+
+std::tuple<item_t, std::string> jit_program::run(vm_state& vm) const {
+    const size_t room = vm.stack.max_depth() - vm.stack.size();
+    if (not is_native() or vm.pc != 0 or vm.stack.size() < interpreted.entry_depth
+        or room < interpreted.max_depth - interpreted.entry_depth) {
+        return run_threaded(vm, interpreted);
+    }
+
+    jit_context ctx{vm.stack.data() + vm.stack.size(), &vm, 0, nullptr};
+    auto native = reinterpret_cast<int (*)(jit_context*)>(machine_code);
+    int status = native(&ctx);
+
+    // a throwing helper already left the stack as the instruction did,
+    // rbx still counts the items it popped
+    if (status != status_exception) {
+        sync_stack(&ctx);
+    }
+    vm.pc = ctx.pc;
+
+    if (status != status_exit) {
+        vm.output.flush_after_error();
+    }
+
+    switch (status) {
+    case status_div_by_zero:
+        throw div_by_zero{"cannot divide by zero!"};
+    case status_exception:
+        std::rethrow_exception(ctx.error);
+    default:
+        break;
+    }
+
+    item_t tos{0};
+    if (not vm.stack.empty())
+        tos = std::as_const(vm.stack).top();
+    return {tos, vm.output.result()};
+}
+
+} // namespace vm
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <tuple>
+
+#include "dispatch.h"
+#include "vm.h"
+
+
+namespace vm {
+
+/**
+ * a program compiled to native x86-64 machine code.
+ *
+ * only verified code (see `verify`) can be compiled, built-in instructions
+ * are lowered directly and the stack lives in the vm's operand stack memory.
+ * for everything else - custom instructions, unverifiable code,
+ * other platforms - the program runs on the threaded interpreter.
+ */
+class jit_program {
+public:
+    /**
+     * compile the program.
+     *
+     * @param vm: the vm the code was assembled for
+     * @param code: the assembled program
+     */
+    jit_program(const vm_state& vm, code_view_t code);
+    ~jit_program();
+
+    jit_program(const jit_program&) = delete;
+    jit_program& operator=(const jit_program&) = delete;
+    jit_program(jit_program&& other) noexcept;
+    jit_program& operator=(jit_program&& other) noexcept;
+
+    /**
+     * was the program compiled to machine code?
+     */
+    bool is_native() const;
+
+    /**
+     * execute the program.
+     *
+     * machine code is used if the vm starts at pc 0 with enough stack room,
+     * otherwise the threaded interpreter runs it.
+     * errors are reported just like `run` does.
+     *
+     * @return the execution results: {last TOS item, result string from WRITE instructions}
+     */
+    std::tuple<item_t, std::string> run(vm_state& vm) const;
+
+private:
+    /** used when the machine code can't be */
+    threaded_code_t interpreted;
+
+    /** executable memory holding the machine code */
+    void* machine_code = nullptr;
+    size_t machine_code_size = 0;
+};
+
+} // namespace vm
@@ -0,0 +1,381 @@
+#include "lanes.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+
+namespace vm {
+
+namespace {
+
+/**
+ * lanes started together at most, so their stacks stay in cache.
+ */
+constexpr size_t max_group_lanes = 1024;
+
+
+/**
+ * can the instruction run in lockstep, i.e. does it only touch the stack?
+ */
+bool is_lane_op(opcode code) {
+    switch (code) {
+    case opcode::load_const:
+    case opcode::exit:
+    case opcode::pop:
+    case opcode::add:
+    case opcode::div:
+    case opcode::eq:
+    case opcode::neq:
+    case opcode::dup:
+    case opcode::jmp:
+    case opcode::jmpz:
+    case opcode::load_const_add:
+    case opcode::dup_jmpz:
+    case opcode::eq_jmpz:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+/** addition that wraps around instead of overflowing */
+item_t wrapping_add(item_t a, item_t b) {
+    return static_cast<item_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b));
+}
+
+
+/**
+ * lanes that are at the same pc, and thus have the same stack depth.
+ * slot d of the i-th lane is `slot(d)[i]`.
+ */
+struct lane_group {
+    size_t pc = 0;
+
+    /** index of each lane in the inputs */
+    std::vector<size_t> lanes;
+
+    /** the stacks, slot-major */
+    std::vector<item_t> slots;
+
+    item_t* slot(size_t d) {
+        return slots.data() + d * lanes.size();
+    }
+};
+
+
+/**
+ * move the lanes selected by `take` to a new group at `pc`.
+ * the lanes that are not taken stay in `group`.
+ *
+ * @param depth: number of stack slots in use
+ * @param max_depth: number of stack slots the new groups need
+ */
+lane_group split(lane_group& group, const std::vector<uint8_t>& take,
+                 size_t depth, size_t max_depth, size_t pc) {
+    lane_group taken{pc, {}, {}};
+    lane_group kept{group.pc, {}, {}};
+
+    const size_t count = group.lanes.size();
+    const size_t taken_count = std::accumulate(std::begin(take), std::begin(take) + static_cast<std::ptrdiff_t>(count), size_t{0});
+    taken.lanes.reserve(taken_count);
+    kept.lanes.reserve(count - taken_count);
+    for (size_t i = 0; i < count; i++) {
+        (take[i] ? taken : kept).lanes.push_back(group.lanes[i]);
+    }
+    taken.slots.resize(max_depth * taken.lanes.size());
+    kept.slots.resize(max_depth * kept.lanes.size());
+
+    for (size_t d = 0; d < depth; d++) {
+        const item_t* from = group.slot(d);
+        item_t* to_taken = taken.slot(d);
+        item_t* to_kept = kept.slot(d);
+        for (size_t i = 0; i < count; i++) {
+            if (take[i]) {
+                *to_taken++ = from[i];
+            }
+            else {
+                *to_kept++ = from[i];
+            }
+        }
+    }
+
+    group = std::move(kept);
+    return taken;
+}
+
+
+/**
+ * executes lane groups until all their lanes exited or failed.
+ */
+class lane_engine {
+public:
+    lane_engine(const threaded_code_t& code, const std::vector<std::optional<size_t>>& depth,
+                std::vector<batch_result>& results)
+        : code{code}, depth{depth}, results{results} {}
+
+    void run(lane_group group) {
+        this->pending.push_back(std::move(group));
+        while (not this->pending.empty()) {
+            lane_group next = std::move(this->pending.back());
+            this->pending.pop_back();
+            this->execute(next);
+        }
+    }
+
+private:
+    void execute(lane_group& group);
+
+    /**
+     * continue the lanes with `take` set at `target`, the others at the next pc.
+     * if they disagree, the lanes at `target` are left for later.
+     *
+     * @param depth: stack depth after the jump instruction
+     */
+    void branch(lane_group& group, size_t depth, size_t target) {
+        const size_t count = group.lanes.size();
+        size_t taken = std::accumulate(std::begin(this->take), std::end(this->take), size_t{0});
+        if (taken == 0) {
+            group.pc += 1;
+        }
+        else if (taken == count) {
+            group.pc = target;
+        }
+        else {
+            this->pending.push_back(split(group, this->take, depth, this->code.max_depth, target));
+            group.pc += 1;
+        }
+    }
+
+    const threaded_code_t& code;
+    const std::vector<std::optional<size_t>>& depth;
+    std::vector<batch_result>& results;
+
+    /** groups that still have to run */
+    std::vector<lane_group> pending;
+
+    /** which lanes take a jump or fail */
+    std::vector<uint8_t> take;
+};
+
+
+void lane_engine::execute(lane_group& group) {
+    while (true) {
+        const threaded_op& op = this->code.ops[group.pc];
+        const size_t d = *this->depth[group.pc];
+        const size_t count = group.lanes.size();
+        this->take.resize(count);
+
+        switch (op.code) {
+        case opcode::load_const:
+            std::fill_n(group.slot(d), count, op.arg);
+            break;
+
+        case opcode::pop:
+            break;
+
+        case opcode::dup:
+            std::copy_n(group.slot(d - 1), count, group.slot(d));
+            break;
+
+        case opcode::add: {
+            item_t* tos1 = group.slot(d - 2);
+            const item_t* tos = group.slot(d - 1);
+            for (size_t i = 0; i < count; i++) {
+                tos1[i] = wrapping_add(tos1[i], tos[i]);
+            }
+            break;
+        }
+
+        case opcode::load_const_add: {
+            item_t* tos = group.slot(d - 1);
+            for (size_t i = 0; i < count; i++) {
+                tos[i] = wrapping_add(tos[i], op.arg);
+            }
+            break;
+        }
+
+        case opcode::eq:
+        case opcode::neq: {
+            item_t* tos1 = group.slot(d - 2);
+            const item_t* tos = group.slot(d - 1);
+            const item_t equal = op.code == opcode::eq ? 1 : 0;
+            for (size_t i = 0; i < count; i++) {
+                tos1[i] = tos1[i] == tos[i] ? equal : 1 - equal;
+            }
+            break;
+        }
+
+        case opcode::div: {
+            const item_t* divisor = group.slot(d - 1);
+            size_t zeros = 0;
+            for (size_t i = 0; i < count; i++) {
+                this->take[i] = divisor[i] == 0;
+                zeros += this->take[i];
+            }
+            if (zeros > 0) {
+                // only the lanes dividing by zero fail
+                lane_group failed = split(group, this->take, d, this->code.max_depth, group.pc);
+                for (size_t lane : failed.lanes) {
+                    this->results[lane].error = std::make_exception_ptr(div_by_zero{"cannot divide by zero!"});
+                }
+                if (group.lanes.empty()) {
+                    return;
+                }
+            }
+
+            const size_t left = group.lanes.size();
+            item_t* tos1 = group.slot(d - 2);
+            const item_t* tos = group.slot(d - 1);
+            for (size_t i = 0; i < left; i++) {
+                // INT64_MIN / -1 wraps around, like the jit does
+                tos1[i] = tos[i] == -1 ? wrapping_add(~tos1[i], 1) : tos1[i] / tos[i];
+            }
+            break;
+        }
+
+        case opcode::jmp:
+            group.pc = static_cast<size_t>(op.arg);
+            continue;
+
+        case opcode::jmpz: {
+            const item_t* tos = group.slot(d - 1);
+            for (size_t i = 0; i < count; i++) {
+                this->take[i] = tos[i] == 0;
+            }
+            this->branch(group, d - 1, static_cast<size_t>(op.arg));
+            continue;
+        }
+
+        case opcode::dup_jmpz: {
+            const item_t* tos = group.slot(d - 1);
+            for (size_t i = 0; i < count; i++) {
+                this->take[i] = tos[i] == 0;
+            }
+            this->branch(group, d, static_cast<size_t>(op.arg));
+            continue;
+        }
+
+        case opcode::eq_jmpz: {
+            const item_t* tos1 = group.slot(d - 2);
+            const item_t* tos = group.slot(d - 1);
+            for (size_t i = 0; i < count; i++) {
+                this->take[i] = tos1[i] != tos[i];
+            }
+            this->branch(group, d - 2, static_cast<size_t>(op.arg));
+            continue;
+        }
+
+        case opcode::exit: {
+            const item_t* tos = group.slot(d - 1);
+            for (size_t i = 0; i < count; i++) {
+                this->results[group.lanes[i]].tos = tos[i];
+            }
+            return;
+        }
+
+        default:
+            throw invalid_instruction{"instruction can't run in lanes"};
+        }
+
+        group.pc += 1;
+    }
+}
+
+} // namespace
+
+
+lane_program::lane_program(const vm_state& vm, code_view_t code, size_t width)
+    : code{compile_threaded(vm, code, width)},
+      width{width} {
+
+    this->prototype.instructions = vm.instructions;
+    this->prototype.stack = operand_stack{vm.stack.max_depth()};
+    this->prototype.calls = return_stack{vm.calls.max_depth()};
+    this->prototype.memory = linear_memory{vm.memory.max_size()};
+
+    if (not this->code.verified or this->code.max_depth > vm.stack.max_depth()) {
+        return;
+    }
+    for (const threaded_op& op : this->code.ops) {
+        if (not is_lane_op(op.code)) {
+            return;
+        }
+    }
+    this->depth = this->code.checked.depth;
+}
+
+
+bool lane_program::is_vectorized() const {
+    return not this->depth.empty();
+}
+
+
+std::vector<batch_result> lane_program::run(std::span<const item_t> inputs) const {
+    if (this->width == 0 ? not inputs.empty() : inputs.size() % this->width != 0) {
+        throw std::invalid_argument{"inputs are not a multiple of the lane width"};
+    }
+    if (this->is_vectorized()) {
+        return this->run_vectorized(inputs);
+    }
+    return this->run_scalar(inputs);
+}
+
+
+std::vector<batch_result> lane_program::run_vectorized(std::span<const item_t> inputs) const {
+    // without inputs, there's just no lane
+    const size_t lanes = this->width == 0 ? 0 : inputs.size() / this->width;
+    std::vector<batch_result> results(lanes);
+    lane_engine engine{this->code, this->depth, results};
+
+    for (size_t first = 0; first < lanes; first += max_group_lanes) {
+        lane_group group;
+        size_t count = std::min(max_group_lanes, lanes - first);
+        group.lanes.resize(count);
+        std::iota(std::begin(group.lanes), std::end(group.lanes), first);
+        group.slots.resize(this->code.max_depth * count);
+
+        // transpose the inputs to slot-major
+        for (size_t d = 0; d < this->width; d++) {
+            item_t* slot = group.slot(d);
+            for (size_t i = 0; i < count; i++) {
+                slot[i] = inputs[(first + i) * this->width + d];
+            }
+        }
+        engine.run(std::move(group));
+    }
+    return results;
+}
+
+
+std::vector<batch_result> lane_program::run_scalar(std::span<const item_t> inputs) const {
+    const size_t lanes = this->width == 0 ? 0 : inputs.size() / this->width;
+    std::vector<batch_result> results(lanes);
+    vm_state vm = this->prototype;
+
+    for (size_t lane = 0; lane < lanes; lane++) {
+        batch_result& result = results[lane];
+        try {
+            for (item_t item : inputs.subspan(lane * this->width, this->width)) {
+                vm.stack.push(item);
+            }
+            std::tie(result.tos, result.output) = run_threaded(vm, this->code);
+        }
+        catch (...) {
+            result.error = std::current_exception();
+        }
+
+        vm.pc = 0;
+        vm.stack.clear();
+        vm.calls.clear();
+        vm.memory.clear();
+        vm.output = output_sink{};
+    }
+    return results;
+}
+
+} // namespace vm
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "batch.h"
+#include "dispatch.h"
+#include "vm.h"
+
+
+namespace vm {
+
+/**
+ * one program run in lockstep over many inputs, e.g. a formula
+ * evaluated for millions of tuples.
+ *
+ * lanes at the same pc always have the same stack depth in verified code,
+ * so the stacks are stored slot-major: slot d of all lanes is one array,
+ * and each instruction is a loop over it that the compiler vectorizes
+ * for the target's SIMD width.
+ * lanes that disagree at a conditional jump are split into two groups
+ * which continue separately. a lane that divides by zero fails alone.
+ *
+ * programs that are not verified (see `verify`) or use instructions
+ * with side effects (output, memory, subroutines, custom instructions)
+ * are run lane by lane on the threaded interpreter instead.
+ */
+class lane_program {
+public:
+    /**
+     * prepare the program.
+     *
+     * @param vm: the vm the code was assembled for.
+     *            its stack limit is used, its execution state is not.
+     * @param code: the assembled program
+     * @param width: number of items on the stack of each lane when it starts
+     */
+    lane_program(const vm_state& vm, code_view_t code, size_t width);
+
+    /**
+     * are the lanes executed in lockstep?
+     */
+    bool is_vectorized() const;
+
+    /**
+     * run the program once per input tuple.
+     *
+     * @param inputs: `width` items for each lane, one lane after another.
+     *                the last item of a lane is its TOS.
+     *
+     * @return the result of each lane, in the order of the inputs.
+     *         lanes only have output if they were not vectorized.
+     */
+    std::vector<batch_result> run(std::span<const item_t> inputs) const;
+
+private:
+    std::vector<batch_result> run_vectorized(std::span<const item_t> inputs) const;
+    std::vector<batch_result> run_scalar(std::span<const item_t> inputs) const;
+
+    /** fresh state for lanes that run on the interpreter */
+    vm_state prototype;
+
+    threaded_code_t code;
+    size_t width;
+
+    /** stack depth before each instruction, empty unless vectorized */
+    std::vector<std::optional<size_t>> depth;
+};
+
+} // namespace vm
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "error.h"
+
+
+namespace vm {
+
+/**
+ * linear memory of a vm, addressed by item index.
+ *
+ * memory is handed out by `allocate` from an arena of fixed-size pages,
+ * growing the arena never moves existing items.
+ * every access is bounds checked with one unsigned compare, so negative
+ * addresses are rejected as well; invalid accesses throw `vm_segfault`.
+ *
+ * like the operand stack, copies share their pages copy-on-write:
+ * a page is only copied when a copy writes to it.
+ */
+template<typename T>
+class basic_linear_memory {
+public:
+    using value_type = T;
+
+    static constexpr size_t page_bits = 12;
+    static constexpr size_t page_size = size_t{1} << page_bits;
+
+    /** maximum size of memories that are not given one explicitly, in items */
+    static constexpr size_t default_max_size = size_t{1} << 24;
+
+    explicit basic_linear_memory(size_t max_size = default_max_size)
+        : _max_size{max_size} {}
+
+    basic_linear_memory(const basic_linear_memory& other)
+        : _pages{other._pages},
+          _size{other._size},
+          _max_size{other._max_size} {
+        share_pages(other);
+    }
+
+    basic_linear_memory& operator=(const basic_linear_memory& other) {
+        if (this != &other) {
+            _pages = other._pages;
+            _size = other._size;
+            _max_size = other._max_size;
+            share_pages(other);
+        }
+        return *this;
+    }
+
+    basic_linear_memory(basic_linear_memory&&) noexcept = default;
+    basic_linear_memory& operator=(basic_linear_memory&&) noexcept = default;
+
+    /** number of allocated items */
+    size_t size() const { return _size; }
+
+    /** how many items can be allocated in total */
+    size_t max_size() const { return _max_size; }
+
+    /**
+     * allocate `count` zero-initialized items.
+     *
+     * @return address of the first item
+     */
+    size_t allocate(T count) {
+        if (count < 0 or static_cast<uint64_t>(count) > _max_size - _size) {
+            throw vm_segfault{"out of memory!"};
+        }
+        size_t address = _size;
+        _size += static_cast<size_t>(count);
+        while (_pages.size() * page_size < _size) {
+            _pages.push_back({std::make_shared<T[]>(page_size)});
+        }
+        return address;
+    }
+
+    T load(uint64_t address) const {
+        check(address);
+        return _pages[address >> page_bits].data[address & (page_size - 1)];
+    }
+
+    void store(uint64_t address, const T& value) {
+        check(address);
+        page& target = _pages[address >> page_bits];
+        if (not target.unique) [[unlikely]] {
+            unshare(target);
+        }
+        target.data[address & (page_size - 1)] = value;
+    }
+
+    /**
+     * release all memory.
+     */
+    void clear() {
+        _pages.clear();
+        _size = 0;
+    }
+
+private:
+    struct page {
+        std::shared_ptr<T[]> data;
+
+        /** set while `data` is known not to be shared with a copy */
+        mutable bool unique = true;
+    };
+
+    void check(uint64_t address) const {
+        if (address >= _size) [[unlikely]] {
+            throw vm_segfault{"invalid memory address!"};
+        }
+    }
+
+    /**
+     * mark all pages as shared, here and in the memory they were copied from.
+     * flags are only written if needed, so a memory whose pages are
+     * already shared (e.g. in a snapshot) can be copied from several threads.
+     */
+    void share_pages(const basic_linear_memory& other) {
+        for (size_t i = 0; i < _pages.size(); i++) {
+            _pages[i].unique = false;
+            if (other._pages[i].unique) {
+                other._pages[i].unique = false;
+            }
+        }
+    }
+
+    [[gnu::noinline, gnu::cold]] void unshare(page& target) {
+        // the copies may be gone already
+        if (target.data.use_count() > 1) {
+            auto copy = std::make_shared_for_overwrite<T[]>(page_size);
+            std::copy_n(target.data.get(), page_size, copy.get());
+            target.data = std::move(copy);
+        }
+        target.unique = true;
+    }
+
+    std::vector<page> _pages;
+    size_t _size = 0;
+    size_t _max_size;
+};
+
+
+/** the linear memory of the vm */
+using linear_memory = basic_linear_memory<int64_t>;
+
+} // namespace vm
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <utility>
+
+#include "vm.h"
+
+
+/**
+ * implementations of the built-in instructions.
+ *
+ * they are shared by the `op_action_t`s registered in `create_vm`
+ * and by the execution engines that dispatch built-in opcodes directly,
+ * so both paths behave (and fail) exactly the same.
+ * the operand stack reports missing items with `vm_stackfail`,
+ * unless `checked` is false because the code was verified.
+ * they work for vms of every item type.
+ */
+namespace vm::ops {
+
+template<bool checked = true, typename T>
+inline void print(basic_vm_state<T>& vm) {
+    std::cout << vm.stack.template top<checked>() << std::endl;
+}
+
+template<bool checked = true, typename T>
+inline void load_const(basic_vm_state<T>& vm, const T item) {
+    vm.stack.template push<checked>(item);
+}
+
+template<bool checked = true, typename T>
+inline void exit(basic_vm_state<T>& vm) {
+    vm.stack.template require<checked>(1);
+}
+
+template<bool checked = true, typename T>
+inline void pop(basic_vm_state<T>& vm) {
+    vm.stack.template pop<checked>();
+}
+
+template<bool checked = true, typename T>
+inline void add(basic_vm_state<T>& vm) {
+    vm.stack.template pop2_push1<checked>([](T tos1, T tos) -> T { return tos1 + tos; });
+}
+
+template<bool checked = true, typename T>
+inline void div(basic_vm_state<T>& vm) {
+    vm.stack.template pop2_push1<checked>([](T tos1, T tos) {
+        if (tos == 0)
+            throw div_by_zero{"cannot divide by zero!"};
+        return tos1 / tos;
+    });
+}
+
+template<bool checked = true, typename T>
+inline void eq(basic_vm_state<T>& vm) {
+    vm.stack.template pop2_push1<checked>([](T tos1, T tos) -> T { return tos == tos1 ? 1 : 0; });
+}
+
+template<bool checked = true, typename T>
+inline void neq(basic_vm_state<T>& vm) {
+    vm.stack.template pop2_push1<checked>([](T tos1, T tos) -> T { return tos == tos1 ? 0 : 1; });
+}
+
+template<bool checked = true, typename T>
+inline void dup(basic_vm_state<T>& vm) {
+    T tos{vm.stack.template top<checked>()};
+    vm.stack.template push<checked>(tos);
+}
+
+/** @return true if the jump should be taken. the condition is consumed. */
+template<bool checked = true, typename T>
+inline bool jmpz(basic_vm_state<T>& vm) {
+    bool zero = vm.stack.template top<checked>() == 0;
+    vm.stack.template pop<checked>();
+    return zero;
+}
+
+template<bool checked = true, typename T>
+inline void write(basic_vm_state<T>& vm) {
+    //append TOS as a number to the vm output
+    vm.output.write(vm.stack.template top<checked>());
+}
+
+template<bool checked = true, typename T>
+inline void write_char(basic_vm_state<T>& vm) {
+    //append TOS as a char to the vm output
+    vm.output.put(static_cast<char>(vm.stack.template top<checked>()));
+}
+
+/** LOAD_CONST item; ADD */
+template<bool checked = true, typename T>
+inline void load_const_add(basic_vm_state<T>& vm, const T item) {
+    vm.stack.template top<checked>() += item;
+}
+
+/** DUP; JMPZ - @return true if the jump should be taken. */
+template<bool checked = true, typename T>
+inline bool dup_jmpz(basic_vm_state<T>& vm) {
+    return vm.stack.template top<checked>() == 0;
+}
+
+/** EQ; JMPZ - @return true if the jump should be taken. */
+template<bool checked = true, typename T>
+inline bool eq_jmpz(basic_vm_state<T>& vm) {
+    auto [tos1, tos] = vm.stack.template pop2<checked>();
+    return tos1 != tos;
+}
+
+/** LOAD_CONST item; WRITE_CHAR */
+template<bool checked = true, typename T>
+inline void load_const_write_char(basic_vm_state<T>& vm, const T item) {
+    vm.stack.template push<checked>(item);
+    vm.output.put(static_cast<char>(item));
+}
+
+/** LOAD offset - replace the address at TOS by the memory item at address + offset */
+template<bool checked = true, typename T>
+inline void load(basic_vm_state<T>& vm, const T offset) {
+    T& address = vm.stack.template top<checked>();
+    address = vm.memory.load(static_cast<uint64_t>(address) + static_cast<uint64_t>(offset));
+}
+
+/** STORE offset - store TOS1 at memory address TOS + offset, and pop both */
+template<bool checked = true, typename T>
+inline void store(basic_vm_state<T>& vm, const T offset) {
+    auto [value, address] = vm.stack.template pop2<checked>();
+    vm.memory.store(static_cast<uint64_t>(address) + static_cast<uint64_t>(offset), value);
+}
+
+/** ALLOC - replace the item count at TOS by the address of that many new zeroed items */
+template<bool checked = true, typename T>
+inline void alloc(basic_vm_state<T>& vm) {
+    T& count = vm.stack.template top<checked>();
+    count = static_cast<T>(vm.memory.allocate(count));
+}
+
+/**
+ * CALL - remember to continue at `return_pc` when the callee returns.
+ * the call depth is not proven by `verify`, so it is always checked.
+ */
+template<typename T>
+inline void call(basic_vm_state<T>& vm, size_t return_pc) {
+    if (vm.calls.size() == vm.calls.max_depth()) [[unlikely]] {
+        throw vm_stackfail{"call stack overflow!"};
+    }
+    vm.calls.push(return_pc);
+}
+
+/** RET - @return the pc after the CALL that is returned from */
+template<typename T>
+inline size_t ret(basic_vm_state<T>& vm) {
+    if (vm.calls.empty()) [[unlikely]] {
+        throw vm_stackfail{"return without call!"};
+    }
+    size_t return_pc = std::as_const(vm.calls).top();
+    vm.calls.pop();
+    return return_pc;
+}
+
+} // namespace vm::ops
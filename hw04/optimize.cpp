@@ -0,0 +1,254 @@
+#include "optimize.h"
+
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace vm {
+
+namespace {
+
+/**
+ * one instruction while the code is being rewritten.
+ */
+struct instruction {
+    opcode op;
+    item_t arg;
+
+    /** pc of the (first) original instruction this one was created from */
+    size_t origin;
+};
+
+
+bool is_jump(opcode op) {
+    return (op == opcode::jmp or op == opcode::jmpz or
+            op == opcode::dup_jmpz or op == opcode::eq_jmpz or
+            op == opcode::call);
+}
+
+
+bool falls_through(opcode op) {
+    // a CALL continues after its callee returns
+    return op != opcode::exit and op != opcode::jmp and op != opcode::ret;
+}
+
+
+/**
+ * evaluate a binary instruction on two constants.
+ * fails for operations that have to raise their error at runtime.
+ */
+std::optional<item_t> fold(opcode op, item_t tos1, item_t tos) {
+    switch (op) {
+    case opcode::add:
+        // wrap around instead of overflowing
+        return static_cast<item_t>(static_cast<uint64_t>(tos1) + static_cast<uint64_t>(tos));
+    case opcode::div:
+        if (tos == 0 or (tos1 == std::numeric_limits<item_t>::min() and tos == -1))
+            return std::nullopt;
+        return tos1 / tos;
+    case opcode::eq:
+        return tos1 == tos ? 1 : 0;
+    case opcode::neq:
+        return tos1 == tos ? 0 : 1;
+    default:
+        return std::nullopt;
+    }
+}
+
+
+/**
+ * rewrites instructions while they are emitted,
+ * by matching patterns at the end of the already emitted code.
+ */
+class peephole {
+public:
+    peephole(const std::vector<bool>& is_target, optimize_report& report)
+        : is_target{is_target}, report{report} {}
+
+    void emit(const instruction& instr) {
+        code.push_back(instr);
+        while (reduce());
+    }
+
+    std::vector<instruction> code;
+
+private:
+    /**
+     * can the last `count` instructions be merged into one?
+     * only the first of them may be a jump target.
+     */
+    bool mergeable(size_t count) const {
+        if (code.size() < count)
+            return false;
+        for (size_t i = code.size() - count + 1; i < code.size(); i++) {
+            if (is_target[code[i].origin])
+                return false;
+        }
+        return true;
+    }
+
+    /** replace the last `count` instructions with one */
+    void merge(size_t count, opcode op, item_t arg, const std::string& pattern) {
+        size_t origin = code[code.size() - count].origin;
+        code.resize(code.size() - count);
+        code.push_back({op, arg, origin});
+        report.eliminated[pattern] += count - 1;
+    }
+
+    /** @return true if a pattern was rewritten */
+    bool reduce() {
+        const size_t size = code.size();
+
+        if (mergeable(3)) {
+            const auto& a = code[size - 3];
+            const auto& b = code[size - 2];
+            const auto& c = code[size - 1];
+            if (a.op == opcode::load_const and b.op == opcode::load_const) {
+                auto folded = fold(c.op, a.arg, b.arg);
+                if (folded) {
+                    auto pattern = "fold " + name_of(c.op);
+                    merge(3, opcode::load_const, *folded, pattern);
+                    return true;
+                }
+            }
+        }
+
+        if (mergeable(2)) {
+            const auto& a = code[size - 2];
+            const auto& b = code[size - 1];
+            if (a.op == opcode::load_const and b.op == opcode::add) {
+                merge(2, opcode::load_const_add, a.arg, "LOAD_CONST ADD");
+                return true;
+            }
+            if (a.op == opcode::load_const and b.op == opcode::load_const_add) {
+                merge(2, opcode::load_const, *fold(opcode::add, a.arg, b.arg), "fold ADD");
+                return true;
+            }
+            if (a.op == opcode::load_const_add and b.op == opcode::load_const_add) {
+                merge(2, opcode::load_const_add, *fold(opcode::add, a.arg, b.arg), "fold ADD");
+                return true;
+            }
+            if (a.op == opcode::dup and b.op == opcode::jmpz) {
+                merge(2, opcode::dup_jmpz, b.arg, "DUP JMPZ");
+                return true;
+            }
+            if (a.op == opcode::eq and b.op == opcode::jmpz) {
+                merge(2, opcode::eq_jmpz, b.arg, "EQ JMPZ");
+                return true;
+            }
+            if (a.op == opcode::load_const and b.op == opcode::write_char) {
+                merge(2, opcode::load_const_write_char, a.arg, "LOAD_CONST WRITE_CHAR");
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    static std::string name_of(opcode op) {
+        switch (op) {
+        case opcode::add: return "ADD";
+        case opcode::div: return "DIV";
+        case opcode::eq:  return "EQ";
+        case opcode::neq: return "NEQ";
+        default:          return "?";
+        }
+    }
+
+    const std::vector<bool>& is_target;
+    optimize_report& report;
+};
+
+} // namespace
+
+
+size_t optimize_report::total() const {
+    return std::accumulate(std::begin(eliminated), std::end(eliminated), size_t{0},
+                           [](size_t sum, const auto& entry) { return sum + entry.second; });
+}
+
+
+code_t optimize(const vm_state& vm, code_view_t code, optimize_report* report) {
+    optimize_report local_report;
+    optimize_report& result = report ? *report : local_report;
+    result = {};
+
+    const size_t size = code.size();
+
+    std::vector<opcode> ops;
+    ops.reserve(size);
+    for (const auto& [op_id, arg] : code) {
+        auto builtin = vm.instructions->builtin_opcodes.find(op_id);
+        if (builtin == std::end(vm.instructions->builtin_opcodes)) {
+            return {std::begin(code), std::end(code)};
+        }
+        ops.push_back(builtin->second);
+    }
+
+    std::unordered_map<opcode, op_id_t> op_ids;
+    for (const auto& [op_id, op] : vm.instructions->builtin_opcodes) {
+        op_ids.emplace(op, op_id);
+    }
+
+    // find reachable instructions and jump targets
+    std::vector<bool> reachable(size);
+    std::vector<bool> is_target(size);
+    std::vector<size_t> worklist;
+    if (size > 0) {
+        worklist.push_back(0);
+    }
+    while (not worklist.empty()) {
+        size_t pc = worklist.back();
+        worklist.pop_back();
+        if (reachable[pc])
+            continue;
+        reachable[pc] = true;
+
+        item_t target = code[pc].second;
+        if (is_jump(ops[pc]) and target >= 0 and static_cast<size_t>(target) < size) {
+            is_target[static_cast<size_t>(target)] = true;
+            worklist.push_back(static_cast<size_t>(target));
+        }
+        if (falls_through(ops[pc]) and pc + 1 < size) {
+            worklist.push_back(pc + 1);
+        }
+    }
+
+    peephole rewriter{is_target, result};
+    for (size_t pc = 0; pc < size; pc++) {
+        if (not reachable[pc]) {
+            result.eliminated["unreachable code"] += 1;
+            continue;
+        }
+        rewriter.emit({ops[pc], code[pc].second, pc});
+    }
+
+    // where each original jump target ended up
+    std::vector<size_t> new_pc(size);
+    for (size_t pc = 0; pc < rewriter.code.size(); pc++) {
+        new_pc[rewriter.code[pc].origin] = pc;
+    }
+
+    code_t optimized;
+    optimized.reserve(rewriter.code.size());
+    for (auto [op, arg, origin] : rewriter.code) {
+        if (is_jump(op) and arg >= 0) {
+            if (static_cast<size_t>(arg) < size) {
+                arg = static_cast<item_t>(new_pc[static_cast<size_t>(arg)]);
+            }
+            else {
+                // keep jumping out of the code
+                arg = static_cast<item_t>(rewriter.code.size());
+            }
+        }
+        optimized.emplace_back(op_ids.at(op), arg);
+    }
+
+    return optimized;
+}
+
+} // namespace vm
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <string>
+
+#include "vm.h"
+
+
+namespace vm {
+
+/**
+ * what `optimize` did to a program.
+ */
+struct optimize_report {
+    /**
+     * number of instructions eliminated, per rewrite pattern.
+     */
+    std::map<std::string, size_t> eliminated;
+
+    /**
+     * number of instructions eliminated in total.
+     */
+    size_t total() const;
+};
+
+
+/**
+ * peephole optimization of assembled code, to be run between `assemble` and `run`.
+ *
+ * - removes instructions that can't be reached from pc 0
+ * - folds ADD, DIV, EQ and NEQ of two constants into one LOAD_CONST
+ * - fuses `LOAD_CONST k; ADD`, `DUP; JMPZ`, `EQ; JMPZ` and
+ *   `LOAD_CONST k; WRITE_CHAR` into superinstructions
+ *
+ * instructions that are jump targets are never merged into their predecessor,
+ * and all jump targets are adjusted to the new code layout.
+ * code with custom instructions is returned unchanged, as they may
+ * read or modify the program counter.
+ *
+ * @param vm: the vm the code was assembled for, created by `create_vm`
+ * @param code: the program to optimize
+ * @param report: if given, filled with the number of eliminated instructions
+ *
+ * @return the optimized program
+ */
+code_t optimize(const vm_state& vm, code_view_t code, optimize_report* report = nullptr);
+
+} // namespace vm
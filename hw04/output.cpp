@@ -0,0 +1,199 @@
+#include "output.h"
+
+#include <cerrno>
+#include <algorithm>
+#include <charconv>
+#include <system_error>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#define VM_POSIX_FD 1
+#else
+#define VM_POSIX_FD 0
+#endif
+
+
+namespace vm {
+
+output_sink::output_sink(target_kind kind, size_t flush_threshold)
+    : flush_threshold{flush_threshold},
+      kind{kind} {}
+
+
+output_sink output_sink::to_stream(std::ostream& stream, size_t flush_threshold) {
+    output_sink sink{target_kind::stream, flush_threshold};
+    sink.stream = &stream;
+    return sink;
+}
+
+
+output_sink output_sink::to_fd(int fd, size_t flush_threshold) {
+    output_sink sink{target_kind::fd, flush_threshold};
+    sink.fd = fd;
+    return sink;
+}
+
+
+output_sink output_sink::to_buffer(std::string& buffer, size_t flush_threshold) {
+    output_sink sink{target_kind::buffer, flush_threshold};
+    sink.target_buffer = &buffer;
+    return sink;
+}
+
+
+void output_sink::write(int64_t number) {
+    // enough for the sign and all digits of int64_t
+    char digits[24];
+    auto [end, error] = std::to_chars(std::begin(digits), std::end(digits), number);
+    this->write(std::string_view{digits, static_cast<size_t>(end - digits)});
+}
+
+
+output_sink::output_sink(const output_sink& other)
+    : buffer{other.buffer},
+      unique{false},
+      flush_threshold{other.flush_threshold},
+      kind{other.kind},
+      stream{other.stream},
+      fd{other.fd},
+      target_buffer{other.target_buffer} {
+
+    if (other.unique) {
+        other.unique = false;
+    }
+}
+
+
+output_sink& output_sink::operator=(const output_sink& other) {
+    if (this != &other) {
+        *this = output_sink{other};
+    }
+    return *this;
+}
+
+
+output_sink::output_sink(output_sink&& other) noexcept
+    : buffer{std::move(other.buffer)},
+      unique{std::exchange(other.unique, false)},
+      flush_threshold{other.flush_threshold},
+      kind{other.kind},
+      stream{other.stream},
+      fd{other.fd},
+      target_buffer{other.target_buffer} {}
+
+
+output_sink& output_sink::operator=(output_sink&& other) noexcept {
+    if (this == &other) {
+        return *this;
+    }
+    this->release();
+    this->buffer = std::move(other.buffer);
+    this->unique = std::exchange(other.unique, false);
+    this->flush_threshold = other.flush_threshold;
+    this->kind = other.kind;
+    this->stream = other.stream;
+    this->fd = other.fd;
+    this->target_buffer = other.target_buffer;
+    return *this;
+}
+
+
+void output_sink::release() noexcept {
+    if (this->kind != target_kind::collect and this->buffer and this->buffer.use_count() == 1) {
+        this->flush_after_error();
+    }
+}
+
+
+void output_sink::unshare() {
+    // the copies may be gone already
+    if (this->buffer.use_count() != 1) {
+        auto copy = std::make_shared<std::string>();
+        copy->reserve(std::min(this->flush_threshold, default_flush_threshold));
+        if (this->buffer) {
+            copy->append(*this->buffer);
+        }
+        this->buffer = std::move(copy);
+    }
+    this->unique = true;
+}
+
+
+void output_sink::flush() {
+    if (not this->buffer or this->buffer->empty()) {
+        return;
+    }
+    const std::string& buffer = *this->buffer;
+
+    switch (this->kind) {
+    case target_kind::collect:
+        return;
+    case target_kind::stream:
+        this->stream->write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        this->stream->flush();
+        break;
+    case target_kind::fd: {
+#if VM_POSIX_FD
+        size_t done = 0;
+        while (done < buffer.size()) {
+            ssize_t written = ::write(this->fd, buffer.data() + done, buffer.size() - done);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                int error = errno;
+                // keep what wasn't written for the next attempt
+                this->writable().erase(0, done);
+                throw std::system_error{error, std::generic_category(), "can't write vm output"};
+            }
+            done += static_cast<size_t>(written);
+        }
+#else
+        throw std::system_error{std::make_error_code(std::errc::function_not_supported),
+                                "file descriptor output"};
+#endif
+        break;
+    }
+    case target_kind::buffer:
+        this->target_buffer->append(buffer);
+        break;
+    }
+
+    // don't modify a buffer that a copy still uses
+    if (this->unique) {
+        this->buffer->clear();
+    }
+    else {
+        this->buffer.reset();
+    }
+}
+
+
+void output_sink::drop_pending_copy() {
+    if (this->kind != target_kind::collect) {
+        this->buffer.reset();
+        this->unique = false;
+    }
+}
+
+
+void output_sink::flush_after_error() noexcept {
+    try {
+        this->flush();
+    }
+    catch (...) {
+        // the output that couldn't be written stays in the buffer
+    }
+}
+
+
+std::string output_sink::result() {
+    this->flush();
+    if (this->kind == target_kind::collect) {
+        return std::string{this->pending()};
+    }
+    return {};
+}
+
+} // namespace vm
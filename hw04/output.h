@@ -0,0 +1,168 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+
+namespace vm {
+
+/**
+ * destination for the text produced by WRITE and WRITE_CHAR.
+ *
+ * output is collected in a buffer and handed to the target whenever
+ * the buffer reaches the flush threshold, when a program exits or fails,
+ * and when the sink is destroyed.
+ * without a target, the buffer just keeps growing and its content is
+ * returned as the result string of `run`.
+ *
+ * copies of a sink share the buffer until one of them writes (copy-on-write).
+ * copies with a target write to the same target.
+ */
+class output_sink {
+public:
+    static constexpr size_t default_flush_threshold = 64 * 1024;
+
+    /** collect all output for the result of `run` */
+    output_sink() = default;
+
+    output_sink(const output_sink& other);
+    output_sink& operator=(const output_sink& other);
+    output_sink(output_sink&& other) noexcept;
+    output_sink& operator=(output_sink&& other) noexcept;
+
+    /** hands the pending output to the target, write errors are ignored */
+    ~output_sink() {
+        if (this->kind != target_kind::collect) [[unlikely]] {
+            this->release();
+        }
+    }
+
+    /** write output to a stream, which must outlive the sink */
+    static output_sink to_stream(std::ostream& stream, size_t flush_threshold = default_flush_threshold);
+
+    /** write output to a file descriptor, which is not closed by the sink */
+    static output_sink to_fd(int fd, size_t flush_threshold = default_flush_threshold);
+
+    /** append output to a caller-owned string, which must outlive the sink */
+    static output_sink to_buffer(std::string& buffer, size_t flush_threshold = default_flush_threshold);
+
+    void put(char c) {
+        this->writable().push_back(c);
+        this->flush_if_full();
+    }
+
+    void write(std::string_view text) {
+        this->writable().append(text);
+        this->flush_if_full();
+    }
+
+    /** write an integer in decimal */
+    void write(int64_t number);
+
+    /**
+     * hand all buffered output to the target.
+     * throws `std::system_error` if a file descriptor can't be written.
+     */
+    void flush();
+
+    /**
+     * flush, ignoring write errors.
+     * for when a program failed, so its error is the one that is reported.
+     */
+    void flush_after_error() noexcept;
+
+    /**
+     * flush, and return the output collected without a target.
+     * the text stays in the sink, so later runs append to it.
+     * with a target, nothing is collected and the result is empty.
+     */
+    std::string result();
+
+    /**
+     * forget the pending output if the sink has a target.
+     * for copies that share the target with the original sink,
+     * so only the original hands the pending output over.
+     */
+    void drop_pending_copy();
+
+    /** the output that was not flushed yet */
+    std::string_view pending() const {
+        if (not this->buffer) {
+            return {};
+        }
+        return *this->buffer;
+    }
+
+private:
+    enum class target_kind : uint8_t {
+        collect,
+        stream,
+        fd,
+        buffer,
+    };
+
+    output_sink(target_kind kind, size_t flush_threshold);
+
+    void flush_if_full() {
+        if (this->buffer->size() >= this->flush_threshold) [[unlikely]] {
+            this->flush();
+        }
+    }
+
+    /** the buffer, made exclusive to this sink */
+    std::string& writable() {
+        if (not this->unique) [[unlikely]] {
+            this->unshare();
+        }
+        return *this->buffer;
+    }
+
+    void unshare();
+
+    /** flush the output that would be lost with the buffer, if no copy still holds it */
+    void release() noexcept;
+
+    /** shared with copies of the sink, null while empty */
+    std::shared_ptr<std::string> buffer;
+
+    /**
+     * set while `buffer` exists and is known not to be shared.
+     * like `basic_operand_stack`, the flag is cleared in the source
+     * of a copy, but only if it is set.
+     */
+    mutable bool unique = false;
+
+    size_t flush_threshold = std::numeric_limits<size_t>::max();
+
+    target_kind kind = target_kind::collect;
+    std::ostream* stream = nullptr;
+    int fd = -1;
+    std::string* target_buffer = nullptr;
+};
+
+
+namespace detail {
+
+/**
+ * run an engine, and flush the vm's output if it fails.
+ * on exit, `result` flushes.
+ */
+template<typename Engine>
+auto flush_on_error(output_sink& output, Engine&& engine) {
+    try {
+        return engine();
+    }
+    catch (...) {
+        output.flush_after_error();
+        throw;
+    }
+}
+
+} // namespace detail
+
+} // namespace vm
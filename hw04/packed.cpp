@@ -0,0 +1,217 @@
+#include "packed.h"
+
+#include <iterator>
+#include <limits>
+#include <utility>
+
+#include "dispatch_common.h"
+#include "ops.h"
+
+
+namespace vm {
+
+namespace {
+
+invalid_instruction pack_error(std::string_view what, size_t pc) {
+    return invalid_instruction{std::string{what} + " at pc=" + std::to_string(pc)};
+}
+
+} // namespace
+
+
+template<typename T>
+basic_packed_code<T> pack(const vm_state& vm, code_view_t code) {
+    basic_packed_code<T> packed;
+    packed.codes.reserve(code.size());
+    packed.args.reserve(code.size());
+
+    for (size_t pc = 0; pc < code.size(); pc++) {
+        auto [op_id, arg] = code[pc];
+        auto builtin = vm.instructions->builtin_opcodes.find(op_id);
+        if (builtin == std::end(vm.instructions->builtin_opcodes)) {
+            throw pack_error("custom instruction can't be packed", pc);
+        }
+        if (arg < std::numeric_limits<T>::min() or arg > std::numeric_limits<T>::max()) {
+            throw pack_error("argument out of range", pc);
+        }
+        packed.codes.push_back(builtin->second);
+        packed.args.push_back(static_cast<T>(arg));
+    }
+    return packed;
+}
+
+
+namespace {
+
+VM_ENGINE_BEGIN
+
+/** the dispatch loop */
+template<typename T>
+std::tuple<T, std::string> execute(basic_vm_state<T>& vm, const basic_packed_code<T>& code) {
+    const opcode* const codes = code.codes.data();
+    const T* const args = code.args.data();
+    const size_t code_size = code.size();
+    size_t op = 0;
+    detail::pc_sync<basic_vm_state<T>> pc{vm, vm.pc};
+
+#if VM_COMPUTED_GOTO
+    // same order as the `opcode` enum
+    static void* const handlers[] = {
+        &&do_print, &&do_load_const, &&do_exit, &&do_pop, &&do_add,
+        &&do_div, &&do_eq, &&do_neq, &&do_dup, &&do_jmp, &&do_jmpz,
+        &&do_write, &&do_write_char, &&do_load_const_add, &&do_dup_jmpz,
+        &&do_eq_jmpz, &&do_load_const_write_char,
+        &&do_load, &&do_store, &&do_alloc, &&do_call, &&do_ret, &&do_custom,
+    };
+    static_assert(std::size(handlers) == static_cast<size_t>(opcode::custom) + 1);
+
+#define VM_CASE(name) do_##name
+#define VM_DISPATCH() goto *handlers[static_cast<size_t>(codes[op])]
+#else
+#define VM_CASE(name) case opcode::name
+#define VM_DISPATCH() goto dispatch
+#endif
+
+// fetch the instruction at pc and jump to its handler
+#define VM_NEXT()                               \
+    do {                                        \
+        if (pc.value >= code_size)              \
+            goto segfault;                      \
+        op = pc.value++;                        \
+        VM_DISPATCH();                          \
+    } while (false)
+
+    VM_NEXT();
+
+#if !VM_COMPUTED_GOTO
+dispatch:
+    switch (codes[op]) {
+#endif
+
+    VM_CASE(print):
+        ops::print(vm);
+        VM_NEXT();
+
+    VM_CASE(load_const):
+        ops::load_const(vm, args[op]);
+        VM_NEXT();
+
+    VM_CASE(exit): {
+        ops::exit(vm);
+        T tos = std::as_const(vm.stack).top();
+        return {tos, vm.output.result()};
+    }
+
+    VM_CASE(pop):
+        ops::pop(vm);
+        VM_NEXT();
+
+    VM_CASE(add):
+        ops::add(vm);
+        VM_NEXT();
+
+    VM_CASE(div):
+        ops::div(vm);
+        VM_NEXT();
+
+    VM_CASE(eq):
+        ops::eq(vm);
+        VM_NEXT();
+
+    VM_CASE(neq):
+        ops::neq(vm);
+        VM_NEXT();
+
+    VM_CASE(dup):
+        ops::dup(vm);
+        VM_NEXT();
+
+    VM_CASE(jmp):
+        pc.value = static_cast<size_t>(args[op]);
+        VM_NEXT();
+
+    VM_CASE(jmpz):
+        if (ops::jmpz(vm))
+            pc.value = static_cast<size_t>(args[op]);
+        VM_NEXT();
+
+    VM_CASE(write):
+        ops::write(vm);
+        VM_NEXT();
+
+    VM_CASE(write_char):
+        ops::write_char(vm);
+        VM_NEXT();
+
+    VM_CASE(load_const_add):
+        ops::load_const_add(vm, args[op]);
+        VM_NEXT();
+
+    VM_CASE(dup_jmpz):
+        if (ops::dup_jmpz(vm))
+            pc.value = static_cast<size_t>(args[op]);
+        VM_NEXT();
+
+    VM_CASE(eq_jmpz):
+        if (ops::eq_jmpz(vm))
+            pc.value = static_cast<size_t>(args[op]);
+        VM_NEXT();
+
+    VM_CASE(load_const_write_char):
+        ops::load_const_write_char(vm, args[op]);
+        VM_NEXT();
+
+    VM_CASE(load):
+        ops::load(vm, args[op]);
+        VM_NEXT();
+
+    VM_CASE(store):
+        ops::store(vm, args[op]);
+        VM_NEXT();
+
+    VM_CASE(alloc):
+        ops::alloc(vm);
+        VM_NEXT();
+
+    VM_CASE(call):
+        ops::call(vm, pc.value);
+        pc.value = static_cast<size_t>(args[op]);
+        VM_NEXT();
+
+    VM_CASE(ret):
+        pc.value = ops::ret(vm);
+        VM_NEXT();
+
+    VM_CASE(custom):
+        // `pack` doesn't emit these
+        throw invalid_instruction{"custom instruction in packed code"};
+
+#if !VM_COMPUTED_GOTO
+    }
+#endif
+
+#undef VM_NEXT
+#undef VM_DISPATCH
+#undef VM_CASE
+
+segfault:
+    throw vm_segfault{"seg fault!"};
+}
+
+VM_ENGINE_END
+
+} // namespace
+
+
+template<typename T>
+std::tuple<T, std::string> run_packed(basic_vm_state<T>& vm, const basic_packed_code<T>& code) {
+    return detail::flush_on_error(vm.output, [&] { return execute(vm, code); });
+}
+
+
+template basic_packed_code<int32_t> pack(const vm_state&, code_view_t);
+template basic_packed_code<int64_t> pack(const vm_state&, code_view_t);
+template std::tuple<int32_t, std::string> run_packed(basic_vm_state<int32_t>&, const basic_packed_code<int32_t>&);
+template std::tuple<int64_t, std::string> run_packed(basic_vm_state<int64_t>&, const basic_packed_code<int64_t>&);
+
+} // namespace vm
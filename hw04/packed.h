@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "vm.h"
+
+
+namespace vm {
+
+/**
+ * a program in a compact encoding, for vms with items of type `T`.
+ *
+ * opcodes and arguments are stored in two arrays, so an instruction
+ * takes one byte plus one `T`: 5 bytes with 32 bit items instead of
+ * the 16 bytes of an `op_t`. a program packed for `int32_t` items
+ * also runs on a stack of half the size.
+ */
+template<typename T>
+struct basic_packed_code {
+    std::vector<opcode> codes;
+    std::vector<T> args;
+
+    /** number of instructions */
+    size_t size() const { return codes.size(); }
+
+    /** size of the encoding in bytes */
+    size_t bytes() const { return codes.size() * sizeof(opcode) + args.size() * sizeof(T); }
+};
+
+/** programs for vms with 32 bit items */
+using packed_code_t = basic_packed_code<int32_t>;
+
+
+/**
+ * convert assembled code to the compact encoding.
+ *
+ * only built-in instructions can be packed, custom instructions
+ * are bound to `vm_state`. arguments must fit into `T`.
+ * both is reported as `invalid_instruction`.
+ *
+ * @param vm: the vm the code was assembled for
+ * @param code: the assembled program
+ */
+template<typename T>
+basic_packed_code<T> pack(const vm_state& vm, code_view_t code);
+
+
+/**
+ * execute packed code.
+ *
+ * behaves like `run_threaded` in its checked mode, but with items of type `T`.
+ * errors are reported the same way.
+ *
+ * @return the execution results: {last TOS item, result string from WRITE instructions}
+ */
+template<typename T>
+std::tuple<T, std::string> run_packed(basic_vm_state<T>& vm, const basic_packed_code<T>& code);
+
+
+// instantiated in packed.cpp
+extern template basic_packed_code<int32_t> pack(const vm_state&, code_view_t);
+extern template basic_packed_code<int64_t> pack(const vm_state&, code_view_t);
+extern template std::tuple<int32_t, std::string> run_packed(basic_vm_state<int32_t>&, const basic_packed_code<int32_t>&);
+extern template std::tuple<int64_t, std::string> run_packed(basic_vm_state<int64_t>&, const basic_packed_code<int64_t>&);
+
+} // namespace vm
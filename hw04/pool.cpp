@@ -0,0 +1,141 @@
+#include "pool.h"
+
+#include <algorithm>
+
+
+namespace vm {
+
+namespace {
+
+/** chunks per worker, more give better balance at more queue traffic */
+constexpr size_t chunks_per_worker = 8;
+
+} // namespace
+
+
+work_stealing_pool::work_stealing_pool(size_t threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        this->queues.push_back(std::make_unique<queue>());
+    }
+    for (size_t i = 0; i < threads; i++) {
+        this->threads.emplace_back([this, i] { this->work(i); });
+    }
+}
+
+
+work_stealing_pool::~work_stealing_pool() {
+    {
+        std::lock_guard guard{this->lock};
+        this->stopping = true;
+    }
+    this->job_ready.notify_all();
+    for (auto& thread : this->threads) {
+        thread.join();
+    }
+}
+
+
+size_t work_stealing_pool::size() const {
+    return this->threads.size();
+}
+
+
+void work_stealing_pool::parallel_for(size_t count,
+                                      const std::function<void(size_t, size_t)>& fun) {
+    if (count == 0) {
+        return;
+    }
+
+    // deal out the chunks round-robin
+    size_t workers = this->size();
+    size_t chunk_size = std::max<size_t>(1, count / (workers * chunks_per_worker));
+    size_t worker = 0;
+    for (size_t begin = 0; begin < count; begin += chunk_size) {
+        auto& target = *this->queues[worker];
+        std::lock_guard guard{target.lock};
+        target.chunks.emplace_back(begin, std::min(count, begin + chunk_size));
+        worker = (worker + 1) % workers;
+    }
+
+    std::unique_lock guard{this->lock};
+    this->job = &fun;
+    this->error = nullptr;
+    this->busy = workers;
+    this->generation++;
+    this->job_ready.notify_all();
+
+    this->job_done.wait(guard, [this] { return this->busy == 0; });
+    this->job = nullptr;
+    if (this->error) {
+        std::rethrow_exception(std::exchange(this->error, nullptr));
+    }
+}
+
+
+bool work_stealing_pool::take(size_t worker, chunk& next) {
+    {
+        auto& own = *this->queues[worker];
+        std::lock_guard guard{own.lock};
+        if (not own.chunks.empty()) {
+            next = own.chunks.back();
+            own.chunks.pop_back();
+            return true;
+        }
+    }
+
+    for (size_t i = 1; i < this->queues.size(); i++) {
+        auto& victim = *this->queues[(worker + i) % this->queues.size()];
+        std::lock_guard guard{victim.lock};
+        if (not victim.chunks.empty()) {
+            next = victim.chunks.front();
+            victim.chunks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void work_stealing_pool::work(size_t worker) {
+    size_t seen_generation = 0;
+
+    while (true) {
+        const std::function<void(size_t, size_t)>* fun;
+        {
+            std::unique_lock guard{this->lock};
+            this->job_ready.wait(guard, [&] {
+                return this->stopping or this->generation != seen_generation;
+            });
+            if (this->stopping) {
+                return;
+            }
+            seen_generation = this->generation;
+            fun = this->job;
+        }
+
+        chunk next;
+        while (this->take(worker, next)) {
+            for (size_t index = next.first; index < next.second; index++) {
+                try {
+                    (*fun)(index, worker);
+                }
+                catch (...) {
+                    std::lock_guard guard{this->lock};
+                    if (not this->error) {
+                        this->error = std::current_exception();
+                    }
+                }
+            }
+        }
+
+        std::lock_guard guard{this->lock};
+        if (--this->busy == 0) {
+            this->job_done.notify_one();
+        }
+    }
+}
+
+} // namespace vm
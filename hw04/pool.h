@@ -0,0 +1,78 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+namespace vm {
+
+/**
+ * fixed set of worker threads that process index ranges.
+ *
+ * each worker has its own queue of chunks. it takes work from the back
+ * of its own queue, and when that runs dry it steals from the front
+ * of the other workers' queues, so uneven chunks even out.
+ */
+class work_stealing_pool {
+public:
+    /**
+     * @param threads: number of workers, 0 for one per hardware thread
+     */
+    explicit work_stealing_pool(size_t threads = 0);
+    ~work_stealing_pool();
+
+    work_stealing_pool(const work_stealing_pool&) = delete;
+    work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+    /** number of worker threads */
+    size_t size() const;
+
+    /**
+     * call `fun(index, worker)` for every index in [0, count) and wait for completion.
+     *
+     * `worker` is the number of the calling worker thread, in [0, size()),
+     * so per-thread state can be kept in an array.
+     * if calls throw, the remaining work is still done and
+     * the first exception is rethrown afterwards.
+     * only one parallel_for may run at a time.
+     */
+    void parallel_for(size_t count, const std::function<void(size_t index, size_t worker)>& fun);
+
+private:
+    /** a range of indices */
+    using chunk = std::pair<size_t, size_t>;
+
+    struct queue {
+        std::mutex lock;
+        std::deque<chunk> chunks;
+    };
+
+    void work(size_t worker);
+    bool take(size_t worker, chunk& next);
+
+    std::vector<std::unique_ptr<queue>> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex lock;
+    std::condition_variable job_ready;
+    std::condition_variable job_done;
+
+    /** increased for each job, so workers notice new work */
+    size_t generation = 0;
+    /** workers still busy with the current job */
+    size_t busy = 0;
+    bool stopping = false;
+
+    const std::function<void(size_t, size_t)>* job = nullptr;
+    std::exception_ptr error;
+};
+
+} // namespace vm
@@ -0,0 +1,167 @@
+#include "profile.h"
+
+#include <cstdio>
+
+
+namespace vm {
+
+namespace {
+
+void append_json_string(std::string& out, std::string_view text) {
+    out += '"';
+    for (char c : text) {
+        switch (c) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\t': out += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            }
+            else {
+                out += c;
+            }
+        }
+    }
+    out += '"';
+}
+
+
+void append_json_number(std::string& out, double number) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.9g", number);
+    out += text;
+}
+
+} // namespace
+
+
+double branch_profile::taken_ratio() const {
+    size_t total = this->taken + this->not_taken;
+    if (total == 0) {
+        return 0;
+    }
+    return static_cast<double>(this->taken) / static_cast<double>(total);
+}
+
+
+std::string profile::to_json() const {
+    std::string out = "{\"seconds\":";
+    append_json_number(out, this->seconds);
+    out += ",\"ticks\":" + std::to_string(this->ticks);
+
+    out += ",\"instructions\":{";
+    bool first = true;
+    for (const auto& [name, stats] : this->instructions) {
+        if (not first) {
+            out += ',';
+        }
+        first = false;
+        append_json_string(out, name);
+        out += ":{\"count\":" + std::to_string(stats.count);
+        out += ",\"ticks\":" + std::to_string(stats.ticks);
+        out += ",\"seconds\":";
+        append_json_number(out, stats.seconds);
+        out += '}';
+    }
+
+    out += "},\"hotness\":[";
+    for (size_t pc = 0; pc < this->hotness.size(); pc++) {
+        if (pc > 0) {
+            out += ',';
+        }
+        out += std::to_string(this->hotness[pc]);
+    }
+
+    out += "],\"branches\":[";
+    first = true;
+    for (const auto& [pc, branch] : this->branches) {
+        if (not first) {
+            out += ',';
+        }
+        first = false;
+        out += "{\"pc\":" + std::to_string(pc);
+        out += ",\"taken\":" + std::to_string(branch.taken);
+        out += ",\"not_taken\":" + std::to_string(branch.not_taken);
+        out += ",\"taken_ratio\":";
+        append_json_number(out, branch.taken_ratio());
+        out += '}';
+    }
+    out += "]}";
+    return out;
+}
+
+
+profile_recorder::profile_recorder(const vm_state& vm, code_view_t code, profile& result)
+    : vm{vm},
+      result{result},
+      start_time{std::chrono::steady_clock::now()},
+      last_tick{profile_clock::now()},
+      counters(vm.instructions->next_op_id),
+      branch_at(code.size()),
+      branches(code.size()) {
+
+    if (result.hotness.size() < code.size()) {
+        result.hotness.resize(code.size());
+    }
+
+    for (size_t pc = 0; pc < code.size(); pc++) {
+        auto builtin = vm.instructions->builtin_opcodes.find(code[pc].first);
+        if (builtin == std::end(vm.instructions->builtin_opcodes)) {
+            continue;
+        }
+        switch (builtin->second) {
+        case opcode::jmpz:
+        case opcode::dup_jmpz:
+        case opcode::eq_jmpz:
+            this->branch_at[pc] = builtin->second;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+
+void profile_recorder::finish() {
+    std::chrono::duration<double> duration = std::chrono::steady_clock::now() - this->start_time;
+    this->result.seconds += duration.count();
+
+    uint64_t ticks = 0;
+    for (const auto& counter : this->counters) {
+        ticks += counter.ticks;
+    }
+    this->result.ticks += ticks;
+
+    for (op_id_t op_id = 0; op_id < this->counters.size(); op_id++) {
+        const auto& counter = this->counters[op_id];
+        if (counter.count == 0) {
+            continue;
+        }
+        auto& stats = this->result.instructions[this->vm.instructions->names.at(op_id)];
+        stats.count += counter.count;
+        stats.ticks += counter.ticks;
+    }
+
+    for (size_t pc = 0; pc < this->branches.size(); pc++) {
+        const auto& counter = this->branches[pc];
+        if (counter.taken + counter.not_taken > 0) {
+            auto& branch = this->result.branches[pc];
+            branch.taken += counter.taken;
+            branch.not_taken += counter.not_taken;
+        }
+    }
+
+    // convert ticks to time by the share of the total
+    for (auto& [name, stats] : this->result.instructions) {
+        if (this->result.ticks > 0) {
+            stats.seconds = this->result.seconds * static_cast<double>(stats.ticks)
+                            / static_cast<double>(this->result.ticks);
+        }
+    }
+}
+
+} // namespace vm
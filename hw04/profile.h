@@ -0,0 +1,177 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "vm.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <x86intrin.h>
+#define VM_PROFILE_RDTSC 1
+#else
+#define VM_PROFILE_RDTSC 0
+#endif
+
+
+namespace vm {
+
+/**
+ * execution statistics of one instruction.
+ */
+struct instruction_profile {
+    /** how often it was executed */
+    size_t count = 0;
+
+    /** time spent executing it, in `profile_clock` ticks */
+    uint64_t ticks = 0;
+
+    /** estimated time spent executing it */
+    double seconds = 0;
+};
+
+
+/**
+ * how a conditional jump (JMPZ, DUP_JMPZ, EQ_JMPZ) went.
+ */
+struct branch_profile {
+    size_t taken = 0;
+    size_t not_taken = 0;
+
+    /** share of executions that jumped, 0 if never executed */
+    double taken_ratio() const;
+};
+
+
+/**
+ * what a program spent its time on, recorded by the profiling `run`.
+ * repeated runs of the same code add up.
+ */
+struct profile {
+    /** total time of all profiled runs */
+    double seconds = 0;
+
+    /** total `profile_clock` ticks spent in instructions */
+    uint64_t ticks = 0;
+
+    /** statistics per instruction name */
+    std::map<std::string, instruction_profile> instructions;
+
+    /** number of executions of the instruction at each pc */
+    std::vector<size_t> hotness;
+
+    /** outcome of each conditional jump, by pc */
+    std::map<size_t, branch_profile> branches;
+
+    /** the report as a JSON object */
+    std::string to_json() const;
+};
+
+
+/**
+ * time stamps for measuring instructions.
+ * cpu cycles on x86-64, steady_clock ticks elsewhere.
+ */
+struct profile_clock {
+    static uint64_t now() {
+#if VM_PROFILE_RDTSC
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+};
+
+
+/**
+ * execution policy of the `run` loop that collects a `profile`.
+ */
+class profile_recorder {
+public:
+    profile_recorder(const vm_state& vm, code_view_t code, profile& result);
+
+    /**
+     * the clock is read once per instruction: each instruction is charged
+     * the time since the previous one finished, including its dispatch.
+     */
+    uint64_t before(const vm_state& vm, size_t pc, op_id_t, item_t) {
+        if (this->branch_at[pc]) {
+            this->jumps = will_jump(vm, *this->branch_at[pc]);
+        }
+        return this->last_tick;
+    }
+
+    void after(op_id_t op_id, size_t pc, size_t, uint64_t start) {
+        this->last_tick = profile_clock::now();
+        uint64_t ticks = this->last_tick - start;
+        auto& counter = this->counters[op_id];
+        counter.count++;
+        counter.ticks += ticks;
+
+        this->result.hotness[pc]++;
+        if (this->branch_at[pc]) {
+            auto& branch = this->branches[pc];
+            if (this->jumps) {
+                branch.taken++;
+            }
+            else {
+                branch.not_taken++;
+            }
+        }
+    }
+
+    /** add the recorded statistics to the profile */
+    void finish();
+
+private:
+    /**
+     * will the conditional jump be taken, read from the stack before it runs.
+     * the jump target may be the next pc, so it can't be told from where the vm continues.
+     */
+    static bool will_jump(const vm_state& vm, opcode code) {
+        const item_t* stack = vm.stack.data();
+        size_t size = vm.stack.size();
+        switch (code) {
+        case opcode::jmpz:
+        case opcode::dup_jmpz:
+            return size >= 1 and stack[size - 1] == 0;
+        case opcode::eq_jmpz:
+            return size >= 2 and stack[size - 2] != stack[size - 1];
+        default:
+            return false;
+        }
+    }
+
+    const vm_state& vm;
+    profile& result;
+    std::chrono::steady_clock::time_point start_time;
+    uint64_t last_tick;
+
+    /** statistics per op_id */
+    std::vector<instruction_profile> counters;
+
+    /** the conditional jump at each pc, if there is one */
+    std::vector<std::optional<opcode>> branch_at;
+
+    /** will the conditional jump that is running be taken */
+    bool jumps = false;
+
+    /** jump statistics by pc, only used where `branch_at` is set */
+    std::vector<branch_profile> branches;
+};
+
+
+/**
+ * execute the given vm instructions like `run`, and record a profile.
+ *
+ * @param report: the statistics are added to this profile
+ * @return the execution results: {last TOS item, result string from WRITE instructions}
+ */
+std::tuple<item_t, std::string> run(vm_state& vm, code_view_t code, profile& report);
+
+} // namespace vm
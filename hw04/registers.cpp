@@ -0,0 +1,441 @@
+#include "registers.h"
+
+#include <array>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+
+#include "dispatch_common.h"
+#include "verify.h"
+
+
+namespace vm {
+
+namespace {
+
+/**
+ * translates verified stack code to register form.
+ *
+ * while translating a block, each live stack slot refers to the register
+ * that holds its value: its own, a constant register, or the register
+ * of a lower slot it was duplicated from. slots are only referenced
+ * while they are in their own register, so writing a slot's register
+ * never changes the value of another slot.
+ */
+class translator {
+public:
+    translator(const vm_state& vm, code_view_t code, const verification& checked)
+        : vm{vm}, code{code}, checked{checked},
+          value(checked.max_depth + 1),
+          label(code.size()) {}
+
+    void translate();
+
+    std::vector<reg_op> out;
+    std::vector<item_t> constants;
+
+private:
+    /** register holding a constant */
+    uint32_t constant(item_t item) {
+        auto [entry, added] = this->constant_regs.try_emplace(item, this->constants.size());
+        if (added) {
+            this->constants.push_back(item);
+        }
+        return static_cast<uint32_t>(this->checked.max_depth + entry->second);
+    }
+
+    /** move the lowest `depth` slots to their own registers */
+    void materialize(size_t depth, size_t origin) {
+        for (size_t slot = 0; slot < depth; slot++) {
+            if (this->value[slot] != slot) {
+                this->emit(reg_opcode::mov, slot, this->value[slot], 0, 0, origin);
+                this->value[slot] = static_cast<uint32_t>(slot);
+            }
+        }
+    }
+
+    void emit(reg_opcode op, size_t dst, uint32_t a, uint32_t b, item_t imm, size_t origin) {
+        this->out.push_back({op, static_cast<uint32_t>(dst), a, b, imm, origin});
+    }
+
+    /** emit a jump to the stack pc `target` */
+    void emit_jump(reg_opcode op, uint32_t a, uint32_t b, item_t target, size_t origin) {
+        this->jumps.push_back(this->out.size());
+        this->emit(op, 0, a, b, target, origin);
+    }
+
+    const vm_state& vm;
+    code_view_t code;
+    const verification& checked;
+
+    /** register holding the value of each slot */
+    std::vector<uint32_t> value;
+
+    /** index of each constant's register among the constant registers */
+    std::unordered_map<item_t, size_t> constant_regs;
+
+    /** register pc of each stack pc that is a jump target */
+    std::vector<size_t> label;
+
+    /** jumps whose target is still a stack pc */
+    std::vector<size_t> jumps;
+};
+
+
+void translator::translate() {
+    const auto& builtins = this->vm.instructions->builtin_opcodes;
+
+    std::vector<opcode> ops;
+    ops.reserve(this->code.size());
+    std::vector<bool> is_target(this->code.size());
+    for (size_t pc = 0; pc < this->code.size(); pc++) {
+        ops.push_back(builtins.at(this->code[pc].first));
+        // only reachable jumps were checked by `verify`
+        if (this->checked.depth[pc] and jumps_to_arg(ops.back())) {
+            is_target[static_cast<size_t>(this->code[pc].second)] = true;
+        }
+    }
+
+    // does the previous instruction continue here?
+    bool falls_through = false;
+
+    for (size_t pc = 0; pc < this->code.size(); pc++) {
+        if (not this->checked.depth[pc]) {
+            falls_through = false;
+            continue;
+        }
+        const size_t d = *this->checked.depth[pc];
+        const opcode op = ops[pc];
+        const item_t arg = this->code[pc].second;
+
+        if (is_target[pc] or not falls_through) {
+            // all paths into a block agree on the registers
+            if (falls_through) {
+                this->materialize(d, pc);
+            }
+            for (size_t slot = 0; slot < d; slot++) {
+                this->value[slot] = static_cast<uint32_t>(slot);
+            }
+            this->label[pc] = this->out.size();
+        }
+        falls_through = op != opcode::jmp and op != opcode::exit;
+
+        auto slot = [](size_t index) { return static_cast<uint32_t>(index); };
+
+        switch (op) {
+        case opcode::load_const:
+            this->value[d] = this->constant(arg);
+            break;
+
+        case opcode::pop:
+            break;
+
+        case opcode::dup:
+            this->value[d] = this->value[d - 1];
+            break;
+
+        case opcode::add:
+        case opcode::div:
+        case opcode::eq:
+        case opcode::neq: {
+            reg_opcode binary = (op == opcode::add ? reg_opcode::add :
+                                 op == opcode::div ? reg_opcode::div :
+                                 op == opcode::eq ? reg_opcode::eq : reg_opcode::neq);
+            this->emit(binary, d - 2, this->value[d - 2], this->value[d - 1], 0, pc);
+            this->value[d - 2] = slot(d - 2);
+            break;
+        }
+
+        case opcode::load_const_add:
+            this->emit(reg_opcode::add, d - 1, this->value[d - 1], this->constant(arg), 0, pc);
+            this->value[d - 1] = slot(d - 1);
+            break;
+
+        case opcode::jmp:
+            this->materialize(d, pc);
+            this->emit_jump(reg_opcode::jmp, 0, 0, arg, pc);
+            break;
+
+        case opcode::jmpz: {
+            uint32_t condition = this->value[d - 1];
+            this->materialize(d - 1, pc);
+            this->emit_jump(reg_opcode::jz, condition, 0, arg, pc);
+            break;
+        }
+
+        case opcode::dup_jmpz: {
+            uint32_t condition = this->value[d - 1];
+            this->materialize(d, pc);
+            this->emit_jump(reg_opcode::jz, condition, 0, arg, pc);
+            break;
+        }
+
+        case opcode::eq_jmpz: {
+            uint32_t tos1 = this->value[d - 2];
+            uint32_t tos = this->value[d - 1];
+            this->materialize(d - 2, pc);
+            this->emit_jump(reg_opcode::jne, tos1, tos, arg, pc);
+            break;
+        }
+
+        case opcode::exit:
+            this->materialize(d, pc);
+            this->emit(reg_opcode::exit, 0, 0, 0, static_cast<item_t>(d), pc);
+            break;
+
+        case opcode::print:
+            this->emit(reg_opcode::print, 0, this->value[d - 1], 0, 0, pc);
+            break;
+
+        case opcode::write:
+            this->emit(reg_opcode::write, 0, this->value[d - 1], 0, 0, pc);
+            break;
+
+        case opcode::write_char:
+            this->emit(reg_opcode::write_char, 0, this->value[d - 1], 0, 0, pc);
+            break;
+
+        case opcode::load_const_write_char:
+            this->value[d] = this->constant(arg);
+            this->emit(reg_opcode::write_char, 0, this->value[d], 0, 0, pc);
+            break;
+
+        case opcode::load:
+            this->emit(reg_opcode::load, d - 1, this->value[d - 1], 0, arg, pc);
+            this->value[d - 1] = slot(d - 1);
+            break;
+
+        case opcode::store:
+            this->emit(reg_opcode::store, 0, this->value[d - 2], this->value[d - 1], arg, pc);
+            break;
+
+        case opcode::alloc:
+            this->emit(reg_opcode::alloc, d - 1, this->value[d - 1], 0, 0, pc);
+            this->value[d - 1] = slot(d - 1);
+            break;
+
+        case opcode::call:
+        case opcode::ret:
+        case opcode::custom:
+            // verified code has none of these
+            throw invalid_instruction{"can't translate instruction at pc=" + std::to_string(pc)};
+        }
+    }
+
+    for (size_t jump : this->jumps) {
+        auto& op = this->out[jump];
+        op.imm = static_cast<item_t>(this->label[static_cast<size_t>(op.imm)]);
+    }
+}
+
+
+/** registers a program may use without allocating them */
+constexpr size_t small_register_count = 64;
+
+
+/**
+ * the engine tracks the current register instruction,
+ * the vm's program counter continues after the stack instruction it came from.
+ */
+struct origin_pc {
+    size_t operator()(const reg_op* op) const {
+        return op->origin + 1;
+    }
+};
+
+} // namespace
+
+
+register_program::register_program(const vm_state& vm, code_view_t code, size_t entry_depth)
+    : interpreted{compile_threaded(vm, code, entry_depth)} {
+
+    // registers are numbered with 32 bits
+    if (not this->interpreted.verified or code.size() >= std::numeric_limits<uint32_t>::max() / 2) {
+        return;
+    }
+
+    const verification& checked = this->interpreted.checked;
+    translator translation{vm, code, checked};
+    translation.translate();
+
+    this->code = std::move(translation.out);
+    this->constants = std::move(translation.constants);
+    this->slots = checked.max_depth;
+}
+
+
+bool register_program::is_translated() const {
+    return not this->code.empty();
+}
+
+
+const std::vector<reg_op>& register_program::ops() const {
+    return this->code;
+}
+
+
+std::tuple<item_t, std::string> register_program::run(vm_state& vm) const {
+    size_t dispatches = 0;
+    return detail::flush_on_error(vm.output, [&] { return this->execute<false>(vm, dispatches); });
+}
+
+
+std::tuple<item_t, std::string> register_program::run(vm_state& vm, size_t& dispatches) const {
+    return detail::flush_on_error(vm.output, [&] { return this->execute<true>(vm, dispatches); });
+}
+
+
+VM_ENGINE_BEGIN
+
+template<bool counting>
+std::tuple<item_t, std::string> register_program::execute(vm_state& vm, size_t& dispatches) const {
+    const size_t entry_depth = this->interpreted.entry_depth;
+    if (not this->is_translated() or vm.pc != 0 or vm.stack.size() < entry_depth
+        or vm.stack.max_depth() - vm.stack.size() + entry_depth < this->slots) {
+        return run_threaded(vm, this->interpreted);
+    }
+
+    // the topmost `entry_depth` stack items are the first slots
+    const size_t base = vm.stack.size() - entry_depth;
+    // most programs fit into registers on the native stack, only larger ones allocate
+    const size_t register_count = this->slots + this->constants.size();
+    std::array<item_t, small_register_count> small_registers;
+    std::vector<item_t> large_registers;
+    if (register_count > small_register_count) {
+        large_registers.resize(register_count);
+    }
+    item_t* const r = large_registers.empty() ? small_registers.data() : large_registers.data();
+    std::copy_n(std::as_const(vm.stack).data() + base, entry_depth, r);
+    std::copy(std::begin(this->constants), std::end(this->constants), r + this->slots);
+
+    const reg_op* const code_begin = this->code.data();
+    detail::pc_sync<vm_state, const reg_op*, origin_pc> current{vm, code_begin};
+    const reg_op*& op = current.value;
+
+#if VM_COMPUTED_GOTO
+    // same order as the `reg_opcode` enum
+    static void* const handlers[] = {
+        &&do_mov, &&do_add, &&do_div, &&do_eq, &&do_neq,
+        &&do_jmp, &&do_jz, &&do_jne,
+        &&do_print, &&do_write, &&do_write_char,
+        &&do_load, &&do_store, &&do_alloc, &&do_exit,
+    };
+    static_assert(std::size(handlers) == static_cast<size_t>(reg_opcode::exit) + 1);
+
+#define VM_CASE(name) do_##name
+#define VM_DISPATCH() goto *handlers[static_cast<size_t>(op->code)]
+#else
+#define VM_CASE(name) case reg_opcode::name
+#define VM_DISPATCH() goto dispatch
+#endif
+
+// jump to the handler of the instruction at op
+#define VM_GO()                                 \
+    do {                                        \
+        if constexpr (counting)                 \
+            dispatches++;                       \
+        VM_DISPATCH();                          \
+    } while (false)
+
+#define VM_NEXT()                               \
+    do {                                        \
+        op++;                                   \
+        VM_GO();                                \
+    } while (false)
+
+#define VM_JUMP()                                               \
+    do {                                                        \
+        op = code_begin + static_cast<size_t>(op->imm);         \
+        VM_GO();                                                \
+    } while (false)
+
+    VM_GO();
+
+#if !VM_COMPUTED_GOTO
+dispatch:
+    switch (op->code) {
+#endif
+
+    VM_CASE(mov):
+        r[op->dst] = r[op->a];
+        VM_NEXT();
+
+    VM_CASE(add):
+        r[op->dst] = r[op->a] + r[op->b];
+        VM_NEXT();
+
+    VM_CASE(div):
+        if (r[op->b] == 0)
+            throw div_by_zero{"cannot divide by zero!"};
+        r[op->dst] = r[op->a] / r[op->b];
+        VM_NEXT();
+
+    VM_CASE(eq):
+        r[op->dst] = r[op->a] == r[op->b] ? 1 : 0;
+        VM_NEXT();
+
+    VM_CASE(neq):
+        r[op->dst] = r[op->a] == r[op->b] ? 0 : 1;
+        VM_NEXT();
+
+    VM_CASE(jmp):
+        VM_JUMP();
+
+    VM_CASE(jz):
+        if (r[op->a] == 0)
+            VM_JUMP();
+        VM_NEXT();
+
+    VM_CASE(jne):
+        if (r[op->a] != r[op->b])
+            VM_JUMP();
+        VM_NEXT();
+
+    VM_CASE(print):
+        std::cout << r[op->a] << std::endl;
+        VM_NEXT();
+
+    VM_CASE(write):
+        vm.output.write(r[op->a]);
+        VM_NEXT();
+
+    VM_CASE(write_char):
+        vm.output.put(static_cast<char>(r[op->a]));
+        VM_NEXT();
+
+    VM_CASE(load):
+        r[op->dst] = vm.memory.load(static_cast<uint64_t>(r[op->a]) + static_cast<uint64_t>(op->imm));
+        VM_NEXT();
+
+    VM_CASE(store):
+        vm.memory.store(static_cast<uint64_t>(r[op->b]) + static_cast<uint64_t>(op->imm), r[op->a]);
+        VM_NEXT();
+
+    VM_CASE(alloc):
+        r[op->dst] = static_cast<item_t>(vm.memory.allocate(r[op->a]));
+        VM_NEXT();
+
+    VM_CASE(exit): {
+        // write the slots back to the stack
+        const size_t depth = static_cast<size_t>(op->imm);
+        std::copy_n(r, depth, vm.stack.data() + base);
+        vm.stack.resize(base + depth);
+        return {r[depth - 1], vm.output.result()};
+    }
+
+#if !VM_COMPUTED_GOTO
+    }
+#endif
+
+#undef VM_JUMP
+#undef VM_NEXT
+#undef VM_GO
+#undef VM_DISPATCH
+#undef VM_CASE
+}
+
+VM_ENGINE_END
+
+} // namespace vm
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "dispatch.h"
+#include "vm.h"
+
+
+namespace vm {
+
+/**
+ * instructions of the register form.
+ */
+enum class reg_opcode : uint8_t {
+    mov,
+    add,
+    div,
+    eq,
+    neq,
+    jmp,
+    jz,
+    jne,
+    print,
+    write,
+    write_char,
+    load,
+    store,
+    alloc,
+    exit,
+};
+
+
+/**
+ * one three-address instruction: `dst = a op b`.
+ *
+ * operands are register numbers. the first registers hold the stack slots,
+ * the ones after them hold the program's constants.
+ */
+struct reg_op {
+    reg_opcode code;
+    uint32_t dst = 0;
+    uint32_t a = 0;
+    uint32_t b = 0;
+
+    /**
+     * jump target, memory offset for LOAD and STORE,
+     * or the number of stack slots for EXIT.
+     */
+    item_t imm = 0;
+
+    /** pc of the stack instruction this was translated from */
+    size_t origin = 0;
+};
+
+
+/**
+ * a program translated from stack code to register form.
+ *
+ * verified code has a known stack depth at each pc, so stack slot `d`
+ * becomes register `d` and instructions name their operands directly.
+ * LOAD_CONST, DUP and POP only change which register a slot refers to
+ * at translation time (copy propagation), moves are emitted only where
+ * control flow meets and the slots must be in their own registers.
+ *
+ * code that can't be verified, e.g. with custom instructions or calls,
+ * runs on the threaded interpreter instead.
+ */
+class register_program {
+public:
+    /**
+     * translate the program.
+     *
+     * @param vm: the vm the code was assembled for
+     * @param code: the assembled program
+     * @param entry_depth: how many items are at least on the stack when the program starts
+     */
+    register_program(const vm_state& vm, code_view_t code, size_t entry_depth = 0);
+
+    /**
+     * was the program translated to register form?
+     */
+    bool is_translated() const;
+
+    /**
+     * the register instructions, empty unless translated.
+     */
+    const std::vector<reg_op>& ops() const;
+
+    /**
+     * execute the program.
+     *
+     * register form is used if the vm starts at pc 0 with enough stack room,
+     * otherwise the threaded interpreter runs it.
+     * results and errors are the same as for `run`, but if the register form
+     * fails, the stack is left as it was when the program started.
+     *
+     * @return the execution results: {last TOS item, result string from WRITE instructions}
+     */
+    std::tuple<item_t, std::string> run(vm_state& vm) const;
+
+    /**
+     * like `run`, and count the executed instructions in `dispatches`.
+     */
+    std::tuple<item_t, std::string> run(vm_state& vm, size_t& dispatches) const;
+
+private:
+    template<bool counting>
+    std::tuple<item_t, std::string> execute(vm_state& vm, size_t& dispatches) const;
+
+    /** used when the register form can't be */
+    threaded_code_t interpreted;
+
+    std::vector<reg_op> code;
+
+    /** values of the constant registers, they follow the slot registers */
+    std::vector<item_t> constants;
+
+    /** number of slot registers */
+    size_t slots = 0;
+};
+
+} // namespace vm
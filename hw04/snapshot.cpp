@@ -0,0 +1,39 @@
+#include "snapshot.h"
+
+
+namespace vm {
+
+namespace {
+
+/** hand the vm's buffered output to its target, so it comes before what the forks write */
+const vm_state& flushed(vm_state& vm) {
+    vm.output.flush();
+    return vm;
+}
+
+} // namespace
+
+
+vm_snapshot::vm_snapshot(vm_state& vm)
+    : frozen{flushed(vm)} {
+
+    // the forks must not share the vm's buffer for its later output
+    this->frozen.output.drop_pending_copy();
+}
+
+
+const vm_state& vm_snapshot::state() const {
+    return this->frozen;
+}
+
+
+vm_snapshot snapshot(vm_state& vm) {
+    return vm_snapshot{vm};
+}
+
+
+vm_state fork(const vm_snapshot& snapshot) {
+    return snapshot.state();
+}
+
+} // namespace vm
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "vm.h"
+
+
+namespace vm {
+
+/**
+ * a frozen vm state, to start many runs from the same point,
+ * e.g. after running a common prelude.
+ *
+ * taking a snapshot and forking it is O(1): the operand stack,
+ * the output buffer and the instruction table are shared copy-on-write,
+ * and only copied once a fork modifies them.
+ * memory pages are shared too, forking only copies the page table.
+ * a snapshot may be forked from several threads at once.
+ *
+ * output collected without a target is part of the snapshot. output for
+ * a target is flushed when the snapshot is taken, so it reaches the
+ * target once and before anything the forks write.
+ */
+class vm_snapshot {
+public:
+    explicit vm_snapshot(vm_state& vm);
+
+    /** the frozen state */
+    const vm_state& state() const;
+
+private:
+    vm_state frozen;
+};
+
+
+/**
+ * freeze the current state of a vm, after flushing its output.
+ * the vm can go on running, it doesn't affect the snapshot.
+ */
+vm_snapshot snapshot(vm_state& vm);
+
+
+/**
+ * create a vm that continues from a snapshot.
+ */
+vm_state fork(const vm_snapshot& snapshot);
+
+} // namespace vm
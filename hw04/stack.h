@@ -0,0 +1,232 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "error.h"
+
+
+namespace vm {
+
+/**
+ * contiguous, preallocated stack of vm items.
+ *
+ * offers the `std::stack` interface the vm used before (push, pop, top,
+ * empty, size), plus batch operations for the instruction handlers.
+ * pushing beyond the maximum depth, and popping or reading from
+ * an empty stack, throws `vm_stackfail`.
+ *
+ * copies share their storage until one of them is modified (copy-on-write),
+ * so copying a vm is cheap no matter how deep its stack is.
+ *
+ * the `checked = false` variants of the modifying functions skip these checks.
+ * they are used for code whose stack usage was proven by `verify`,
+ * and they don't unshare the storage either: call `detach` before using them.
+ */
+template<typename T>
+class basic_operand_stack {
+public:
+    using value_type = T;
+
+    /** maximum depth of stacks that are not given one explicitly */
+    static constexpr size_t default_max_depth = 16 * 1024;
+
+    explicit basic_operand_stack(size_t max_depth = default_max_depth)
+        : _data{std::make_shared_for_overwrite<T[]>(max_depth)},
+          _max_depth{max_depth} {}
+
+    basic_operand_stack(const basic_operand_stack& other)
+        : _data{other._data},
+          _max_depth{other._max_depth},
+          _size{other._size},
+          _unique{false} {
+        other.mark_shared();
+    }
+
+    basic_operand_stack& operator=(const basic_operand_stack& other) {
+        if (this != &other) {
+            _data = other._data;
+            _max_depth = other._max_depth;
+            _size = other._size;
+            _unique = false;
+            other.mark_shared();
+        }
+        return *this;
+    }
+
+    basic_operand_stack(basic_operand_stack&& other) noexcept
+        : _data{std::move(other._data)},
+          _max_depth{std::exchange(other._max_depth, 0)},
+          _size{std::exchange(other._size, 0)},
+          _unique{std::exchange(other._unique, true)} {}
+
+    basic_operand_stack& operator=(basic_operand_stack&& other) noexcept {
+        _data = std::move(other._data);
+        _max_depth = std::exchange(other._max_depth, 0);
+        _size = std::exchange(other._size, 0);
+        _unique = std::exchange(other._unique, true);
+        return *this;
+    }
+
+    bool empty() const { return _size == 0; }
+    size_t size() const { return _size; }
+
+    /**
+     * how many items fit onto the stack.
+     */
+    size_t max_depth() const { return _max_depth; }
+
+    template<bool checked = true>
+    T& top() {
+        require<checked>(1);
+        unshare<checked>();
+        return _data[_size - 1];
+    }
+
+    template<bool checked = true>
+    const T& top() const {
+        require<checked>(1);
+        return _data[_size - 1];
+    }
+
+    template<bool checked = true>
+    void push(const T& item) {
+        if (checked and _size == _max_depth) [[unlikely]] {
+            throw vm_stackfail{"stack overflow!"};
+        }
+        unshare<checked>();
+        _data[_size++] = item;
+    }
+
+    template<bool checked = true>
+    void pop() {
+        require<checked>(1);
+        _size -= 1;
+    }
+
+    /**
+     * throw `vm_stackfail` unless there are at least `n` items on the stack.
+     */
+    template<bool checked = true>
+    void require(size_t n) const {
+        if (checked and _size < n) [[unlikely]] {
+            throw vm_stackfail{n == 1 ? "empty stack!" : "stack size not sufficient!"};
+        }
+    }
+
+    /**
+     * pop the two topmost items and push `fun(tos1, tos)`.
+     *
+     * if `fun` throws, the stack is left unchanged.
+     */
+    template<bool checked = true, typename F>
+    void pop2_push1(F&& fun) {
+        require<checked>(2);
+        unshare<checked>();
+        T* tos = &_data[_size - 1];
+        tos[-1] = fun(tos[-1], tos[0]);
+        _size -= 1;
+    }
+
+    /**
+     * pop the two topmost items and return them as {tos1, tos}.
+     */
+    template<bool checked = true>
+    std::pair<T, T> pop2() {
+        require<checked>(2);
+        _size -= 2;
+        return {_data[_size], _data[_size + 1]};
+    }
+
+    /**
+     * the stack memory, bottom item first.
+     * valid for `max_depth()` items.
+     */
+    T* data() {
+        detach();
+        return _data.get();
+    }
+    const T* data() const { return _data.get(); }
+
+    /**
+     * change the number of items to `n`, which must be at most `max_depth()`.
+     * new items are uninitialized, this is meant for code that
+     * filled the stack memory through `data()` itself.
+     */
+    void resize(size_t n) {
+        _size = n;
+    }
+
+    /**
+     * remove all items.
+     */
+    void clear() {
+        _size = 0;
+    }
+
+    /**
+     * give this stack its own copy of shared storage.
+     * the modifying functions do this themselves, except for `checked = false`.
+     */
+    void detach() {
+        if (not _unique) [[unlikely]] {
+            copy_shared();
+        }
+    }
+
+    /**
+     * does this stack possibly share its storage with a copy?
+     */
+    bool shared() const {
+        return not _unique;
+    }
+
+private:
+    template<bool checked>
+    void unshare() {
+        if constexpr (checked) {
+            detach();
+        }
+    }
+
+    [[gnu::noinline, gnu::cold]] void copy_shared() {
+        // the copies may be gone already
+        if (_data.use_count() > 1) {
+            auto copy = std::make_shared_for_overwrite<T[]>(_max_depth);
+            std::copy_n(_data.get(), _size, copy.get());
+            _data = std::move(copy);
+        }
+        _unique = true;
+    }
+
+    /**
+     * the storage now has another owner.
+     * only written if needed, so a stack that is already shared
+     * (e.g. a snapshot) can be copied from several threads.
+     */
+    void mark_shared() const {
+        if (_unique) {
+            _unique = false;
+        }
+    }
+
+    std::shared_ptr<T[]> _data;
+    size_t _max_depth;
+    size_t _size = 0;
+
+    /** set while `_data` is known not to be shared with a copy */
+    mutable bool _unique = true;
+};
+
+
+/** the operand stack of the vm */
+using operand_stack = basic_operand_stack<int64_t>;
+
+
+/** the return addresses of the active CALLs */
+using return_stack = basic_operand_stack<size_t>;
+
+} // namespace vm
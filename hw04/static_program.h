@@ -0,0 +1,497 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+
+#include "ops.h"
+#include "util.h"
+#include "verify.h"
+#include "vm.h"
+
+
+/**
+ * programs assembled at compile time, for programs shipped with the binary.
+ *
+ *   constexpr auto program = vm::assemble<"LOAD_CONST 1\n"
+ *                                         "EXIT\n">();
+ *   auto [tos, output] = vm::run<program>(state);
+ *
+ * invalid programs don't compile: unknown instructions, invalid arguments
+ * and jumps out of the program are reported at the line where
+ * constant evaluation failed.
+ * `run<program>` is instantiated for the program, so the compiler sees
+ * each straight-line block as one piece of code.
+ */
+namespace vm {
+
+/**
+ * one instruction of a compile-time program.
+ */
+struct static_op {
+    opcode code;
+    item_t arg;
+};
+
+
+/**
+ * an assembled compile-time program of `N` instructions.
+ */
+template<size_t N>
+struct static_code {
+    std::array<static_op, N> ops;
+
+    static constexpr size_t size() { return N; }
+
+    constexpr const static_op& operator[](size_t pc) const { return ops[pc]; }
+};
+
+
+/**
+ * the names of the built-in instructions, as `create_vm` registers them.
+ */
+inline constexpr std::pair<std::string_view, opcode> builtin_names[] = {
+    {"PRINT", opcode::print},
+    {"LOAD_CONST", opcode::load_const},
+    {"EXIT", opcode::exit},
+    {"POP", opcode::pop},
+    {"ADD", opcode::add},
+    {"DIV", opcode::div},
+    {"EQ", opcode::eq},
+    {"NEQ", opcode::neq},
+    {"DUP", opcode::dup},
+    {"JMP", opcode::jmp},
+    {"JMPZ", opcode::jmpz},
+    {"WRITE", opcode::write},
+    {"WRITE_CHAR", opcode::write_char},
+    {"LOAD_CONST_ADD", opcode::load_const_add},
+    {"DUP_JMPZ", opcode::dup_jmpz},
+    {"EQ_JMPZ", opcode::eq_jmpz},
+    {"LOAD_CONST_WRITE_CHAR", opcode::load_const_write_char},
+    {"LOAD", opcode::load},
+    {"STORE", opcode::store},
+    {"ALLOC", opcode::alloc},
+    {"CALL", opcode::call},
+    {"RET", opcode::ret},
+};
+
+
+/** implementation details of the compile-time assembler */
+namespace detail {
+
+/**
+ * cut the next line from the front of the text.
+ */
+constexpr std::string_view next_line(std::string_view& text) {
+    size_t end = text.find('\n');
+    std::string_view line = text.substr(0, end);
+    text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    return line;
+}
+
+
+/** number of lines that hold an instruction */
+consteval size_t count_instructions(std::string_view text) {
+    size_t count = 0;
+    while (not text.empty()) {
+        std::string_view line = next_line(text);
+        if (not util::next_word(line).empty()) {
+            count++;
+        }
+    }
+    return count;
+}
+
+
+consteval opcode parse_opcode(std::string_view name) {
+    for (const auto& [builtin, code] : builtin_names) {
+        if (builtin == name) {
+            return code;
+        }
+    }
+    throw "unknown instruction";
+}
+
+
+consteval item_t parse_argument(std::string_view text) {
+    bool negative = false;
+    if (text.size() > 1 and (text.front() == '-' or text.front() == '+')) {
+        negative = text.front() == '-';
+        text.remove_prefix(1);
+    }
+    // accumulate negatively, so the minimum item fits
+    item_t value = 0;
+    for (char c : text) {
+        if (c < '0' or c > '9') {
+            throw "invalid argument";
+        }
+        item_t digit = c - '0';
+        if (value < (std::numeric_limits<item_t>::min() + digit) / 10) {
+            throw "argument out of range";
+        }
+        value = value * 10 - digit;
+    }
+    if (not negative) {
+        if (value == std::numeric_limits<item_t>::min()) {
+            throw "argument out of range";
+        }
+        value = -value;
+    }
+    return value;
+}
+
+
+/** does the instruction's argument name a pc? */
+constexpr bool is_jump(opcode code) {
+    return jumps_to_arg(code) or code == opcode::call;
+}
+
+
+/** may the instruction not continue at pc + 1? */
+constexpr bool transfers_control(opcode code) {
+    return is_jump(code) or code == opcode::ret or code == opcode::exit;
+}
+
+} // namespace detail
+
+
+/**
+ * assemble a program at compile time.
+ * errors make this fail to compile.
+ *
+ * @return the program as a fixed-size array of instructions
+ */
+template<util::fixed_string text>
+consteval auto assemble() {
+    constexpr size_t size = detail::count_instructions(text.view());
+    static_code<size> code{};
+
+    std::string_view lines = text.view();
+    size_t pc = 0;
+    while (not lines.empty()) {
+        std::string_view line = detail::next_line(lines);
+        std::string_view name = util::next_word(line);
+        if (name.empty()) {
+            continue;
+        }
+        static_op& op = code.ops[pc++];
+        op.code = detail::parse_opcode(name);
+
+        std::string_view argument = util::next_word(line);
+        if (not argument.empty()) {
+            op.arg = detail::parse_argument(argument);
+        }
+        if (not util::next_word(line).empty()) {
+            throw "more than one instruction argument";
+        }
+        if (detail::is_jump(op.code) and (op.arg < 0 or static_cast<size_t>(op.arg) >= size)) {
+            throw "jump target out of range";
+        }
+    }
+    return code;
+}
+
+
+/** implementation details of `run<program>` */
+namespace detail {
+
+/** returned by a block when the program exited */
+inline constexpr size_t exited = std::numeric_limits<size_t>::max();
+
+
+/**
+ * result of `verify_static`.
+ */
+struct static_verification {
+    bool safe = false;
+    size_t max_depth = 0;
+};
+
+
+/**
+ * the checks of `verify`, done at compile time for a program started
+ * on an empty stack: no stack underflow, no running past the end,
+ * the same stack depth whenever an instruction is reached.
+ * the instructions' stack effects and successors are the ones `verify` uses.
+ */
+template<size_t N>
+consteval static_verification verify_static(const static_code<N>& program) {
+    static_verification result;
+    if (N == 0) {
+        return result;
+    }
+    // depth + 1 before each instruction, 0 while it is not reached
+    std::array<size_t, N> depth{};
+    std::array<size_t, N> worklist{};
+    size_t pending = 0;
+
+    depth[0] = 1;
+    worklist[pending++] = 0;
+    while (pending > 0) {
+        size_t pc = worklist[--pending];
+        const static_op& op = program[pc];
+
+        if (not is_verifiable(op.code)) {
+            return result;
+        }
+        const stack_effect effect = effect_of(op.code);
+        if (depth[pc] - 1 < effect.pops) {
+            return result;
+        }
+        size_t after = depth[pc] - effect.pops + effect.pushes;
+        result.max_depth = std::max(result.max_depth, after - 1);
+
+        // where the instruction continues
+        std::array<size_t, 2> next{exited, exited};
+        if (jumps_to_arg(op.code)) {
+            next[0] = static_cast<size_t>(op.arg);
+        }
+        if (continues_after(op.code)) {
+            if (pc + 1 >= N) {
+                return result;
+            }
+            next[1] = pc + 1;
+        }
+        for (size_t target : next) {
+            if (target == exited) {
+                continue;
+            }
+            if (depth[target] == 0) {
+                depth[target] = after;
+                worklist[pending++] = target;
+            }
+            else if (depth[target] != after) {
+                return result;
+            }
+        }
+    }
+
+    result.safe = true;
+    return result;
+}
+
+
+/** can the instruction fail even if the program was verified? */
+constexpr bool may_fail_verified(opcode code) {
+    switch (code) {
+    case opcode::div:
+    case opcode::print:
+    case opcode::write:
+    case opcode::write_char:
+    case opcode::load_const_write_char:
+    case opcode::load:
+    case opcode::store:
+    case opcode::alloc:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+/**
+ * which pcs start a block: the entry, jump and call targets,
+ * and the instructions after a transfer of control.
+ */
+template<size_t N>
+consteval std::array<bool, N> find_leaders(const static_code<N>& program) {
+    std::array<bool, N> leaders{};
+    if constexpr (N > 0) {
+        leaders[0] = true;
+    }
+    for (size_t pc = 0; pc < N; pc++) {
+        opcode code = program[pc].code;
+        if (is_jump(code)) {
+            leaders[static_cast<size_t>(program[pc].arg)] = true;
+        }
+        if (transfers_control(code) and pc + 1 < N) {
+            leaders[pc + 1] = true;
+        }
+    }
+    return leaders;
+}
+
+template<auto program>
+inline constexpr auto leaders = find_leaders(program);
+
+
+/** the pc after the block that starts at `pc` */
+template<auto program>
+consteval size_t block_end(size_t pc) {
+    do {
+        pc++;
+    } while (pc < program.size() and not leaders<program>[pc]);
+    return pc;
+}
+
+
+/**
+ * execute the instruction of `program` at `pc`.
+ * without `checked`, the program must be verified and start at pc 0.
+ *
+ * @return where the program continues, or `exited`
+ */
+template<auto program, bool checked, size_t pc>
+size_t execute_op(vm_state& vm) {
+    constexpr static_op op = program[pc];
+    constexpr size_t next = pc + 1;
+    constexpr auto target = static_cast<size_t>(op.arg);
+
+    // the other engines report errors with the pc after the instruction
+    if constexpr (checked or may_fail_verified(op.code)) {
+        vm.pc = next;
+    }
+
+    if constexpr (op.code == opcode::exit) {
+        vm.pc = next;
+        ops::exit<checked>(vm);
+        return exited;
+    }
+    else if constexpr (op.code == opcode::jmp) {
+        return target;
+    }
+    else if constexpr (op.code == opcode::jmpz) {
+        return ops::jmpz<checked>(vm) ? target : next;
+    }
+    else if constexpr (op.code == opcode::dup_jmpz) {
+        return ops::dup_jmpz<checked>(vm) ? target : next;
+    }
+    else if constexpr (op.code == opcode::eq_jmpz) {
+        return ops::eq_jmpz<checked>(vm) ? target : next;
+    }
+    else if constexpr (op.code == opcode::call) {
+        ops::call(vm, next);
+        return target;
+    }
+    else if constexpr (op.code == opcode::ret) {
+        return ops::ret(vm);
+    }
+    else {
+        if constexpr (op.code == opcode::print)                      { ops::print<checked>(vm); }
+        else if constexpr (op.code == opcode::load_const)            { ops::load_const<checked>(vm, op.arg); }
+        else if constexpr (op.code == opcode::pop)                   { ops::pop<checked>(vm); }
+        else if constexpr (op.code == opcode::add)                   { ops::add<checked>(vm); }
+        else if constexpr (op.code == opcode::div)                   { ops::div<checked>(vm); }
+        else if constexpr (op.code == opcode::eq)                    { ops::eq<checked>(vm); }
+        else if constexpr (op.code == opcode::neq)                   { ops::neq<checked>(vm); }
+        else if constexpr (op.code == opcode::dup)                   { ops::dup<checked>(vm); }
+        else if constexpr (op.code == opcode::write)                 { ops::write<checked>(vm); }
+        else if constexpr (op.code == opcode::write_char)            { ops::write_char<checked>(vm); }
+        else if constexpr (op.code == opcode::load_const_add)        { ops::load_const_add<checked>(vm, op.arg); }
+        else if constexpr (op.code == opcode::load_const_write_char) { ops::load_const_write_char<checked>(vm, op.arg); }
+        else if constexpr (op.code == opcode::load)                  { ops::load<checked>(vm, op.arg); }
+        else if constexpr (op.code == opcode::store)                 { ops::store<checked>(vm, op.arg); }
+        else if constexpr (op.code == opcode::alloc)                 { ops::alloc<checked>(vm); }
+        else { static_assert(op.code != op.code, "instruction can't be run"); }
+        return next;
+    }
+}
+
+
+/**
+ * execute the instructions from `pc` to the last one of its block.
+ * all but the last continue at the next instruction.
+ */
+template<auto program, bool checked, size_t pc, size_t... offsets>
+size_t execute_straight(vm_state& vm, std::index_sequence<offsets...>) {
+    (execute_op<program, checked, pc + offsets>(vm), ...);
+    return execute_op<program, checked, pc + sizeof...(offsets)>(vm);
+}
+
+
+/**
+ * execute the block of `program` that starts at `pc`.
+ * the block is expanded into one function, so the compiler can
+ * inline it as a whole.
+ *
+ * @return where the program continues, or `exited`
+ */
+template<auto program, bool checked, size_t pc>
+size_t execute_block(vm_state& vm) {
+    constexpr size_t length = block_end<program>(pc) - pc;
+    return execute_straight<program, checked, pc>(vm, std::make_index_sequence<length - 1>{});
+}
+
+
+/**
+ * entry point for `pc`: its block if it starts one, otherwise its instruction.
+ * checked execution may resume within a block, it then runs single
+ * instructions up to the next block.
+ */
+template<auto program, bool checked, size_t pc>
+constexpr auto entry_point() {
+    if constexpr (leaders<program>[pc]) {
+        return &execute_block<program, checked, pc>;
+    }
+    else {
+        return &execute_op<program, checked, pc>;
+    }
+}
+
+
+/** entry points indexed by pc */
+template<auto program, bool checked, size_t... pcs>
+constexpr auto block_table(std::index_sequence<pcs...>) {
+    return std::array<size_t (*)(vm_state&), sizeof...(pcs)>{entry_point<program, checked, pcs>()...};
+}
+
+
+template<auto program, bool checked>
+void execute(vm_state& vm) {
+    static constexpr auto blocks = block_table<program, checked>(std::make_index_sequence<program.size()>{});
+
+    if constexpr (not checked) {
+        // the unchecked stack operations don't unshare copied stacks
+        vm.stack.detach();
+    }
+
+    size_t pc = vm.pc;
+    while (pc != exited) {
+        if (checked and pc >= blocks.size()) {
+            vm.pc = pc;
+            throw vm_segfault{"seg fault!"};
+        }
+        pc = blocks[pc](vm);
+    }
+}
+
+} // namespace detail
+
+
+/**
+ * execute a program assembled at compile time.
+ *
+ * behaves exactly like `run` on the same program.
+ * only jumps go through a table, everything else is resolved
+ * when `run` is instantiated for the program.
+ * the program is verified at compile time as well, if that succeeds
+ * and it starts at pc 0 with enough stack room, it runs without
+ * stack depth and program counter checks.
+ *
+ * @return the execution results: {last TOS item, result string from WRITE instructions}
+ */
+template<auto program>
+std::tuple<item_t, std::string> run(vm_state& vm) {
+    static constexpr detail::static_verification verified = detail::verify_static(program);
+
+    detail::flush_on_error(vm.output, [&] {
+        if (verified.safe and vm.pc == 0
+            and vm.stack.max_depth() - vm.stack.size() >= verified.max_depth) {
+            detail::execute<program, false>(vm);
+        }
+        else {
+            detail::execute<program, true>(vm);
+        }
+    });
+
+    item_t tos = std::as_const(vm.stack).top();
+    return {tos, vm.output.result()};
+}
+
+} // namespace vm
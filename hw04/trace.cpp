@@ -0,0 +1,66 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <bit>
+
+
+namespace vm {
+
+trace_buffer::trace_buffer(size_t capacity)
+    : slots{std::make_unique<slot[]>(std::bit_ceil(std::max<size_t>(capacity, 1)))},
+      mask{std::bit_ceil(std::max<size_t>(capacity, 1)) - 1} {}
+
+
+size_t trace_buffer::capacity() const {
+    return this->mask + 1;
+}
+
+
+uint64_t trace_buffer::recorded() const {
+    return this->head.load(std::memory_order_acquire);
+}
+
+
+std::vector<trace_entry> trace_buffer::entries() const {
+    uint64_t end = this->head.load(std::memory_order_acquire);
+    uint64_t begin = end > this->capacity() ? end - this->capacity() : 0;
+
+    std::vector<trace_entry> result;
+    result.reserve(end - begin);
+    for (uint64_t position = begin; position < end; position++) {
+        const slot& source = this->slots[position & this->mask];
+
+        uint64_t before = source.sequence.load(std::memory_order_acquire);
+        trace_entry entry{
+            source.pc.load(std::memory_order_relaxed),
+            source.op_id.load(std::memory_order_relaxed),
+            source.tos.load(std::memory_order_relaxed),
+        };
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t after = source.sequence.load(std::memory_order_relaxed);
+
+        // skip entries the writer replaced in the meantime
+        if (before == position + 1 and after == position + 1) {
+            result.push_back(entry);
+        }
+    }
+    return result;
+}
+
+
+void trace_buffer::dump(std::ostream& out, const vm_state& vm) const {
+    const auto& names = vm.instructions->names;
+    for (const auto& [pc, op_id, tos] : this->entries()) {
+        auto name = names.find(op_id);
+        out << "pc=" << pc << " ";
+        if (name == std::end(names)) {
+            out << "op_id=" << op_id;
+        }
+        else {
+            out << name->second;
+        }
+        out << " tos=" << tos << '\n';
+    }
+}
+
+} // namespace vm
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <tuple>
+#include <vector>
+
+#include "vm.h"
+
+
+namespace vm {
+
+/**
+ * one executed instruction, as recorded in a `trace_buffer`.
+ */
+struct trace_entry {
+    size_t pc;
+    op_id_t op_id;
+
+    /** top of stack before the instruction ran, 0 if the stack was empty */
+    item_t tos;
+};
+
+
+/**
+ * ring buffer of the most recently executed instructions.
+ *
+ * filled by the tracing `run`, so when a program fails its last steps
+ * can be inspected. there is one writer, but the buffer can be read
+ * at any time from any thread, even while the program runs:
+ * each slot is guarded by a sequence number, readers skip slots
+ * that are overwritten while they read them. nothing is locked.
+ */
+class trace_buffer {
+public:
+    static constexpr size_t default_capacity = 1024;
+
+    /**
+     * @param capacity: number of entries kept, rounded up to a power of two
+     */
+    explicit trace_buffer(size_t capacity = default_capacity);
+
+    /** number of entries kept */
+    size_t capacity() const;
+
+    /** number of instructions recorded in total */
+    uint64_t recorded() const;
+
+    void record(size_t pc, op_id_t op_id, item_t tos) {
+        uint64_t position = this->head.load(std::memory_order_relaxed);
+        slot& target = this->slots[position & this->mask];
+
+        // invalidate the slot while it is written
+        target.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        target.pc.store(pc, std::memory_order_relaxed);
+        target.op_id.store(op_id, std::memory_order_relaxed);
+        target.tos.store(tos, std::memory_order_relaxed);
+        target.sequence.store(position + 1, std::memory_order_release);
+
+        this->head.store(position + 1, std::memory_order_release);
+    }
+
+    /**
+     * the recorded entries that are still in the buffer, oldest first.
+     */
+    std::vector<trace_entry> entries() const;
+
+    /**
+     * print the entries, with instruction names taken from the vm.
+     */
+    void dump(std::ostream& out, const vm_state& vm) const;
+
+private:
+    struct slot {
+        /** position + 1 of the entry in the slot, 0 while it is written */
+        std::atomic<uint64_t> sequence{0};
+        std::atomic<size_t> pc{0};
+        std::atomic<op_id_t> op_id{0};
+        std::atomic<item_t> tos{0};
+    };
+
+    std::unique_ptr<slot[]> slots;
+    size_t mask;
+
+    /** number of entries written so far */
+    std::atomic<uint64_t> head{0};
+};
+
+
+/**
+ * execute the given vm instructions like `run`, and record each
+ * instruction in the trace buffer before it is executed.
+ *
+ * @return the execution results: {last TOS item, result string from WRITE instructions}
+ */
+std::tuple<item_t, std::string> run(vm_state& vm, code_view_t code, trace_buffer& trace);
+
+} // namespace vm
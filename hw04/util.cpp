@@ -1,5 +1,21 @@
 #include "util.h"
 
+#include <cerrno>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define VM_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define VM_MMAP 0
+#endif
+
 
 namespace vm::util {
 
@@ -23,4 +39,76 @@ std::string strip(std::string_view inpt) {
 }
 
 
+mapped_file::mapped_file(const std::string& path) {
+#if VM_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::system_error{errno, std::generic_category(), "can't open " + path};
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        int error = errno;
+        close(fd);
+        throw std::system_error{error, std::generic_category(), "can't stat " + path};
+    }
+
+    // empty files can't be mapped, but they are empty anyway
+    size_t size = static_cast<size_t>(info.st_size);
+    if (size > 0) {
+        void* memory = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        int error = errno;
+        if (memory == MAP_FAILED) {
+            close(fd);
+            throw std::system_error{error, std::generic_category(), "can't map " + path};
+        }
+        mapping = memory;
+        mapping_size = size;
+    }
+    close(fd);
+#else
+    std::ifstream in{path, std::ios::binary};
+    if (not in) {
+        throw std::system_error{errno, std::generic_category(), "can't open " + path};
+    }
+    copy.assign(std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{});
+#endif
+}
+
+
+mapped_file::~mapped_file() {
+#if VM_MMAP
+    if (mapping) {
+        munmap(mapping, mapping_size);
+    }
+#endif
+}
+
+
+mapped_file::mapped_file(mapped_file&& other) noexcept
+    : mapping{std::exchange(other.mapping, nullptr)},
+      mapping_size{std::exchange(other.mapping_size, 0)},
+      copy{std::move(other.copy)} {}
+
+
+mapped_file& mapped_file::operator=(mapped_file&& other) noexcept {
+    std::swap(mapping, other.mapping);
+    std::swap(mapping_size, other.mapping_size);
+    std::swap(copy, other.copy);
+    return *this;
+}
+
+
+std::string_view mapped_file::data() const {
+    if (mapping) {
+        return {static_cast<const char*>(mapping), mapping_size};
+    }
+    return copy;
+}
+
+
+bool mapped_file::mapped() const {
+    return mapping != nullptr;
+}
+
+
 } // namespace vm::util
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstddef>
+#include <functional>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 
@@ -20,6 +23,101 @@ std::string strip(std::string_view inpt);
 
 
 
+/**
+ * string hash that also accepts string_views,
+ * for looking up string keys without creating a temporary string.
+ * use with `std::equal_to<>` as key equality.
+ */
+struct string_hash {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view txt) const {
+        return std::hash<std::string_view>{}(txt);
+    }
+};
+
+
+/**
+ * does the character separate words within a program line?
+ */
+constexpr bool is_space(char c) {
+    return c == ' ' or c == '\t' or c == '\r';
+}
+
+
+/**
+ * cut the next whitespace-separated word from the front of the text.
+ * returns an empty view if there is none.
+ * used by the assemblers at run time and at compile time.
+ */
+constexpr std::string_view next_word(std::string_view& text) {
+    size_t begin = 0;
+    while (begin < text.size() and is_space(text[begin])) {
+        begin++;
+    }
+    size_t end = begin;
+    while (end < text.size() and not is_space(text[end])) {
+        end++;
+    }
+    std::string_view word = text.substr(begin, end - begin);
+    text.remove_prefix(end);
+    return word;
+}
+
+
+/**
+ * a string literal that can be used as a template argument,
+ * e.g. `template<util::fixed_string text>`.
+ */
+template<size_t N>
+struct fixed_string {
+    char chars[N];
+
+    constexpr fixed_string(const char (&literal)[N]) {
+        for (size_t i = 0; i < N; i++) {
+            chars[i] = literal[i];
+        }
+    }
+
+    /** the string, without the terminating null character */
+    constexpr std::string_view view() const {
+        return {chars, N - 1};
+    }
+};
+
+
+/**
+ * a read-only file mapped into memory.
+ *
+ * where mmap is not available, the file is read into memory instead.
+ * throws `std::system_error` if the file can't be read.
+ */
+class mapped_file {
+public:
+    explicit mapped_file(const std::string& path);
+    ~mapped_file();
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+    mapped_file(mapped_file&& other) noexcept;
+    mapped_file& operator=(mapped_file&& other) noexcept;
+
+    /** the file contents */
+    std::string_view data() const;
+
+    /** is the content mapped, i.e. not a copy? */
+    bool mapped() const;
+
+private:
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+
+    /** file contents when they could not be mapped */
+    std::string copy;
+};
+
+
+
 /** implementation details that may unsettle innocent homework solvers */
 namespace detail {
 
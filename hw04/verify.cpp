@@ -0,0 +1,81 @@
+#include "verify.h"
+
+#include <algorithm>
+
+
+namespace vm {
+
+verification verify(const vm_state& vm, code_view_t code, size_t entry_depth) {
+    verification result;
+    result.entry_depth = entry_depth;
+    result.depth.resize(code.size());
+    result.max_depth = entry_depth;
+
+    auto fail = [&](size_t pc, std::string_view what) {
+        result.error = std::string{what} + " at pc=" + std::to_string(pc);
+        return result;
+    };
+
+    if (code.empty()) {
+        return fail(0, "no code");
+    }
+
+    // abstract interpretation: only stack depths are tracked,
+    // each reachable instruction is visited once.
+    std::vector<size_t> worklist{0};
+    result.depth[0] = entry_depth;
+
+    while (not worklist.empty()) {
+        size_t pc = worklist.back();
+        worklist.pop_back();
+
+        auto builtin = vm.instructions->builtin_opcodes.find(code[pc].first);
+        if (builtin == std::end(vm.instructions->builtin_opcodes)) {
+            return fail(pc, "custom instruction");
+        }
+        opcode op = builtin->second;
+        if (not is_verifiable(op)) {
+            // the stack depth would have to be tracked across subroutines
+            return fail(pc, "subroutine call");
+        }
+        item_t arg = code[pc].second;
+
+        size_t depth = *result.depth[pc];
+        stack_effect effect = effect_of(op);
+        if (depth < effect.pops) {
+            return fail(pc, "stack underflow");
+        }
+        depth = depth - effect.pops + effect.pushes;
+        result.max_depth = std::max(result.max_depth, depth);
+
+        // the instruction continues at these pcs
+        std::vector<size_t> next;
+        if (jumps_to_arg(op)) {
+            if (arg < 0 or static_cast<size_t>(arg) >= code.size()) {
+                return fail(pc, "jump target out of range");
+            }
+            next.push_back(static_cast<size_t>(arg));
+        }
+        if (continues_after(op)) {
+            if (pc + 1 >= code.size()) {
+                return fail(pc, "execution runs past the end of the code");
+            }
+            next.push_back(pc + 1);
+        }
+
+        for (size_t target : next) {
+            if (not result.depth[target]) {
+                result.depth[target] = depth;
+                worklist.push_back(target);
+            }
+            else if (*result.depth[target] != depth) {
+                return fail(target, "inconsistent stack depth");
+            }
+        }
+    }
+
+    result.safe = true;
+    return result;
+}
+
+} // namespace vm
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "vm.h"
+
+
+namespace vm {
+
+/**
+ * result of the static analysis done by `verify`.
+ */
+struct verification {
+    /**
+     * true if the code was proven to never underflow the stack,
+     * to jump only to valid instructions and to never run past its end.
+     */
+    bool safe = false;
+
+    /**
+     * why the code could not be proven safe.
+     */
+    std::string error;
+
+    /**
+     * how many items the analysis assumed on the stack when starting at pc 0.
+     */
+    size_t entry_depth = 0;
+
+    /**
+     * stack depth before each instruction is executed.
+     * instructions that can't be reached have no depth.
+     */
+    std::vector<std::optional<size_t>> depth;
+
+    /**
+     * the highest stack depth the code can reach.
+     */
+    size_t max_depth = 0;
+};
+
+
+/**
+ * how a built-in instruction changes the stack.
+ */
+struct stack_effect {
+    /** items that must be on the stack before the instruction */
+    size_t pops;
+    /** items the instruction leaves on the stack in their place */
+    size_t pushes;
+};
+
+
+/**
+ * the stack effect of a built-in instruction.
+ * shared by `verify` and the compile-time verification of `run<program>`.
+ */
+constexpr stack_effect effect_of(opcode code) {
+    switch (code) {
+    case opcode::load_const:            return {0, 1};
+    case opcode::dup:                   return {1, 2};
+    case opcode::pop:                   return {1, 0};
+    case opcode::jmpz:                  return {1, 0};
+    case opcode::add:
+    case opcode::div:
+    case opcode::eq:
+    case opcode::neq:                   return {2, 1};
+    case opcode::print:
+    case opcode::exit:
+    case opcode::write:
+    case opcode::write_char:            return {1, 1};
+    case opcode::load_const_add:        return {1, 1};
+    case opcode::dup_jmpz:              return {1, 1};
+    case opcode::eq_jmpz:               return {2, 0};
+    case opcode::load_const_write_char: return {0, 1};
+    case opcode::load:
+    case opcode::alloc:                 return {1, 1};
+    case opcode::store:                 return {2, 0};
+    case opcode::jmp:
+    case opcode::call:
+    case opcode::ret:
+    case opcode::custom:                return {0, 0};
+    }
+    return {0, 0};
+}
+
+
+/**
+ * can the stack depth analysis follow the instruction?
+ * subroutines would need the depth tracked across calls,
+ * custom instructions have an unknown stack effect.
+ */
+constexpr bool is_verifiable(opcode code) {
+    return code != opcode::call and code != opcode::ret and code != opcode::custom;
+}
+
+
+/**
+ * may the verifiable instruction continue at the pc in its argument?
+ */
+constexpr bool jumps_to_arg(opcode code) {
+    return code == opcode::jmp or code == opcode::jmpz
+        or code == opcode::dup_jmpz or code == opcode::eq_jmpz;
+}
+
+
+/**
+ * may the verifiable instruction continue at pc + 1?
+ */
+constexpr bool continues_after(opcode code) {
+    return code != opcode::exit and code != opcode::jmp;
+}
+
+
+/**
+ * compute the stack depth at each pc by abstract interpretation
+ * and check all jump targets.
+ *
+ * only built-in instructions can be verified, the stack effect of
+ * instructions added with `register_instruction` is unknown.
+ * each instruction must always be reached with the same stack depth,
+ * so loops that grow or shrink the stack are not verifiable either.
+ *
+ * @param vm: the vm the code was assembled for
+ * @param code: the program to check, it starts at pc 0
+ * @param entry_depth: how many items are on the stack when the program starts
+ */
+verification verify(const vm_state& vm, code_view_t code, size_t entry_depth = 0);
+
+} // namespace vm
@@ -2,240 +2,351 @@
 
 #include <iostream>
 #include <limits>
+#include <utility>
 
-#include "util.h"
+#include "assembler.h"
+#include "ops.h"
+#include "profile.h"
+#include "trace.h"
 
 
 namespace vm {
 
 
+namespace {
+
+/**
+ * add an instruction to a table, giving it the next free op_id.
+ */
+void add_instruction(instruction_table& table, std::string_view name,
+                     const op_action_t& action) {
+    size_t op_id = table.next_op_id;
+
+    //mapping instruction name -> op_id
+    table.ids.emplace(std::make_pair(static_cast<std::string>(name), op_id));
+    //mapping op_id -> instruction name
+    table.names.emplace(std::make_pair(op_id, static_cast<std::string>(name)));
+    //mapping op_id -> action
+    table.actions.emplace(std::make_pair(op_id, action));
+
+    //increment next_op_id for the next instruction to register
+    table.next_op_id++;
+}
+
+
+/**
+ * register one of the instructions every vm ships with,
+ * and remember which built-in opcode it is so execution engines
+ * can dispatch it without going through its `op_action_t`.
+ */
+void register_builtin(instruction_table& table, std::string_view name, opcode code,
+                      const op_action_t& action) {
+    table.builtin_opcodes.emplace(table.next_op_id, code);
+    add_instruction(table, name, action);
+}
+
+} // namespace
+
+
 vm_state create_vm(bool debug) {
     vm_state state;
+    auto table = std::make_shared<instruction_table>();
 
     // enable vm debugging
     state.debug = debug;
 
 
-    register_instruction(state, "PRINT", [](vm_state& vmstate, const item_t) {
-        std::cout << vmstate.stack.top() << std::endl;
+    register_builtin(*table, "PRINT", opcode::print, [](vm_state& vmstate, const item_t) {
+        ops::print(vmstate);
         return true;
     });
 
-    // TODO create instructions
-    register_instruction(state, "LOAD_CONST", [](vm_state& vmstate, const item_t item){
-        vmstate.stack.push(item);
+    register_builtin(*table, "LOAD_CONST", opcode::load_const, [](vm_state& vmstate, const item_t item){
+        ops::load_const(vmstate, item);
         return true;
     });
 
-    register_instruction(state, "EXIT", [](vm_state& vmstate, const item_t){
-        if (vmstate.stack.empty())
-        {
-            throw vm_stackfail{"empty stack!"};
-        }
+    register_builtin(*table, "EXIT", opcode::exit, [](vm_state& vmstate, const item_t){
+        ops::exit(vmstate);
         return false;
     });
 
-    register_instruction(state, "POP", [](vm_state& vmstate, const item_t){
-        if (vmstate.stack.empty())
-            throw vm_stackfail{"empty stack!"};
-        vmstate.stack.pop();
+    register_builtin(*table, "POP", opcode::pop, [](vm_state& vmstate, const item_t){
+        ops::pop(vmstate);
         return true;
     });
 
-    register_instruction(state, "ADD", [](vm_state& vmstate, const item_t){
-        if (vmstate.stack.size() < 2)
-            throw vm_stackfail{"stack size not sufficient!"};
-        item_t tos{vmstate.stack.top()};
-        vmstate.stack.pop();
-        item_t tos1{vmstate.stack.top()};
-        vmstate.stack.pop();
-        vmstate.stack.push(tos1 + tos);
+    register_builtin(*table, "ADD", opcode::add, [](vm_state& vmstate, const item_t){
+        ops::add(vmstate);
         return true;
     });
 
-    register_instruction(state, "DIV", [](vm_state& vmstate, const item_t){
-        if (vmstate.stack.size() < 2)
-            throw vm_stackfail{"stack size not sufficient!"};
-        item_t tos{vmstate.stack.top()};
-        if (tos == 0) 
-            throw div_by_zero{"cannot divide by zero!"};
-        vmstate.stack.pop();
-        item_t tos1{vmstate.stack.top()};
-        vmstate.stack.pop();
-        vmstate.stack.push(tos1 / tos);
+    register_builtin(*table, "DIV", opcode::div, [](vm_state& vmstate, const item_t){
+        ops::div(vmstate);
         return true;
     });
 
-    register_instruction(state, "EQ", [](vm_state& vmstate, const item_t){
-        if (vmstate.stack.size() < 2)
-            throw vm_stackfail{"stack size not sufficient!"};
-        item_t tos{vmstate.stack.top()};
-        vmstate.stack.pop();
-        item_t tos1{vmstate.stack.top()};
-        vmstate.stack.pop();
-        if (tos == tos1)
-            vmstate.stack.push(1);
-        else
-            vmstate.stack.push(0);
+    register_builtin(*table, "EQ", opcode::eq, [](vm_state& vmstate, const item_t){
+        ops::eq(vmstate);
         return true;
     });
 
-    register_instruction(state, "NEQ", [](vm_state& vmstate, const item_t){
-        if (vmstate.stack.size() < 2)
-            throw vm_stackfail{"stack size not sufficient!"};
-        item_t tos{vmstate.stack.top()};
-        vmstate.stack.pop();
-        item_t tos1{vmstate.stack.top()};
-        vmstate.stack.pop();
-        if (tos == tos1)
-            vmstate.stack.push(0);
-        else
-            vmstate.stack.push(1);
+    register_builtin(*table, "NEQ", opcode::neq, [](vm_state& vmstate, const item_t){
+        ops::neq(vmstate);
         return true;
     });
 
-    register_instruction(state, "DUP", [](vm_state& vmstate, const item_t){
-        if (vmstate.stack.empty())
-            throw vm_stackfail{"empty stack!"};
-        item_t tos{vmstate.stack.top()};
-        vmstate.stack.push(tos);
+    register_builtin(*table, "DUP", opcode::dup, [](vm_state& vmstate, const item_t){
+        ops::dup(vmstate);
         return true;
     });
 
-    register_instruction(state, "JMP", [](vm_state& vmstate, const item_t item){
+    register_builtin(*table, "JMP", opcode::jmp, [](vm_state& vmstate, const item_t item){
         vmstate.pc = static_cast<size_t>(item);
         return true;
     });
 
-    register_instruction(state, "JMPZ", [](vm_state& vmstate, const item_t item){
-        if (vmstate.stack.empty())
-            throw vm_stackfail{"empty stack!"};
-        if (vmstate.stack.top() == 0)
+    register_builtin(*table, "JMPZ", opcode::jmpz, [](vm_state& vmstate, const item_t item){
+        if (ops::jmpz(vmstate))
             vmstate.pc = static_cast<size_t>(item);
-        vmstate.stack.pop();
         return true;
     });
 
-    register_instruction(state, "WRITE", [](vm_state& vmstate, const item_t){
-        if (vmstate.stack.empty())
-            throw vm_stackfail{"empty stack!"};
-        item_t tos{vmstate.stack.top()};
-        //append TOS as a number to the vm output string;
-        vmstate.output_text.append(std::to_string(tos));
+    register_builtin(*table, "WRITE", opcode::write, [](vm_state& vmstate, const item_t){
+        ops::write(vmstate);
+        return true;
+    });
+
+    register_builtin(*table, "WRITE_CHAR", opcode::write_char, [](vm_state& vmstate, const item_t){
+        ops::write_char(vmstate);
+        return true;
+    });
+
+    register_builtin(*table, "LOAD_CONST_ADD", opcode::load_const_add, [](vm_state& vmstate, const item_t item){
+        ops::load_const_add(vmstate, item);
+        return true;
+    });
+
+    register_builtin(*table, "DUP_JMPZ", opcode::dup_jmpz, [](vm_state& vmstate, const item_t item){
+        if (ops::dup_jmpz(vmstate))
+            vmstate.pc = static_cast<size_t>(item);
+        return true;
+    });
+
+    register_builtin(*table, "EQ_JMPZ", opcode::eq_jmpz, [](vm_state& vmstate, const item_t item){
+        if (ops::eq_jmpz(vmstate))
+            vmstate.pc = static_cast<size_t>(item);
+        return true;
+    });
+
+    register_builtin(*table, "LOAD_CONST_WRITE_CHAR", opcode::load_const_write_char, [](vm_state& vmstate, const item_t item){
+        ops::load_const_write_char(vmstate, item);
+        return true;
+    });
+
+    register_builtin(*table, "LOAD", opcode::load, [](vm_state& vmstate, const item_t item){
+        ops::load(vmstate, item);
+        return true;
+    });
+
+    register_builtin(*table, "STORE", opcode::store, [](vm_state& vmstate, const item_t item){
+        ops::store(vmstate, item);
+        return true;
+    });
+
+    register_builtin(*table, "ALLOC", opcode::alloc, [](vm_state& vmstate, const item_t){
+        ops::alloc(vmstate);
+        return true;
+    });
+
+    register_builtin(*table, "CALL", opcode::call, [](vm_state& vmstate, const item_t item){
+        ops::call(vmstate, vmstate.pc);
+        vmstate.pc = static_cast<size_t>(item);
         return true;
     });
 
-    register_instruction(state, "WRITE_CHAR", [](vm_state& vmstate, const item_t){
-        if (vmstate.stack.empty())
-            throw vm_stackfail{"empty stack!"};
-        item_t tos{vmstate.stack.top()};
-        //append TOS as a char to the vm output string;
-        char ascii_tos = static_cast<char>(tos); //TODO CONVERSIONE INT TO CHAR NON VA
-        vmstate.output_text += ascii_tos;
+    register_builtin(*table, "RET", opcode::ret, [](vm_state& vmstate, const item_t){
+        vmstate.pc = ops::ret(vmstate);
         return true;
     });
 
+    state.instructions = std::move(table);
     return state;
 }
 
 
 void register_instruction(vm_state& state, std::string_view name,
                           const op_action_t& action) {
-    size_t op_id = state.next_op_id;
-
-    // TODO make instruction available to vm
+    // other vms may share the table, so extend a copy of it
+    auto table = std::make_shared<instruction_table>(*state.instructions);
+    add_instruction(*table, name, action);
+    state.instructions = std::move(table);
+}
 
-    //mapping instruction name -> op_id
-    state.instruction_ids.emplace(std::make_pair(static_cast<std::string>(name), op_id));
-    //mapping op_id -> instruction name
-    state.instruction_names.emplace(std::make_pair(op_id, static_cast<std::string>(name)));
-    //mapping op_id -> action
-    state.instruction_actions.emplace(std::make_pair(op_id, action));
-
-    //increment next_op_id for the next instruction to register
-    state.next_op_id++;
 
+code_t assemble(const vm_state& state, std::string_view input_program) {
+    assembler assembler{state};
+    assembler.feed(input_program);
+    return assembler.finish();
 }
 
 
-code_t assemble(const vm_state& state, std::string_view input_program) {
-    code_t code;
+std::tuple<item_t, std::string> run(vm_state& vm, const code_t& code) {
+    return run(vm, code_view_t{code});
+}
 
-    // convert each line separately
-    for (auto& line : util::split(input_program, '\n')) {
 
-        auto line_words = util::split(line, ' ');
+namespace {
 
-        // only support instruction and one argument
-        if (line_words.size() >= 3) {
-            throw invalid_instruction{std::string{"more than one instruction argument: "} + line};
-        }
+/**
+ * execution policies of the `run` loop.
+ *
+ * the loop calls `before` and `after` around each instruction,
+ * and `finish` when it stops, also by an exception.
+ * the policy is a template parameter, so a policy with empty hooks
+ * compiles to the plain loop.
+ */
 
-        // look up instruction id
-        auto& op_name = line_words[0];
-        auto find_op_id = state.instruction_ids.find(op_name);
-        if (find_op_id == std::end(state.instruction_ids)) {
-            throw invalid_instruction{std::string{"unknown instruction: "} + op_name};
-        }
-        op_id_t op_id = find_op_id->second;
+/** no tracing at all */
+struct release_policy {
+    uint64_t before(const vm_state&, size_t, op_id_t, item_t) const { return 0; }
+    void after(op_id_t, size_t, size_t, uint64_t) {}
+    void finish() {}
+};
 
-        // parse the argument
-        item_t argument{0};
-        if (line_words.size() == 2) {
-            argument = std::stoll(line_words[1]);
-        }
 
-        // and save the instruction to the code store
-        code.emplace_back(op_id, argument);
+/** print each instruction before it runs */
+struct debug_policy {
+    uint64_t before(const vm_state& vm, size_t pc, op_id_t op_id, item_t arg) const {
+        std::cout << "-- exec " << vm.instructions->names.at(op_id) << " arg=" << arg << " at pc=" << pc << '\n';
+        return 0;
     }
+    void after(op_id_t, size_t, size_t, uint64_t) {}
+    void finish() {
+        std::cout.flush();
+    }
+};
 
-    return code;
-}
 
+/** record each instruction in a ring buffer */
+struct trace_policy {
+    trace_buffer& trace;
 
-std::tuple<item_t, std::string> run(vm_state& vm, const code_t& code) {
-    // to help you debugging the code!
-    if (vm.debug) {
-        std::cout << "=== running vm ======================" << std::endl;
-        std::cout << "disassembly of run code:" << std::endl;
-        for (const auto &[op_id, arg] : code) {
-            if (not vm.instruction_names.contains(op_id)) {
-                std::cout << "could not disassemble - op_id unknown..." << std::endl;
-                std::cout << "turning off debug mode." << std::endl;
-                vm.debug = false;
-                break;
-            }
-            std::cout << vm.instruction_names[op_id] << " " << arg << std::endl;
+    uint64_t before(const vm_state& vm, size_t pc, op_id_t op_id, item_t) const {
+        item_t tos = vm.stack.empty() ? 0 : vm.stack.top();
+        trace.record(pc, op_id, tos);
+        return 0;
+    }
+    void after(op_id_t, size_t, size_t, uint64_t) {}
+    void finish() {}
+};
+
+
+/**
+ * print the code for debug mode.
+ * @return false if the code can't be disassembled
+ */
+bool print_disassembly(const vm_state& vm, code_view_t code) {
+    std::cout << "=== running vm ======================\n";
+    std::cout << "disassembly of run code:\n";
+    for (const auto &[op_id, arg] : code) {
+        auto name = vm.instructions->names.find(op_id);
+        if (name == std::end(vm.instructions->names)) {
+            std::cout << "could not disassemble - op_id unknown...\n";
+            std::cout << "turning off debug mode." << std::endl;
+            return false;
         }
-        std::cout << "=== end of disassembly" << std::endl << std::endl;
+        std::cout << name->second << " " << arg << '\n';
     }
-    std::tuple<item_t, std::string> result = {0, ""};
+    std::cout << "=== end of disassembly\n" << std::endl;
+    return true;
+}
+
+
+/**
+ * the `run` loop, with the policy called around each instruction.
+ */
+template<typename policy_t>
+std::tuple<item_t, std::string> execute(vm_state& vm, code_view_t code, policy_t& policy) {
+    const auto& actions = vm.instructions->actions;
+
     // execution loop for the machine
     while (true) {
         if (vm.pc > code.size() - 1)
             throw vm_segfault{"seg fault!"};
         auto& [op_id, arg] = code[vm.pc];
 
-        if (vm.debug) {
-            std::cout << "-- exec " << vm.instruction_names[op_id] << " arg=" << arg << " at pc=" << vm.pc << std::endl;
-        }
+        auto action = actions.find(op_id);
+        if (action == std::end(actions))
+            throw invalid_instruction{"unknown op_id: " + std::to_string(op_id)};
 
         // increase the program counter here so its value can be overwritten
         // by the instruction when it executes!
+        size_t pc = vm.pc;
         vm.pc += 1;
 
-        // TODO execute instruction and stop if the action returns false.
-        bool execution_result{vm.instruction_actions[op_id](vm, arg)};
-        item_t tos{0};
-        if (!vm.stack.empty())
-            tos = vm.stack.top();
-        std::string out_text{vm.output_text};
-        result = std::make_tuple(tos, out_text); 
-        if (execution_result == false) 
+        // execute instruction and stop if the action returns false.
+        auto start = policy.before(vm, pc, op_id, arg);
+        bool keep_running = action->second(vm, arg);
+        policy.after(op_id, pc, vm.pc, start);
+        if (not keep_running)
             break;
     }
 
-    return result; //return tuple(exit value, output text)
+    // the result is only assembled once the program exits
+    item_t tos{0};
+    if (!vm.stack.empty())
+        tos = std::as_const(vm.stack).top();
+    return {tos, vm.output.result()}; //return tuple(exit value, output text)
+}
+
+
+/**
+ * run the loop, and let the policy finish and flush the output
+ * even if the program fails.
+ */
+template<typename policy_t>
+std::tuple<item_t, std::string> execute_finished(vm_state& vm, code_view_t code, policy_t& policy) {
+    try {
+        auto result = execute(vm, code, policy);
+        policy.finish();
+        return result;
+    }
+    catch (...) {
+        vm.output.flush_after_error();
+        policy.finish();
+        throw;
+    }
+}
+
+} // namespace
+
+
+std::tuple<item_t, std::string> run(vm_state& vm, code_view_t code) {
+    // to help you debugging the code!
+    // decided once here, the release loop has no debug code at all.
+    if (vm.debug) {
+        if (print_disassembly(vm, code)) {
+            debug_policy policy;
+            return execute_finished(vm, code, policy);
+        }
+        vm.debug = false;
+    }
+    release_policy policy;
+    return execute_finished(vm, code, policy);
+}
+
+
+std::tuple<item_t, std::string> run(vm_state& vm, code_view_t code, profile& report) {
+    // errors are part of the profile too
+    profile_recorder policy{vm, code, report};
+    return execute_finished(vm, code, policy);
+}
+
+
+std::tuple<item_t, std::string> run(vm_state& vm, code_view_t code, trace_buffer& trace) {
+    trace_policy policy{trace};
+    return execute(vm, code, policy);
 }
 
 
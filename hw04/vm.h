@@ -2,14 +2,21 @@
 
 #include <cstdint>
 #include <functional>
-#include <stack>
-#include <stdexcept>
+#include <memory>
 #include <string>
 #include <string_view>
+#include <span>
 #include <sstream>
 #include <tuple>
 #include <unordered_map>
 #include <utility>
+#include <vector>
+
+#include "error.h"
+#include "memory.h"
+#include "output.h"
+#include "stack.h"
+#include "util.h"
 
 namespace vm {
 
@@ -20,7 +27,7 @@ namespace vm {
 /**
  * type used for storing data in one slot on the stack.
  */
-using item_t = int64_t;
+using item_t = operand_stack::value_type;
 
 /**
  * type used for identifying assembled opcodes.
@@ -33,7 +40,14 @@ using op_t = std::pair<op_id_t, item_t>;
 
 
 // forward declaration
-struct vm_state;
+template<typename T>
+struct basic_vm_state;
+
+/**
+ * the state of a vm with the default item type.
+ * `create_vm`, `assemble` and `run` work with this one.
+ */
+using vm_state = basic_vm_state<item_t>;
 
 /**
  * if an instruction is executed, what should be done?
@@ -41,45 +55,137 @@ struct vm_state;
  * function args: the vmstate and the operation argument.
  * return value: true if the VM should keep running on after the instruction.
  */
-using op_action_t = std::function<bool(vm_state&, const item_t)>;
+template<typename T>
+using basic_op_action_t = std::function<bool(basic_vm_state<T>&, const T)>;
+
+using op_action_t = basic_op_action_t<item_t>;
 
 
 /** stores all the assembled instructions, i.e. this is our running program */
 using code_t = std::vector<op_t>;
 
 
-/** all vm execution state information is stored in here */
-struct vm_state {
-    /**
-     * where in the program code are we?
-     */
-    size_t pc = 0;
+/** non-owning view of assembled instructions, e.g. of a mapped bytecode file */
+using code_view_t = std::span<const op_t>;
 
+
+/**
+ * the instructions built into every vm created by `create_vm`.
+ *
+ * execution engines use this to handle these instructions directly
+ * instead of calling their type-erased `op_action_t`.
+ * everything added with `register_instruction` is `custom`.
+ */
+enum class opcode : uint8_t {
+    print,
+    load_const,
+    exit,
+    pop,
+    add,
+    div,
+    eq,
+    neq,
+    dup,
+    jmp,
+    jmpz,
+    write,
+    write_char,
+
+    // superinstructions, created by `optimize`
+    load_const_add,
+    dup_jmpz,
+    eq_jmpz,
+    load_const_write_char,
+
+    // linear memory
+    load,
+    store,
+    alloc,
+
+    // subroutines
+    call,
+    ret,
+
+    custom,
+};
+
+
+/**
+ * the instructions known to a vm.
+ * it is not modified while programs run, so vms can share it.
+ */
+template<typename T>
+struct basic_instruction_table {
     /**
      * stores which id is given the next instruction that is registered.
      */
     size_t next_op_id = 0;
 
-    /**
-     * the main execution state stack.
-     */
-    std::stack<item_t> stack;
-
     /**
      * mapping of instruction name to operation id.
+     * can be searched with a string_view without copying it.
      */
-    std::unordered_map<std::string, op_id_t> instruction_ids;
+    std::unordered_map<std::string, op_id_t, util::string_hash, std::equal_to<>> ids;
 
     /**
      * mapping of operation ids back to instruction names.
      * used for debugging -> so we can resolve an op_id back to a name.
      */
-    std::unordered_map<op_id_t, std::string> instruction_names;
+    std::unordered_map<op_id_t, std::string> names;
 
     /**
      * mapping of operation id to action.
      */
-    std::unordered_map<op_id_t, op_action_t> instruction_actions;
+    std::unordered_map<op_id_t, basic_op_action_t<T>> actions;
+
+    /**
+     * mapping of operation id to the built-in opcode it implements.
+     * only filled for the instructions registered by `create_vm`.
+     */
+    std::unordered_map<op_id_t, opcode> builtin_opcodes;
+};
+
+using instruction_table = basic_instruction_table<item_t>;
+
+
+/**
+ * all vm execution state information is stored in here.
+ *
+ * `T` is the type of the items on the stack and in memory.
+ * vms with narrower items run programs packed by `pack` (see packed.h).
+ */
+template<typename T>
+struct basic_vm_state {
+    /**
+     * where in the program code are we?
+     */
+    size_t pc = 0;
+
+    /**
+     * the main execution state stack.
+     * replace it with `operand_stack{depth}` to change the maximum depth.
+     */
+    basic_operand_stack<T> stack;
+
+    /**
+     * where each active CALL continues when its callee returns.
+     * kept apart from the operand stack, so subroutines can't clobber it.
+     * replace it with `return_stack{depth}` to change the maximum call depth.
+     */
+    return_stack calls;
+
+    /**
+     * linear memory for LOAD, STORE and ALLOC.
+     * replace it with `linear_memory{size}` to change the maximum size.
+     */
+    basic_linear_memory<T> memory;
+
+    /**
+     * the registered instructions.
+     * shared with all copies of this vm, as they only differ in execution state.
+     * `register_instruction` gives this vm its own modified copy.
+     */
+    std::shared_ptr<const basic_instruction_table<T>> instructions = std::make_shared<basic_instruction_table<T>>();
 
     /**
      * activate vm debugging.
@@ -87,7 +193,12 @@ struct vm_state {
     bool debug = false;
 
     // if you need to store more vm state, add it here!
-    std::string output_text = "";
+
+    /**
+     * where WRITE and WRITE_CHAR send their text.
+     * collected for the result of `run` unless another target is set.
+     */
+    output_sink output;
 };
 
 
@@ -141,38 +252,12 @@ void register_instruction(vm_state& vm, std::string_view name,
 std::tuple<item_t, std::string> run(vm_state& vm, const code_t &code);
 
 
-//// exception types, thrown in various error situations.
-
-/**
- * exception thrown when the VM attempts to divide by zero.
- */
-struct div_by_zero : std::runtime_error {
-    using std::runtime_error::runtime_error; //inheritance of std::runtime_error constructor (I guess...)
-};
-
-
-/**
- * exception thrown when an invalid memory address is requested.
- */
-struct vm_segfault : std::runtime_error {
-    using std::runtime_error::runtime_error;
-};
-
-
 /**
- * exception thrown when the stack content is not as expected.
- */
-struct vm_stackfail : std::runtime_error {
-    using std::runtime_error::runtime_error;
-};
-
-
-/**
- * exception thrown when a instruction could not be decoded.
+ * execute vm instructions that are stored elsewhere,
+ * e.g. in a memory mapped bytecode file (see `mapped_program`).
+ *
+ * @return the execution results: {last TOS item, result string from WRITE instructions}
  */
-struct invalid_instruction : std::runtime_error {
-    using std::runtime_error::runtime_error;
-};
-
+std::tuple<item_t, std::string> run(vm_state& vm, code_view_t code);
 
 } // namespace vm
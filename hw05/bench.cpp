@@ -0,0 +1,247 @@
+#include "hw05.h"
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Simple benchmarks for hw05, build with optimizations (CMAKE_BUILD_TYPE=Release) for meaningful
+// numbers. Run all of them, or only the ones given as arguments.
+
+namespace {
+/// Runs the function and returns how many seconds it took
+double measure(const std::function<void()> &fun) {
+  auto start = std::chrono::steady_clock::now();
+  fun();
+  std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+  return duration.count();
+}
+
+/// Prints one result line with the throughput over `bytes` of query text
+void report(std::string_view name, std::size_t bytes, double seconds) {
+  std::cout << "  " << name << ": " << seconds * 1000 << " ms, "
+            << static_cast<double>(bytes) / seconds / (1024 * 1024) << " MiB/s" << std::endl;
+}
+
+/// About `bytes` of valid queries, with mixed keyword case and column lists
+std::string query_text(std::size_t bytes) {
+  const std::vector<std::string> queries = {
+      "SELECT * FROM customers;\n",
+      "select id, name, email FROM users;\n",
+      "Select order_id,customer_id , total_2023 from orders ;\n",
+      "SELECT\tcol1,\n  col2,\n  col3\nFROM\n  some_rather_long_table_name;\n",
+  };
+  std::string text;
+  text.reserve(bytes + 128);
+  for (std::size_t i = 0; text.size() < bytes; ++i) {
+    text += queries[i % queries.size()];
+  }
+  return text;
+}
+
+void lexer() {
+  const std::string text = query_text(64 * 1024 * 1024);
+  std::cout << "lexer: " << text.size() / (1024 * 1024) << " MiB of queries" << std::endl;
+
+  std::size_t count = 0;
+  report("Lexer::next", text.size(), measure([&] {
+           sql::Lexer lexer{text};
+           while (lexer.next()) {
+             ++count;
+           }
+         }));
+  report("tokenize", text.size(), measure([&] { count += sql::tokenize(text).size(); }));
+  report("tokenize + to_token", text.size(), measure([&] {
+           std::vector<sql::Token> tokens;
+           for (const auto &token : sql::tokenize(text)) {
+             tokens.push_back(token.to_token());
+           }
+           count += tokens.size();
+         }));
+
+  // keeps the loops from being optimized away
+  std::cout << "  (" << count << " tokens)" << std::endl;
+}
+
+/// The variant-based `SqlValidator` against the table-driven `DfaValidator`
+void validator() {
+  const std::string text = query_text(16 * 1024 * 1024);
+  std::vector<sql::Token> tokens;
+  for (const auto &token : sql::tokenize(text)) {
+    tokens.push_back(token.to_token());
+  }
+  std::cout << "validator: " << tokens.size() << " tokens" << std::endl;
+
+  // one long stream of valid queries, each semicolon is followed by the next SELECT
+  auto report_tokens = [&](std::string_view name, double seconds) {
+    std::cout << "  " << name << ": " << seconds * 1000 << " ms, "
+              << static_cast<double>(tokens.size()) / seconds / 1e6 << " M tokens/s" << std::endl;
+  };
+
+  std::size_t valid = 0;
+  report_tokens("SqlValidator", measure([&] {
+                  sql::SqlValidator validator;
+                  for (const auto &token : tokens) {
+                    if (validator.is_valid()) {
+                      validator = sql::SqlValidator{};
+                      ++valid;
+                    }
+                    validator.handle(token);
+                  }
+                }));
+  report_tokens("DfaValidator", measure([&] {
+                  sql::DfaValidator validator;
+                  for (const auto &token : tokens) {
+                    if (validator.is_valid()) {
+                      validator = sql::DfaValidator{};
+                      ++valid;
+                    }
+                    validator.handle(token);
+                  }
+                }));
+  std::cout << "  (" << valid << " queries)" << std::endl;
+}
+
+/// One huge query validated from chunks, against collecting all of its tokens first
+void stream() {
+  std::string query = "SELECT first_column";
+  for (std::size_t i = 0; query.size() < 64 * 1024 * 1024; ++i) {
+    query += ",\n  column_" + std::to_string(i);
+  }
+  query += "\nFROM some_table;\n";
+  std::cout << "stream: " << query.size() / (1024 * 1024) << " MiB query" << std::endl;
+
+  constexpr std::size_t chunk_size = 64 * 1024;
+  bool valid = true;
+  report("StreamingValidator, 64 KiB chunks", query.size(), measure([&] {
+           sql::StreamingValidator validator;
+           for (std::size_t begin = 0; begin < query.size(); begin += chunk_size) {
+             validator.feed(std::string_view{query}.substr(begin, chunk_size));
+           }
+           valid &= validator.finish();
+         }));
+  report("tokenize + is_valid_sql_query", query.size(), measure([&] {
+           std::vector<sql::Token> tokens;
+           for (const auto &token : sql::tokenize(query)) {
+             tokens.push_back(token.to_token());
+           }
+           valid &= sql::is_valid_sql_query(tokens);
+         }));
+  std::cout << "  (" << (valid ? "valid" : "invalid") << ")" << std::endl;
+}
+
+/// Compact tokens with interned identifiers against owning `Token`s
+void compact() {
+  const std::string text = query_text(64 * 1024 * 1024);
+  std::cout << "compact: " << text.size() / (1024 * 1024) << " MiB of queries, "
+            << sizeof(sql::CompactToken) << " bytes per compact token, " << sizeof(sql::Token)
+            << " per Token" << std::endl;
+
+  sql::SymbolTable symbols;
+  std::vector<sql::CompactToken> compact_tokens;
+  report("tokenize_compact", text.size(),
+         measure([&] { compact_tokens = sql::tokenize_compact(text, symbols); }));
+  std::vector<sql::Token> tokens;
+  report("tokenize + to_token", text.size(), measure([&] {
+           for (const auto &token : sql::tokenize(text)) {
+             tokens.push_back(token.to_token());
+           }
+         }));
+
+  std::cout << "  " << symbols.size() << " symbols" << std::endl;
+
+  // the text holds many queries, each is validated on its own
+  std::size_t valid = 0;
+  report("validate compact tokens", text.size(), measure([&] {
+           auto begin = compact_tokens.begin();
+           for (auto end = begin; end != compact_tokens.end(); ++end) {
+             if (end->kind == sql::TokenKind::Semicolon) {
+               valid += sql::is_valid_sql_query(std::span{begin, end + 1});
+               begin = end + 1;
+             }
+           }
+         }));
+  std::cout << "  (" << valid << " queries, " << tokens.size() << " tokens)" << std::endl;
+}
+
+/// Scans 100M rows through the executor, summing one column and all columns
+void scan() {
+  constexpr std::size_t rows = 100'000'000;
+
+  sql::Catalog catalog;
+  sql::Table &sales = catalog.create_table("sales");
+  {
+    std::vector<std::int64_t> ids(rows);
+    std::vector<double> prices(rows);
+    for (std::size_t i = 0; i < rows; ++i) {
+      ids[i] = static_cast<std::int64_t>(i);
+      prices[i] = static_cast<double>(i % 1000) / 100;
+    }
+    sales.add_column("id", std::move(ids));
+    sales.add_column("price", std::move(prices));
+  }
+  std::cout << "scan: " << rows / 1'000'000 << "M rows" << std::endl;
+
+  auto report_rows = [&](std::string_view name, double seconds) {
+    std::cout << "  " << name << ": " << seconds * 1000 << " ms, "
+              << static_cast<double>(rows) / seconds / 1e6 << " M rows/s" << std::endl;
+  };
+
+  const sql::Executor executor{catalog};
+  double total = 0;
+  report_rows("SELECT price FROM sales;", measure([&] {
+                auto cursor = executor.execute("SELECT price FROM sales;");
+                sql::Batch batch;
+                while (cursor.next(batch)) {
+                  for (double price : std::get<std::span<const double>>(batch.columns[0])) {
+                    total += price;
+                  }
+                }
+              }));
+  report_rows("SELECT * FROM sales;", measure([&] {
+                auto cursor = executor.execute("SELECT * FROM sales;");
+                sql::Batch batch;
+                while (cursor.next(batch)) {
+                  for (const auto &column : batch.columns) {
+                    std::visit(
+                        [&](auto values) {
+                          for (const auto &value : values) {
+                            if constexpr (std::is_arithmetic_v<std::remove_cvref_t<decltype(value)>>) {
+                              total += static_cast<double>(value);
+                            }
+                          }
+                        },
+                        column);
+                  }
+                }
+              }));
+  std::cout << "  (sum " << total << ")" << std::endl;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  const std::vector<std::pair<std::string_view, std::function<void()>>> benchmarks = {
+      {"lexer", lexer},
+      {"validator", validator},
+      {"stream", stream},
+      {"compact", compact},
+      {"scan", scan},
+  };
+
+  for (const auto &[name, benchmark] : benchmarks) {
+    bool selected = argc < 2;
+    for (int i = 1; i < argc; ++i) {
+      selected |= name == argv[i];
+    }
+    if (selected) {
+      benchmark();
+    }
+  }
+  return 0;
+}
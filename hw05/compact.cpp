@@ -0,0 +1,67 @@
+#include "compact.h"
+
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "lexer.h"
+#include "validator.h"
+
+namespace sql {
+SymbolId SymbolTable::intern(std::string_view name) {
+  if (auto found = ids_.find(name); found != ids_.end()) {
+    return found->second;
+  }
+  if (names_.size() > std::numeric_limits<SymbolId>::max()) {
+    throw std::length_error("too many symbols");
+  }
+  const auto id = static_cast<SymbolId>(names_.size());
+  ids_.emplace(names_.emplace_back(name), id);
+  return id;
+}
+
+std::string_view SymbolTable::name(SymbolId id) const { return names_.at(id); }
+
+std::size_t SymbolTable::size() const { return names_.size(); }
+
+std::vector<CompactToken> compact(std::span<const Token> tokens, SymbolTable &symbols) {
+  std::vector<CompactToken> result;
+  result.reserve(tokens.size());
+  for (const auto &token : tokens) {
+    if (const auto *identifier = std::get_if<token::Identifier>(&token.value())) {
+      result.push_back({TokenKind::Identifier, symbols.intern(identifier->name)});
+    } else {
+      result.push_back({token.kind()});
+    }
+  }
+  return result;
+}
+
+std::vector<CompactToken> tokenize_compact(std::string_view source, SymbolTable &symbols) {
+  std::vector<CompactToken> result;
+  Lexer lexer{source};
+  while (auto token = lexer.next()) {
+    if (token->kind == TokenKind::Identifier) {
+      result.push_back({token->kind, symbols.intern(token->text)});
+    } else {
+      result.push_back({token->kind});
+    }
+  }
+  return result;
+}
+
+Token to_token(CompactToken token, const SymbolTable &symbols) {
+  if (token.kind == TokenKind::Identifier) {
+    return Token{token::Identifier{std::string{symbols.name(token.symbol)}}};
+  }
+  return LexedToken{token.kind, {}, 0}.to_token();
+}
+
+bool is_valid_sql_query(std::span<const CompactToken> tokens) {
+  DfaValidator validator{};
+  for (auto i = tokens.begin(); !validator.is_invalid() && i != tokens.end(); ++i) {
+    validator.handle(i->kind);
+  }
+  return validator.is_valid();
+}
+} // namespace sql
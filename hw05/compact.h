@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "token.h"
+
+namespace sql {
+
+/// Number of an interned identifier name
+using SymbolId = std::uint32_t;
+
+/// Interning table for identifier names, every distinct name is stored once and gets a number.
+class SymbolTable {
+public:
+  SymbolTable() = default;
+
+  // names are referenced by the lookup map, so the table can't be copied
+  SymbolTable(const SymbolTable &) = delete;
+  SymbolTable &operator=(const SymbolTable &) = delete;
+
+  /// Returns the number of the name, adding it to the table if it is new
+  SymbolId intern(std::string_view name);
+
+  /// Returns the name of an interned symbol, which stays valid as long as the table
+  [[nodiscard]]
+  std::string_view name(SymbolId id) const;
+
+  /// Number of distinct names
+  [[nodiscard]]
+  std::size_t size() const;
+
+private:
+  struct Hash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view name) const { return std::hash<std::string_view>{}(name); }
+  };
+
+  /// A deque never moves its elements, so the views into them stay valid
+  std::deque<std::string> names_;
+  std::unordered_map<std::string_view, SymbolId, Hash, std::equal_to<>> ids_;
+};
+
+/// A token in 8 bytes: its kind and, for identifiers, the symbol of its name.
+/// Arrays of these can be validated and parsed without allocating.
+struct CompactToken {
+  TokenKind kind;
+  SymbolId symbol = 0;
+};
+
+static_assert(sizeof(CompactToken) == 8);
+
+/// Converts tokens to the compact form, interning their identifiers
+[[nodiscard]]
+std::vector<CompactToken> compact(std::span<const Token> tokens, SymbolTable &symbols);
+
+/// Lexes the source directly into compact tokens, see `Lexer`.
+/// Throws `LexError` for a character that doesn't start a token.
+[[nodiscard]]
+std::vector<CompactToken> tokenize_compact(std::string_view source, SymbolTable &symbols);
+
+/// Converts a compact token back to a `Token`
+[[nodiscard]]
+Token to_token(CompactToken token, const SymbolTable &symbols);
+
+/// Same as `is_valid_sql_query` for `Token`s, but on compact tokens
+[[nodiscard]]
+bool is_valid_sql_query(std::span<const CompactToken> tokens);
+} // namespace sql
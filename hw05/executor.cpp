@@ -0,0 +1,81 @@
+#include "executor.h"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+#include "compact.h"
+#include "lexer.h"
+
+namespace sql {
+SelectQuery parse_select(std::string_view query) {
+  SymbolTable symbols;
+  const std::vector<CompactToken> tokens = tokenize_compact(query, symbols);
+  if (!is_valid_sql_query(tokens)) {
+    throw QueryError("invalid query: " + std::string{query});
+  }
+
+  // a valid query is SELECT, the columns, FROM, the table and semicolons
+  SelectQuery result;
+  std::size_t i = 1;
+  for (; tokens[i].kind != TokenKind::From; ++i) {
+    if (tokens[i].kind == TokenKind::Identifier) {
+      result.columns.emplace_back(symbols.name(tokens[i].symbol));
+    }
+  }
+  result.table = symbols.name(tokens[i + 1].symbol);
+  return result;
+}
+
+ResultCursor::ResultCursor(const Table &table, std::vector<std::size_t> columns, std::size_t batch_size)
+    : table_(&table), columns_(std::move(columns)), batch_size_(std::max<std::size_t>(1, batch_size)) {}
+
+std::vector<std::string> ResultCursor::column_names() const {
+  std::vector<std::string> names;
+  names.reserve(columns_.size());
+  for (auto index : columns_) {
+    names.push_back(table_->column_names()[index]);
+  }
+  return names;
+}
+
+bool ResultCursor::next(Batch &batch) {
+  if (next_row_ >= table_->rows()) {
+    return false;
+  }
+  batch.first_row = next_row_;
+  batch.rows = std::min(batch_size_, table_->rows() - next_row_);
+  batch.columns.clear();
+  for (auto index : columns_) {
+    batch.columns.push_back(table_->slice(index, batch.first_row, batch.rows));
+  }
+  next_row_ += batch.rows;
+  return true;
+}
+
+Executor::Executor(const Catalog &catalog, std::size_t batch_size)
+    : catalog_(&catalog), batch_size_(batch_size) {}
+
+ResultCursor Executor::execute(std::string_view query) const { return execute(parse_select(query)); }
+
+ResultCursor Executor::execute(const SelectQuery &query) const {
+  const Table *table = catalog_->find_table(query.table);
+  if (table == nullptr) {
+    throw QueryError("unknown table: " + query.table);
+  }
+
+  std::vector<std::size_t> columns;
+  if (query.columns.empty()) {
+    columns.resize(table->column_names().size());
+    std::iota(columns.begin(), columns.end(), std::size_t{0});
+  }
+  for (const auto &name : query.columns) {
+    auto index = table->find_column(name);
+    if (!index) {
+      throw QueryError("unknown column: " + name + " in table " + query.table);
+    }
+    columns.push_back(*index);
+  }
+  return ResultCursor{*table, std::move(columns), batch_size_};
+}
+} // namespace sql
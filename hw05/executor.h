@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "table.h"
+
+namespace sql {
+
+/// A query of the grammar that `SqlValidator` accepts: `SELECT * | col, col FROM table;`
+struct SelectQuery {
+  std::string table;
+
+  /// The selected columns, empty for `SELECT *`
+  std::vector<std::string> columns;
+};
+
+/// Parses query text. Throws `LexError` for text that can't be tokenized and
+/// `QueryError` for queries that aren't valid.
+[[nodiscard]]
+SelectQuery parse_select(std::string_view query);
+
+/// Consecutive rows of a result. The columns point into the table, nothing is copied.
+struct Batch {
+  /// Row number of the first row in the table
+  std::size_t first_row = 0;
+
+  /// Number of rows
+  std::size_t rows = 0;
+
+  /// One view per selected column, in the order of the query
+  std::vector<ColumnView> columns;
+};
+
+/// Hands out the result of a query batch by batch.
+/// The table must stay alive and unchanged while the cursor is used.
+class ResultCursor {
+public:
+  ResultCursor(const Table &table, std::vector<std::size_t> columns, std::size_t batch_size);
+
+  /// Names of the selected columns
+  [[nodiscard]]
+  std::vector<std::string> column_names() const;
+
+  /// Moves to the next batch and stores it in `batch`, reusing its storage.
+  /// Returns false when all rows were handed out.
+  bool next(Batch &batch);
+
+private:
+  const Table *table_;
+  std::vector<std::size_t> columns_;
+  std::size_t batch_size_;
+  std::size_t next_row_ = 0;
+};
+
+/// Runs queries against the tables of a catalog.
+///
+/// A projection only selects columns, so the result refers to the stored
+/// columns and rows are streamed in batches instead of being materialized.
+class Executor {
+public:
+  /// Default number of rows per batch
+  static constexpr std::size_t default_batch_size = 64 * 1024;
+
+  /// @param catalog: the tables to query, must outlive the executor and its cursors
+  /// @param batch_size: number of rows per batch, at least 1
+  explicit Executor(const Catalog &catalog, std::size_t batch_size = default_batch_size);
+
+  /// Parses and runs a query, see `parse_select`. Throws `QueryError` for unknown tables and columns.
+  [[nodiscard]]
+  ResultCursor execute(std::string_view query) const;
+
+  /// Runs a parsed query. Throws `QueryError` for unknown tables and columns.
+  [[nodiscard]]
+  ResultCursor execute(const SelectQuery &query) const;
+
+private:
+  const Catalog *catalog_;
+  std::size_t batch_size_;
+};
+} // namespace sql
@@ -2,3 +2,8 @@
 
 #include "token.h"
 #include "validator.h"
+#include "lexer.h"
+#include "stream.h"
+#include "compact.h"
+#include "table.h"
+#include "executor.h"
@@ -0,0 +1,103 @@
+#include "lexer.h"
+
+#include <string>
+
+namespace sql {
+namespace {
+/// Compares an identifier to an upper case keyword, ignoring case.
+/// Setting bit 5 lowers ASCII letters, and identifiers only contain letters, digits and `_`,
+/// of which only the matching letters end up equal.
+bool is_keyword(std::string_view word, std::string_view keyword) {
+  if (word.size() != keyword.size()) {
+    return false;
+  }
+  for (std::size_t i = 0; i < word.size(); ++i) {
+    if ((word[i] | 0x20) != (keyword[i] | 0x20)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string describe(char c) {
+  if (c >= ' ' && c <= '~') {
+    return std::string{"'"} + c + "'";
+  }
+  return "byte " + std::to_string(static_cast<unsigned char>(c));
+}
+} // namespace
+
+TokenKind word_kind(std::string_view word) {
+  if (is_keyword(word, "SELECT")) {
+    return TokenKind::Select;
+  }
+  if (is_keyword(word, "FROM")) {
+    return TokenKind::From;
+  }
+  return TokenKind::Identifier;
+}
+
+Token LexedToken::to_token() const {
+  switch (kind) {
+  case TokenKind::Select: return Token{token::Select{}};
+  case TokenKind::Identifier: return Token{token::Identifier{std::string{text}}};
+  case TokenKind::From: return Token{token::From{}};
+  case TokenKind::Comma: return Token{token::Comma{}};
+  case TokenKind::Asterisks: return Token{token::Asterisks{}};
+  case TokenKind::Semicolon: return Token{token::Semicolon{}};
+  }
+  return Token{token::Semicolon{}};
+}
+
+LexError::LexError(std::size_t offset, char character)
+    : std::runtime_error("unexpected " + describe(character) + " at offset " + std::to_string(offset)),
+      offset_(offset) {}
+
+std::size_t LexError::offset() const { return offset_; }
+
+Lexer::Lexer(std::string_view source) : source_(source) {}
+
+std::optional<LexedToken> Lexer::next() {
+  while (pos_ < source_.size() && is_whitespace(source_[pos_])) {
+    ++pos_;
+  }
+  if (pos_ == source_.size()) {
+    return std::nullopt;
+  }
+
+  const std::size_t start = pos_;
+  const char c = source_[pos_];
+  auto single = [&](TokenKind kind) {
+    ++pos_;
+    return LexedToken{kind, source_.substr(start, 1), start};
+  };
+
+  switch (c) {
+  case ',': return single(TokenKind::Comma);
+  case '*': return single(TokenKind::Asterisks);
+  case ';': return single(TokenKind::Semicolon);
+  default: break;
+  }
+
+  if (!is_identifier_start(c)) {
+    throw LexError(start, c);
+  }
+  ++pos_;
+  while (pos_ < source_.size() && is_identifier_char(source_[pos_])) {
+    ++pos_;
+  }
+  const std::string_view word = source_.substr(start, pos_ - start);
+  return LexedToken{word_kind(word), word, start};
+}
+
+std::size_t Lexer::offset() const { return pos_; }
+
+std::vector<LexedToken> tokenize(std::string_view source) {
+  std::vector<LexedToken> tokens;
+  Lexer lexer{source};
+  while (auto token = lexer.next()) {
+    tokens.push_back(*token);
+  }
+  return tokens;
+}
+} // namespace sql
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include "token.h"
+
+namespace sql {
+
+/// A token as found by the lexer. It doesn't own any memory, its text is a slice of the source,
+/// so the source has to outlive it.
+struct LexedToken {
+  TokenKind kind;
+
+  /// The token's text as written in the source, e.g. `select` for a Select token
+  std::string_view text;
+
+  /// Byte offset of the token's first character in the source
+  std::size_t offset;
+
+  /// Convert to a `Token`, which copies the name of an identifier
+  [[nodiscard]]
+  Token to_token() const;
+};
+
+/// Raised for characters that can't start a token
+class LexError : public std::runtime_error {
+public:
+  LexError(std::size_t offset, char character);
+
+  /// Byte offset of the offending character in the source
+  [[nodiscard]]
+  std::size_t offset() const;
+
+private:
+  std::size_t offset_;
+};
+
+/// Splits query text into tokens in a single pass, without allocating.
+///
+/// `SELECT` and `FROM` are recognised regardless of case. Identifiers start with a letter or an
+/// underscore, followed by letters, digits and underscores. Whitespace separates tokens.
+class Lexer {
+public:
+  explicit Lexer(std::string_view source);
+
+  /// Returns the next token, or nothing at the end of the source.
+  /// Throws `LexError` for a character that doesn't start a token.
+  [[nodiscard]]
+  std::optional<LexedToken> next();
+
+  /// Byte offset where the next token is looked for
+  [[nodiscard]]
+  std::size_t offset() const;
+
+private:
+  std::string_view source_;
+  std::size_t pos_ = 0;
+};
+
+/// Lexes the whole source, see `Lexer`
+[[nodiscard]]
+std::vector<LexedToken> tokenize(std::string_view source);
+
+/// Kind of a word made of identifier characters: `Select`, `From` or `Identifier`
+[[nodiscard]]
+TokenKind word_kind(std::string_view word);
+
+/// Returns true iff the character can start an identifier
+[[nodiscard]]
+constexpr bool is_identifier_start(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+/// Returns true iff the character can continue an identifier
+[[nodiscard]]
+constexpr bool is_identifier_char(char c) {
+  return is_identifier_start(c) || (c >= '0' && c <= '9');
+}
+
+/// Returns true iff the character separates tokens
+[[nodiscard]]
+constexpr bool is_whitespace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+} // namespace sql
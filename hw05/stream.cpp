@@ -0,0 +1,85 @@
+#include "stream.h"
+
+#include <algorithm>
+
+namespace sql {
+bool StreamingValidator::feed(std::string_view chunk) {
+  for (const char c : chunk) {
+    if (is_invalid()) {
+      return false;
+    }
+    if (word_length_ > 0) {
+      if (is_identifier_char(c)) {
+        if (word_length_ < word_prefix_.size()) {
+          word_prefix_[word_length_] = c;
+        }
+        ++word_length_;
+        ++offset_;
+        continue;
+      }
+      end_word();
+      if (is_invalid()) {
+        return false;
+      }
+    }
+
+    switch (c) {
+    case ',': validator_.handle(TokenKind::Comma); break;
+    case '*': validator_.handle(TokenKind::Asterisks); break;
+    case ';': validator_.handle(TokenKind::Semicolon); break;
+    default:
+      if (is_identifier_start(c)) {
+        word_prefix_[0] = c;
+        word_length_ = 1;
+      } else if (!is_whitespace(c)) {
+        lex_error_ = true;
+      }
+      break;
+    }
+    if (is_invalid()) {
+      // the offset stays at the offending character
+      return false;
+    }
+    ++offset_;
+  }
+  return !is_invalid();
+}
+
+bool StreamingValidator::feed(std::span<const Token> tokens) {
+  // a word cut off by the end of the text ends where the tokens begin
+  if (word_length_ > 0 && !is_invalid()) {
+    end_word();
+  }
+  for (const auto &token : tokens) {
+    if (is_invalid()) {
+      break;
+    }
+    validator_.handle(token);
+  }
+  return !is_invalid();
+}
+
+bool StreamingValidator::finish() {
+  if (word_length_ > 0 && !is_invalid()) {
+    end_word();
+  }
+  return !lex_error_ && validator_.is_valid();
+}
+
+bool StreamingValidator::is_invalid() const { return lex_error_ || validator_.is_invalid(); }
+
+std::size_t StreamingValidator::offset() const { return offset_; }
+
+void StreamingValidator::end_word() {
+  // longer words can't be keywords, so their prefix makes no difference
+  const std::size_t kept = std::min(word_length_, word_prefix_.size());
+  const TokenKind kind = word_length_ > word_prefix_.size()
+                             ? TokenKind::Identifier
+                             : word_kind(std::string_view{word_prefix_.data(), kept});
+  validator_.handle(kind);
+  if (is_invalid()) {
+    offset_ -= word_length_;
+  }
+  word_length_ = 0;
+}
+} // namespace sql
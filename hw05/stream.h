@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <span>
+#include <string_view>
+
+#include "lexer.h"
+#include "token.h"
+#include "validator.h"
+
+namespace sql {
+
+/// Validates a query that arrives in pieces, e.g. read from a socket.
+///
+/// Text chunks may end anywhere, even within a keyword or identifier. The lexer state is kept
+/// between chunks, but never the text itself: of a word cut by a chunk end only its first
+/// characters are kept, enough to tell `SELECT` and `FROM` from identifiers.
+/// As soon as the query can't become valid any more, the rest of the input is ignored.
+class StreamingValidator {
+public:
+  StreamingValidator() = default;
+
+  /// Lexes and validates the next chunk of query text.
+  /// Returns `false` once the query is invalid, then further input can be skipped.
+  bool feed(std::string_view chunk);
+
+  /// Validates the next tokens, as `feed` does for text
+  bool feed(std::span<const Token> tokens);
+
+  /// Marks the end of the input and returns `true` iff the query is valid
+  [[nodiscard]]
+  bool finish();
+
+  /// Returns `true` iff the query is invalid, whatever input may follow
+  [[nodiscard]]
+  bool is_invalid() const;
+
+  /// Number of bytes fed so far. Once invalid, the offset of the token or
+  /// character that made the query invalid.
+  [[nodiscard]]
+  std::size_t offset() const;
+
+private:
+  /// Handles the word that ends at the current offset
+  void end_word();
+
+  DfaValidator validator_;
+  std::size_t offset_ = 0;
+
+  /// Set for a character that can't start a token
+  bool lex_error_ = false;
+
+  /// Length and first characters of the word being lexed, the length is 0 if there is none.
+  /// The longest keyword has six characters.
+  std::size_t word_length_ = 0;
+  std::array<char, 6> word_prefix_{};
+};
+} // namespace sql
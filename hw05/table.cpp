@@ -0,0 +1,58 @@
+#include "table.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace sql {
+namespace {
+std::size_t length(const Column &column) {
+  return std::visit([](const auto &values) { return values.size(); }, column);
+}
+} // namespace
+
+void Table::add_column(std::string name, Column values) {
+  if (find_column(name)) {
+    throw QueryError("duplicate column: " + name);
+  }
+  if (!columns_.empty() && length(values) != rows_) {
+    throw QueryError("column " + name + " has " + std::to_string(length(values)) + " rows instead of " +
+                     std::to_string(rows_));
+  }
+  rows_ = length(values);
+  names_.push_back(std::move(name));
+  columns_.push_back(std::move(values));
+}
+
+std::size_t Table::rows() const { return rows_; }
+
+const std::vector<std::string> &Table::column_names() const { return names_; }
+
+std::optional<std::size_t> Table::find_column(std::string_view name) const {
+  auto found = std::find(names_.begin(), names_.end(), name);
+  if (found == names_.end()) {
+    return std::nullopt;
+  }
+  return static_cast<std::size_t>(found - names_.begin());
+}
+
+const Column &Table::column(std::size_t index) const { return columns_.at(index); }
+
+ColumnView Table::slice(std::size_t index, std::size_t first, std::size_t count) const {
+  return std::visit(
+      [&](const auto &values) -> ColumnView { return std::span{values}.subspan(first, count); },
+      column(index));
+}
+
+Table &Catalog::create_table(std::string name) {
+  auto [table, inserted] = tables_.try_emplace(std::move(name));
+  if (!inserted) {
+    throw QueryError("duplicate table: " + table->first);
+  }
+  return table->second;
+}
+
+const Table *Catalog::find_table(std::string_view name) const {
+  auto found = tables_.find(name);
+  return found == tables_.end() ? nullptr : &found->second;
+}
+} // namespace sql
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace sql {
+
+/// Values of one column, stored contiguously
+using Column = std::variant<std::vector<std::int64_t>, std::vector<double>, std::vector<std::string>>;
+
+/// A read-only slice of a column, pointing into the table's storage
+using ColumnView = std::variant<std::span<const std::int64_t>, std::span<const double>, std::span<const std::string>>;
+
+/// Raised for queries that are invalid or name tables and columns that don't exist,
+/// and for tables that are built inconsistently
+class QueryError : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+/// An in-memory table stored by column. All columns have the same number of rows.
+class Table {
+public:
+  Table() = default;
+
+  /// Adds a column. Throws `QueryError` if the name is taken or the column's length
+  /// differs from the other columns.
+  void add_column(std::string name, Column values);
+
+  /// Number of rows
+  [[nodiscard]]
+  std::size_t rows() const;
+
+  /// Column names in the order they were added
+  [[nodiscard]]
+  const std::vector<std::string> &column_names() const;
+
+  /// Position of the named column, if there is one
+  [[nodiscard]]
+  std::optional<std::size_t> find_column(std::string_view name) const;
+
+  /// The column at the given position
+  [[nodiscard]]
+  const Column &column(std::size_t index) const;
+
+  /// The rows [first, first + count) of the column at the given position, without copying
+  [[nodiscard]]
+  ColumnView slice(std::size_t index, std::size_t first, std::size_t count) const;
+
+private:
+  std::vector<std::string> names_;
+  std::vector<Column> columns_;
+  std::size_t rows_ = 0;
+};
+
+/// The tables of a database, by name
+class Catalog {
+public:
+  Catalog() = default;
+
+  /// Creates an empty table, throws `QueryError` if the name is taken
+  Table &create_table(std::string name);
+
+  /// The named table, or `nullptr` if there is none
+  [[nodiscard]]
+  const Table *find_table(std::string_view name) const;
+
+private:
+  std::map<std::string, Table, std::less<>> tables_;
+};
+} // namespace sql
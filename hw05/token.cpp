@@ -1,7 +1,24 @@
 #include "token.h"
 
+#include <cstddef>
+#include <type_traits>
+
 namespace sql {
 Token::Token(token_type value) : value_(value) {}
 
-Token::token_type Token::value() const { return value_; }
+const Token::token_type &Token::value() const { return value_; }
+
+TokenKind Token::kind() const { return static_cast<TokenKind>(value_.index()); }
+
+namespace {
+template <TokenKind kind, class T>
+constexpr bool kind_is =
+    std::is_same_v<std::variant_alternative_t<static_cast<std::size_t>(kind), Token::token_type>, T>;
+} // namespace
+
+// `kind` relies on the enum listing the alternatives in order
+static_assert(kind_is<TokenKind::Select, token::Select> && kind_is<TokenKind::Identifier, token::Identifier> &&
+              kind_is<TokenKind::From, token::From> && kind_is<TokenKind::Comma, token::Comma> &&
+              kind_is<TokenKind::Asterisks, token::Asterisks> &&
+              kind_is<TokenKind::Semicolon, token::Semicolon>);
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <variant>
 
@@ -25,6 +26,9 @@ struct Semicolon{};
 
 } // namespace token
 
+/// The kinds of tokens, in the same order as the alternatives of `Token::token_type`
+enum class TokenKind : std::uint8_t { Select, Identifier, From, Comma, Asterisks, Semicolon };
+
 /// Simple class representing a token for our simplified SQL select clause. A token be any of the
 /// token types. And at runtime you can query which type is currently stored in the token.
 class Token {
@@ -41,7 +45,11 @@ public:
 
   /// Getter for the underlying variant
   [[nodiscard]]
-  token_type value() const;
+  const token_type &value() const;
+
+  /// Which kind of token this is, without copying the value
+  [[nodiscard]]
+  TokenKind kind() const;
 
 private:
   token_type value_;
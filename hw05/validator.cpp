@@ -1,20 +1,23 @@
 #include "validator.h"
 
+#include <array>
+#include <cstddef>
+#include <utility>
 #include <variant>
 #include <vector>
 
 #include "token.h"
 
 namespace sql {
-bool is_valid_sql_query(std::vector<Token> tokens) {
-  SqlValidator sqlValidator{};
+bool is_valid_sql_query(const std::vector<Token> &tokens) {
+  DfaValidator validator{};
   auto i = tokens.begin();
-  while (!sqlValidator.is_invalid() && i != tokens.end()) //exit the loop iff arriving in an ending state 
+  while (!validator.is_invalid() && i != tokens.end()) //exit the loop iff arriving in an ending state 
   {
-    sqlValidator.handle(*i);
+    validator.handle(*i);
     i++;
   }
-  return sqlValidator.is_valid(); //true if current state is `Valid`, false if current state is `Invalid`
+  return validator.is_valid(); //true if current state is `Valid`, false if current state is `Invalid`
 }
 
 
@@ -31,90 +34,147 @@ void SqlValidator::handle(Token token){
 }
 
 struct TransitionFromStartVisitor {
-  State operator()(token::Select) const { return state::SelectStmt{}; }
+  constexpr State operator()(token::Select) const { return state::SelectStmt{}; }
   /// All the other tokens, put it in the invalid state
-  State operator()(auto) const { return state::Invalid{}; }
+  constexpr State operator()(auto) const { return state::Invalid{}; }
 };
 
 struct TransitionFromValidVisitor {
-  State operator()(token::Semicolon) const { return state::Valid{}; }
+  constexpr State operator()(token::Semicolon) const { return state::Valid{}; }
   /// All the other tokens, put it in the invalid state
-  State operator()(auto) const { return state::Invalid{}; }
+  constexpr State operator()(auto) const { return state::Invalid{}; }
 };
 
 
 struct TransitionFromSelectStmtVisitor {
-  State operator()(token::Asterisks) const { return state::AllColumns{}; }
-  State operator()(token::Identifier) const { return state::NamedColumn{}; }
+  constexpr State operator()(token::Asterisks) const { return state::AllColumns{}; }
+  constexpr State operator()(token::Identifier) const { return state::NamedColumn{}; }
   /// All the other tokens, put it in the invalid state
-  State operator()(auto) const { return state::Invalid{}; }
+  constexpr State operator()(auto) const { return state::Invalid{}; }
 };
 
 struct TransitionFromAllColumnsVisitor {
-  State operator()(token::From) const { return state::FromClause{}; }
+  constexpr State operator()(token::From) const { return state::FromClause{}; }
   /// All the other tokens, put it in the invalid state
-  State operator()(auto) const { return state::Invalid{}; }
+  constexpr State operator()(auto) const { return state::Invalid{}; }
 };
 
 struct TransitionFromNamedColumnVisitor {
-  State operator()(token::From) const { return state::FromClause{}; }
-  State operator()(token::Comma) const { return state::MoreColumns{}; }
+  constexpr State operator()(token::From) const { return state::FromClause{}; }
+  constexpr State operator()(token::Comma) const { return state::MoreColumns{}; }
   /// All the other tokens, put it in the invalid state
-  State operator()(auto) const { return state::Invalid{}; }
+  constexpr State operator()(auto) const { return state::Invalid{}; }
 };
 
 struct TransitionFromMoreColumnsVisitor {
-  State operator()(token::Identifier) const { return state::NamedColumn{}; }
+  constexpr State operator()(token::Identifier) const { return state::NamedColumn{}; }
   /// All the other tokens, put it in the invalid state
-  State operator()(auto) const { return state::Invalid{}; }
+  constexpr State operator()(auto) const { return state::Invalid{}; }
 };
 
 struct TransitionFromFromClauseVisitor {
-  State operator()(token::Identifier) const { return state::TableName{}; }
+  constexpr State operator()(token::Identifier) const { return state::TableName{}; }
   /// All the other tokens, put it in the invalid state
-  State operator()(auto) const { return state::Invalid{}; }
+  constexpr State operator()(auto) const { return state::Invalid{}; }
 };
 
 struct TransitionFromTableNameVisitor {
-  State operator()(token::Semicolon) const { return state::Valid{}; }
+  constexpr State operator()(token::Semicolon) const { return state::Valid{}; }
   /// All the other tokens, put it in the invalid state
-  State operator()(auto) const { return state::Invalid{}; }
+  constexpr State operator()(auto) const { return state::Invalid{}; }
 };
 
-State transition(state::Start, Token token) {
-  return std::visit(TransitionFromStartVisitor{}, token.value());
+/// Transitions on the bare token value, shared by `transition` and the transition table
+constexpr State next_state(state::Invalid, const Token::token_type &) { return state::Invalid{}; }
+
+constexpr State next_state(state::Start, const Token::token_type &token) {
+  return std::visit(TransitionFromStartVisitor{}, token);
 }
 
-State transition(state::Valid, Token token) {
-  return std::visit(TransitionFromValidVisitor{}, token.value());
+constexpr State next_state(state::Valid, const Token::token_type &token) {
+  return std::visit(TransitionFromValidVisitor{}, token);
+}
+
+constexpr State next_state(state::SelectStmt, const Token::token_type &token) {
+  return std::visit(TransitionFromSelectStmtVisitor{}, token);
+}
+
+constexpr State next_state(state::AllColumns, const Token::token_type &token) {
+  return std::visit(TransitionFromAllColumnsVisitor{}, token);
+}
+
+constexpr State next_state(state::NamedColumn, const Token::token_type &token) {
+  return std::visit(TransitionFromNamedColumnVisitor{}, token);
+}
+
+constexpr State next_state(state::MoreColumns, const Token::token_type &token) {
+  return std::visit(TransitionFromMoreColumnsVisitor{}, token);
+}
+
+constexpr State next_state(state::FromClause, const Token::token_type &token) {
+  return std::visit(TransitionFromFromClauseVisitor{}, token);
+}
+
+constexpr State next_state(state::TableName, const Token::token_type &token) {
+  return std::visit(TransitionFromTableNameVisitor{}, token);
 }
 
 State transition(state::Invalid, Token) {
   return state::Invalid{};
 }
 
+State transition(state::Start, Token token) {
+  return next_state(state::Start{}, token.value());
+}
+
+State transition(state::Valid, Token token) {
+  return next_state(state::Valid{}, token.value());
+}
+
 State transition(state::SelectStmt, Token token) {
-  return std::visit(TransitionFromSelectStmtVisitor{}, token.value());
+  return next_state(state::SelectStmt{}, token.value());
 }
 
 State transition(state::AllColumns, Token token) {
-  return std::visit(TransitionFromAllColumnsVisitor{}, token.value());
+  return next_state(state::AllColumns{}, token.value());
 }
 
 State transition(state::NamedColumn, Token token) {
-  return std::visit(TransitionFromNamedColumnVisitor{}, token.value());
+  return next_state(state::NamedColumn{}, token.value());
 }
 
 State transition(state::MoreColumns, Token token) {
-  return std::visit(TransitionFromMoreColumnsVisitor{}, token.value());
+  return next_state(state::MoreColumns{}, token.value());
 }
 
 State transition(state::FromClause, Token token) {
-  return std::visit(TransitionFromFromClauseVisitor{}, token.value());
+  return next_state(state::FromClause{}, token.value());
 }
 
 State transition(state::TableName, Token token) {
-  return std::visit(TransitionFromTableNameVisitor{}, token.value());
+  return next_state(state::TableName{}, token.value());
 }
 
+namespace dfa {
+namespace {
+/// Entry for the given state and token kind, found by running the visitors at compile time
+template <std::size_t state, std::size_t kind> constexpr StateId table_entry() {
+  const State next = next_state(std::variant_alternative_t<state, State>{},
+                                Token::token_type{std::in_place_index<kind>});
+  return static_cast<StateId>(next.index());
+}
+
+template <std::size_t state, std::size_t... kinds>
+constexpr std::array<StateId, kind_count> table_row(std::index_sequence<kinds...>) {
+  return {table_entry<state, kinds>()...};
+}
+
+template <std::size_t... states> constexpr Table make_table(std::index_sequence<states...>) {
+  return {table_row<states>(std::make_index_sequence<kind_count>{})...};
+}
+} // namespace
+
+constinit const Table table = make_table(std::make_index_sequence<state_count>{});
+} // namespace dfa
+
 } // namespace sql
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <variant>
 #include <vector>
 
@@ -103,6 +106,47 @@ private:
   State state_ = state::Start{};
 };
 
+/// The FSM compiled into a dense `[state][token kind]` lookup table.
+/// States are numbered like the alternatives of `State`, token kinds like `TokenKind`.
+namespace dfa {
+using StateId = std::uint8_t;
+
+inline constexpr std::size_t state_count = std::variant_size_v<State>;
+inline constexpr std::size_t kind_count = std::variant_size_v<Token::token_type>;
+
+using Table = std::array<std::array<StateId, kind_count>, state_count>;
+
+/// Built at compile time by running the `transition` visitors on every state and token kind
+extern const Table table;
+
+/// Number of a state in the table
+template <class S> inline constexpr StateId id = static_cast<StateId>(State{S{}}.index());
+} // namespace dfa
+
+/// Same machine as `SqlValidator`, but every token is handled with one load from `dfa::table`
+/// instead of visiting the state and the token variants.
+class DfaValidator {
+public:
+  DfaValidator() = default;
+
+  /// Returns `true` iff the machine is in the `Valid` state
+  [[nodiscard]]
+  bool is_valid() const { return state_ == dfa::id<state::Valid>; }
+
+  /// Returns `true` iff the machine is in the `Invalid` state
+  [[nodiscard]]
+  bool is_invalid() const { return state_ == dfa::id<state::Invalid>; }
+
+  /// Moves from one state to the next given the token kind.
+  void handle(TokenKind kind) { state_ = dfa::table[state_][static_cast<std::size_t>(kind)]; }
+
+  /// Moves from one state to the next given the token.
+  void handle(const Token &token) { handle(token.kind()); }
+
+private:
+  dfa::StateId state_ = dfa::id<state::Start>;
+};
+
 /// TODO: Implement this function!
 ///
 /// Given a sequence of tokens, this functions returns true, if it is a valid
@@ -118,5 +162,5 @@ private:
 ///
 /// These sequences must be given in a `std::vector<Token>`
 [[nodiscard]]
-bool is_valid_sql_query(std::vector<Token> tokens);
+bool is_valid_sql_query(const std::vector<Token> &tokens);
 } // namespace sql
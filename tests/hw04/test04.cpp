@@ -10,8 +10,14 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include <doctest/doctest.h>
 
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <iterator>
 #include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
 
 
 #include "hw04.h"
@@ -684,3 +690,1532 @@ TEST_CASE("vm_segfault") {
         REQUIRE_THROWS_AS(vm::run(state, code), vm::vm_segfault);
     }
 }
+
+
+TEST_CASE("vm_threaded") {
+    SUBCASE("same_results_as_run") {
+        const std::vector<std::string> programs = {
+            "LOAD_CONST 3521\n"
+            "LOAD_CONST 5652\n"
+            "ADD\n"
+            "EXIT\n",
+
+            "LOAD_CONST 36\n"
+            "LOAD_CONST 1337\n"
+            "LOAD_CONST 101\n"
+            "WRITE_CHAR\n"
+            "POP\n"
+            "WRITE\n"
+            "POP\n"
+            "WRITE_CHAR\n"
+            "EXIT\n",
+
+            "LOAD_CONST 701\n"
+            "LOAD_CONST 20\n"
+            "EQ\n"
+            "JMPZ 6\n"
+            "LOAD_CONST 8001\n"
+            "JMP 7\n"
+            "LOAD_CONST 6231\n"
+            "EXIT\n",
+
+            "LOAD_CONST 10\n"
+            "LOAD_CONST -1\n"
+            "ADD\n"
+            "DUP\n"
+            "WRITE\n"
+            "JMPZ 7\n"
+            "JMP 1\n"
+            "EXIT\n",
+        };
+
+        for (const auto& program : programs) {
+            vm::vm_state reference_state = vm::create_vm();
+            const auto& expected = vm::run(reference_state, vm::assemble(reference_state, program));
+
+            vm::vm_state state = vm::create_vm();
+            auto code = vm::compile_threaded(state, vm::assemble(state, program));
+            const auto& result = vm::run_threaded(state, code);
+            CHECK_EQ(std::get<0>(result), std::get<0>(expected));
+            CHECK_EQ(std::get<1>(result), std::get<1>(expected));
+        }
+    }
+    SUBCASE("custom_instruction") {
+        vm::vm_state state = vm::create_vm();
+        register_instruction(state, "MUL", [](vm::vm_state& vmstate, const vm::item_t) {
+            vm::item_t a = vmstate.stack.top();
+            vmstate.stack.pop();
+            vm::item_t b = vmstate.stack.top();
+            vmstate.stack.pop();
+
+            vmstate.stack.push(a * b);
+            return true;
+        });
+
+        auto code = vm::compile_threaded(state, vm::assemble(state,
+                                                             "LOAD_CONST 9001\n"
+                                                             "LOAD_CONST 6\n"
+                                                             "MUL\n"
+                                                             "EXIT\n"));
+        const auto& result = vm::run_threaded(state, code);
+        const auto& topstack = std::get<0>(result);
+        CHECK_EQ(topstack, 54006);
+    }
+    SUBCASE("errors") {
+        vm::vm_state state = vm::create_vm();
+        auto stackfail = vm::compile_threaded(state, vm::assemble(state, "ADD\n"));
+        REQUIRE_THROWS_AS(vm::run_threaded(state, stackfail), vm::vm_stackfail);
+
+        state = vm::create_vm();
+        auto div_zero = vm::compile_threaded(state, vm::assemble(state,
+                                                                 "LOAD_CONST 4212\n"
+                                                                 "LOAD_CONST 0\n"
+                                                                 "DIV\n"
+                                                                 "EXIT\n"));
+        REQUIRE_THROWS_AS(vm::run_threaded(state, div_zero), vm::div_by_zero);
+
+        state = vm::create_vm();
+        auto segfault = vm::compile_threaded(state, vm::assemble(state,
+                                                                 "LOAD_CONST 0\n"
+                                                                 "JMPZ -40\n"
+                                                                 "EXIT\n"));
+        REQUIRE_THROWS_AS(vm::run_threaded(state, segfault), vm::vm_segfault);
+    }
+}
+
+
+TEST_CASE("vm_operand_stack") {
+    SUBCASE("stack_interface") {
+        vm::operand_stack stack{4};
+        CHECK_UNARY(stack.empty());
+        stack.push(5);
+        stack.push(7);
+        CHECK_EQ(stack.size(), 2);
+        CHECK_EQ(stack.top(), 7);
+        stack.pop2_push1([](vm::item_t tos1, vm::item_t tos) { return tos1 - tos; });
+        CHECK_EQ(stack.size(), 1);
+        CHECK_EQ(stack.top(), -2);
+        stack.pop();
+        CHECK_UNARY(stack.empty());
+        REQUIRE_THROWS_AS(stack.pop(), vm::vm_stackfail);
+        REQUIRE_THROWS_AS(stack.top(), vm::vm_stackfail);
+    }
+    SUBCASE("max_depth") {
+        vm::vm_state state = vm::create_vm();
+        state.stack = vm::operand_stack{2};
+        auto code = vm::assemble(state,
+                                 "LOAD_CONST 1\n"
+                                 "LOAD_CONST 2\n"
+                                 "LOAD_CONST 3\n"
+                                 "EXIT\n");
+        REQUIRE_THROWS_AS(vm::run(state, code), vm::vm_stackfail);
+    }
+    SUBCASE("copy") {
+        vm::operand_stack stack{8};
+        stack.push(1);
+        stack.push(2);
+        vm::operand_stack copy{stack};
+        copy.pop();
+        CHECK_EQ(stack.size(), 2);
+        CHECK_EQ(copy.size(), 1);
+        CHECK_EQ(copy.max_depth(), 8);
+    }
+}
+
+
+TEST_CASE("vm_verify") {
+    SUBCASE("safe_loop") {
+        vm::vm_state state = vm::create_vm();
+        auto code = vm::assemble(state,
+                                 "LOAD_CONST 10\n"
+                                 "LOAD_CONST -1\n"
+                                 "ADD\n"
+                                 "DUP\n"
+                                 "JMPZ 6\n"
+                                 "JMP 1\n"
+                                 "EXIT\n");
+        auto result = vm::verify(state, code);
+        CHECK_UNARY(result.safe);
+        CHECK_EQ(result.max_depth, 2);
+        CHECK_EQ(*result.depth[1], 1);
+        CHECK_EQ(*result.depth[6], 1);
+
+        auto threaded = vm::compile_threaded(state, code);
+        CHECK_UNARY(threaded.verified);
+        const auto& run_result = vm::run_threaded(state, threaded);
+        CHECK_EQ(std::get<0>(run_result), 0);
+    }
+    SUBCASE("unreachable_code_is_ignored") {
+        vm::vm_state state = vm::create_vm();
+        auto code = vm::assemble(state,
+                                 "LOAD_CONST 456\n"
+                                 "EXIT\n"
+                                 "ADD\n"
+                                 "JMP -5\n");
+        auto result = vm::verify(state, code);
+        CHECK_UNARY(result.safe);
+        CHECK_UNARY_FALSE(result.depth[2].has_value());
+    }
+    SUBCASE("unsafe_code") {
+        vm::vm_state state = vm::create_vm();
+        const std::vector<std::string> programs = {
+            // underflow
+            "LOAD_CONST 1\n"
+            "ADD\n"
+            "EXIT\n",
+            // jump out of bounds
+            "LOAD_CONST 0\n"
+            "JMPZ 3\n"
+            "EXIT\n",
+            // runs past the end
+            "LOAD_CONST 1\n",
+            // stack grows in a loop
+            "LOAD_CONST 1\n"
+            "JMP 0\n",
+        };
+        for (const auto& program : programs) {
+            CHECK_UNARY_FALSE(vm::verify(state, vm::assemble(state, program)).safe);
+        }
+
+        register_instruction(state, "NOP", [](vm::vm_state&, const vm::item_t) {
+            return true;
+        });
+        CHECK_UNARY_FALSE(vm::verify(state, vm::assemble(state, "LOAD_CONST 1\nNOP\nEXIT\n")).safe);
+    }
+    SUBCASE("unverified_code_keeps_checks") {
+        vm::vm_state state = vm::create_vm();
+        auto code = vm::compile_threaded(state, vm::assemble(state,
+                                                             "LOAD_CONST -52\n"
+                                                             "ADD\n"));
+        CHECK_UNARY_FALSE(code.verified);
+        REQUIRE_THROWS_AS(vm::run_threaded(state, code), vm::vm_stackfail);
+    }
+    SUBCASE("verified_code_keeps_div_by_zero") {
+        vm::vm_state state = vm::create_vm();
+        auto code = vm::compile_threaded(state, vm::assemble(state,
+                                                             "LOAD_CONST 4212\n"
+                                                             "LOAD_CONST 0\n"
+                                                             "DIV\n"
+                                                             "EXIT\n"));
+        CHECK_UNARY(code.verified);
+        REQUIRE_THROWS_AS(vm::run_threaded(state, code), vm::div_by_zero);
+    }
+}
+
+
+TEST_CASE("vm_optimize") {
+    SUBCASE("superinstructions") {
+        vm::vm_state state = vm::create_vm();
+        auto code = vm::assemble(state,
+                                 "LOAD_CONST 10\n"
+                                 "LOAD_CONST -1\n"
+                                 "ADD\n"
+                                 "DUP\n"
+                                 "JMPZ 6\n"
+                                 "JMP 1\n"
+                                 "EXIT\n");
+        vm::optimize_report report;
+        auto optimized = vm::optimize(state, code, &report);
+        CHECK_EQ(optimized.size(), 5);
+        CHECK_EQ(report.eliminated["LOAD_CONST ADD"], 1);
+        CHECK_EQ(report.eliminated["DUP JMPZ"], 1);
+        CHECK_EQ(report.total(), 2);
+
+        const auto& result = vm::run(state, optimized);
+        CHECK_EQ(std::get<0>(result), 0);
+    }
+    SUBCASE("constant_folding") {
+        vm::vm_state state = vm::create_vm();
+        auto code = vm::assemble(state,
+                                 "LOAD_CONST 346375\n"
+                                 "LOAD_CONST 815\n"
+                                 "DIV\n"
+                                 "LOAD_CONST 5\n"
+                                 "ADD\n"
+                                 "LOAD_CONST 430\n"
+                                 "EQ\n"
+                                 "EXIT\n");
+        vm::optimize_report report;
+        auto optimized = vm::optimize(state, code, &report);
+        CHECK_EQ(optimized.size(), 2);
+        CHECK_EQ(report.eliminated["fold DIV"], 2);
+        CHECK_EQ(report.eliminated["fold ADD"], 2);
+        CHECK_EQ(report.eliminated["fold EQ"], 2);
+
+        const auto& result = vm::run(state, optimized);
+        CHECK_EQ(std::get<0>(result), 1);
+    }
+    SUBCASE("division_by_zero_is_kept") {
+        vm::vm_state state = vm::create_vm();
+        auto optimized = vm::optimize(state, vm::assemble(state,
+                                                          "LOAD_CONST 4212\n"
+                                                          "LOAD_CONST 0\n"
+                                                          "DIV\n"
+                                                          "EXIT\n"));
+        CHECK_EQ(optimized.size(), 4);
+        REQUIRE_THROWS_AS(vm::run(state, optimized), vm::div_by_zero);
+    }
+    SUBCASE("unreachable_code_and_jump_targets") {
+        vm::vm_state state = vm::create_vm();
+        auto code = vm::assemble(state,
+                                 "JMP 5\n"
+                                 "LOAD_CONST 123\n"
+                                 "LOAD_CONST 912\n"
+                                 "JMP 7\n"
+                                 "LOAD_CONST 852\n"
+                                 "JMP 2\n"
+                                 "LOAD_CONST 601\n"
+                                 "EXIT\n");
+        vm::optimize_report report;
+        auto optimized = vm::optimize(state, code, &report);
+        CHECK_EQ(report.eliminated["unreachable code"], 3);
+
+        const auto& result = vm::run(state, optimized);
+        CHECK_EQ(std::get<0>(result), 912);
+    }
+    SUBCASE("no_merge_into_jump_target") {
+        vm::vm_state state = vm::create_vm();
+        auto code = vm::assemble(state,
+                                 "LOAD_CONST 701\n"
+                                 "DUP\n"
+                                 "EQ\n"
+                                 "JMPZ 5\n"
+                                 "LOAD_CONST 1\n"
+                                 "LOAD_CONST 2\n"
+                                 "ADD\n"
+                                 "EXIT\n");
+        vm::optimize_report report;
+        auto optimized = vm::optimize(state, code, &report);
+        CHECK_EQ(report.eliminated["fold ADD"], 0);
+        CHECK_EQ(report.eliminated["LOAD_CONST ADD"], 1);
+        CHECK_EQ(report.eliminated["EQ JMPZ"], 1);
+
+        const auto& result = vm::run(state, optimized);
+        CHECK_EQ(std::get<0>(result), 3);
+    }
+    SUBCASE("output_and_segfaults_are_kept") {
+        vm::vm_state state = vm::create_vm();
+        auto optimized = vm::optimize(state, vm::assemble(state,
+                                                          "LOAD_CONST 72\n"
+                                                          "WRITE_CHAR\n"
+                                                          "LOAD_CONST 105\n"
+                                                          "WRITE_CHAR\n"
+                                                          "EXIT\n"));
+        CHECK_EQ(optimized.size(), 3);
+        CHECK_EQ(std::get<1>(vm::run(state, optimized)), "Hi");
+
+        state = vm::create_vm();
+        optimized = vm::optimize(state, vm::assemble(state,
+                                                     "LOAD_CONST 0\n"
+                                                     "JMPZ 3\n"
+                                                     "EXIT\n"));
+        REQUIRE_THROWS_AS(vm::run(state, optimized), vm::vm_segfault);
+    }
+}
+
+
+TEST_CASE("vm_jit") {
+    SUBCASE("same_results_as_run") {
+        const std::vector<std::string> programs = {
+            "LOAD_CONST 3521\n"
+            "LOAD_CONST 5652\n"
+            "ADD\n"
+            "EXIT\n",
+
+            "LOAD_CONST 346375\n"
+            "LOAD_CONST -815\n"
+            "DIV\n"
+            "LOAD_CONST 9223372036854775807\n"
+            "NEQ\n"
+            "EXIT\n",
+
+            "LOAD_CONST 36\n"
+            "LOAD_CONST 1337\n"
+            "LOAD_CONST 101\n"
+            "WRITE_CHAR\n"
+            "POP\n"
+            "WRITE\n"
+            "POP\n"
+            "WRITE_CHAR\n"
+            "EXIT\n",
+
+            "LOAD_CONST 701\n"
+            "DUP\n"
+            "EQ\n"
+            "JMPZ 6\n"
+            "LOAD_CONST 8001\n"
+            "JMP 7\n"
+            "LOAD_CONST 6231\n"
+            "EXIT\n",
+
+            "LOAD_CONST 10\n"
+            "LOAD_CONST -1\n"
+            "ADD\n"
+            "DUP\n"
+            "WRITE\n"
+            "LOAD_CONST 44\n"
+            "WRITE_CHAR\n"
+            "POP\n"
+            "DUP\n"
+            "JMPZ 11\n"
+            "JMP 1\n"
+            "EXIT\n",
+        };
+
+        for (const auto& program : programs) {
+            vm::vm_state reference_state = vm::create_vm();
+            const auto& expected = vm::run(reference_state, vm::assemble(reference_state, program));
+
+            for (bool optimized : {false, true}) {
+                vm::vm_state state = vm::create_vm();
+                auto code = vm::assemble(state, program);
+                if (optimized) {
+                    code = vm::optimize(state, code);
+                }
+                vm::jit_program jit{state, code};
+                const auto& result = jit.run(state);
+                CHECK_EQ(std::get<0>(result), std::get<0>(expected));
+                CHECK_EQ(std::get<1>(result), std::get<1>(expected));
+                CHECK_EQ(state.stack.size(), reference_state.stack.size());
+            }
+        }
+    }
+    SUBCASE("div_by_zero") {
+        vm::vm_state state = vm::create_vm();
+        vm::jit_program jit{state, vm::assemble(state,
+                                                "LOAD_CONST 4212\n"
+                                                "LOAD_CONST 0\n"
+                                                "DIV\n"
+                                                "EXIT\n")};
+        REQUIRE_THROWS_AS(jit.run(state), vm::div_by_zero);
+        CHECK_EQ(state.stack.size(), 2);
+    }
+    SUBCASE("unreachable_code") {
+        // the jump targets of dead code are not verified
+        vm::vm_state state = vm::create_vm();
+        vm::jit_program jit{state, vm::assemble(state,
+                                                "LOAD_CONST 7\n"
+                                                "EXIT\n"
+                                                "JMP 100000000\n"
+                                                "JMPZ -5\n")};
+#if defined(__x86_64__) && defined(__linux__)
+        CHECK_UNARY(jit.is_native());
+#endif
+        CHECK_EQ(std::get<0>(jit.run(state)), 7);
+        CHECK_EQ(state.pc, 2);
+    }
+    SUBCASE("interpreter_fallback") {
+        vm::vm_state state = vm::create_vm();
+        vm::jit_program unverified{state, vm::assemble(state,
+                                                       "LOAD_CONST -52\n"
+                                                       "ADD\n")};
+        CHECK_UNARY_FALSE(unverified.is_native());
+        REQUIRE_THROWS_AS(unverified.run(state), vm::vm_stackfail);
+
+        state = vm::create_vm();
+        register_instruction(state, "MUL", [](vm::vm_state& vmstate, const vm::item_t) {
+            auto [b, a] = vmstate.stack.pop2();
+            vmstate.stack.push(a * b);
+            return true;
+        });
+        vm::jit_program custom{state, vm::assemble(state,
+                                                   "LOAD_CONST 9001\n"
+                                                   "LOAD_CONST 6\n"
+                                                   "MUL\n"
+                                                   "EXIT\n")};
+        CHECK_UNARY_FALSE(custom.is_native());
+        CHECK_EQ(std::get<0>(custom.run(state)), 54006);
+    }
+}
+
+
+TEST_CASE("vm_bytecode") {
+    const std::string path = (std::filesystem::temp_directory_path() / "testhw04.vmbc").string();
+    const std::string program = (
+        "LOAD_CONST 36\n"
+        "LOAD_CONST 1337\n"
+        "LOAD_CONST 101\n"
+        "WRITE_CHAR\n"
+        "POP\n"
+        "WRITE\n"
+        "POP\n"
+        "WRITE_CHAR\n"
+        "EXIT\n");
+
+    SUBCASE("in_place") {
+        vm::vm_state state = vm::create_vm();
+        vm::bytecode::save(state, vm::assemble(state, program), path);
+
+        vm::mapped_program mapped{state, path};
+        CHECK_UNARY(mapped.in_place());
+        CHECK_EQ(mapped.code().size(), 9);
+
+        const auto& result = vm::run(state, mapped.code());
+        CHECK_EQ(std::get<0>(result), 36);
+        CHECK_EQ(std::get<1>(result), "e1337$");
+    }
+    SUBCASE("translated_op_ids") {
+        auto mul = [](vm::vm_state& vmstate, const vm::item_t) {
+            auto [b, a] = vmstate.stack.pop2();
+            vmstate.stack.push(a * b);
+            return true;
+        };
+
+        vm::vm_state writer = vm::create_vm();
+        register_instruction(writer, "MUL", mul);
+        vm::bytecode::save(writer, vm::assemble(writer,
+                                                "LOAD_CONST 9001\n"
+                                                "LOAD_CONST 6\n"
+                                                "MUL\n"
+                                                "EXIT\n"), path);
+
+        vm::vm_state state = vm::create_vm();
+        register_instruction(state, "NOP", [](vm::vm_state&, const vm::item_t) { return true; });
+        register_instruction(state, "MUL", mul);
+
+        vm::mapped_program mapped{state, path};
+        CHECK_UNARY_FALSE(mapped.in_place());
+        CHECK_EQ(std::get<0>(vm::run(state, mapped.code())), 54006);
+
+        REQUIRE_THROWS_AS(vm::mapped_program(vm::create_vm(), path), vm::invalid_instruction);
+    }
+    SUBCASE("malformed_files") {
+        {
+            std::ofstream out{path, std::ios::binary | std::ios::trunc};
+            out << "LOAD_CONST 1\nEXIT\n";
+        }
+        REQUIRE_THROWS_AS(vm::mapped_program(vm::create_vm(), path), vm::invalid_instruction);
+
+        vm::vm_state state = vm::create_vm();
+        vm::bytecode::save(state, vm::assemble(state, program), path);
+        std::filesystem::resize_file(path, std::filesystem::file_size(path) - 8);
+        REQUIRE_THROWS_AS(vm::mapped_program(state, path), vm::invalid_instruction);
+    }
+    SUBCASE("unwritable") {
+        vm::vm_state state = vm::create_vm();
+        const std::string missing = (std::filesystem::temp_directory_path() / "testhw04_missing" / "out.vmbc").string();
+        bool thrown = false;
+        try {
+            vm::bytecode::save(state, vm::assemble(state, program), missing);
+        }
+        catch (const std::system_error& error) {
+            thrown = true;
+            CHECK_EQ(error.code(), std::make_error_code(std::io_errc::stream));
+        }
+        CHECK_UNARY(thrown);
+    }
+
+    std::filesystem::remove(path);
+}
+
+
+TEST_CASE("vm_assembler") {
+    vm::vm_state state = vm::create_vm();
+    const std::string program =
+        "LOAD_CONST 40\n"
+        "\n"
+        "LOAD_CONST\t+2\r\n"
+        "  ADD  \n"
+        "LOAD_CONST -1\n"
+        "ADD\n"
+        "EXIT";
+    const vm::code_t expected = vm::assemble(state, program);
+    REQUIRE_EQ(expected.size(), 6);
+    CHECK_EQ(expected[1].second, 2);
+    CHECK_EQ(std::get<0>(vm::run(state, expected)), 41);
+
+    SUBCASE("chunked") {
+        // every possible split into two chunks, including splits within words
+        for (size_t split = 0; split <= program.size(); split++) {
+            vm::assembler assembler{state};
+            assembler.feed(std::string_view{program}.substr(0, split));
+            assembler.feed(std::string_view{program}.substr(split));
+            CHECK_EQ(assembler.finish(), expected);
+        }
+
+        vm::assembler bytewise{state};
+        for (char c : program) {
+            bytewise.feed({&c, 1});
+        }
+        CHECK_EQ(bytewise.finish(), expected);
+    }
+    SUBCASE("stream_and_file") {
+        std::istringstream input{program};
+        CHECK_EQ(vm::assemble(state, input), expected);
+
+        std::string path = (std::filesystem::temp_directory_path() / "test04_assembler.vm").string();
+        {
+            std::ofstream out{path, std::ios::binary | std::ios::trunc};
+            out << program;
+        }
+        CHECK_EQ(vm::assemble_file(state, path), expected);
+        std::filesystem::remove(path);
+    }
+    SUBCASE("parallel") {
+        // every chunk size, down to one line per chunk
+        for (size_t chunk_size = 1; chunk_size <= program.size(); chunk_size++) {
+            vm::parallel_assembler assembler{state, 2, chunk_size};
+            CHECK_EQ(assembler.assemble(program), expected);
+        }
+
+        // tail calls are found across chunk boundaries
+        const std::string calls =
+            "CALL 3\n"
+            "\n"
+            "RET\n"
+            "LOAD_CONST 1\n"
+            "CALL 0\n"
+            "RET\n";
+        for (size_t chunk_size = 1; chunk_size <= calls.size(); chunk_size++) {
+            vm::parallel_assembler assembler{state, 3, chunk_size};
+            CHECK_EQ(assembler.assemble(calls), vm::assemble(state, calls));
+        }
+
+        // the first invalid line is reported
+        vm::parallel_assembler assembler{state, 4, 1};
+        REQUIRE_THROWS_WITH_AS(assembler.assemble("LOAD_CONST 1\n\nMUL\nEXIT\nDIV 1 2\nSUB\n"),
+                               "line 3: unknown instruction: MUL", vm::invalid_instruction);
+        CHECK(assembler.assemble("").empty());
+    }
+    SUBCASE("errors") {
+        REQUIRE_THROWS_WITH_AS(vm::assemble(state, "LOAD_CONST 1\nEXIT\nMUL\n"),
+                               "line 3: unknown instruction: MUL", vm::invalid_instruction);
+        REQUIRE_THROWS_WITH_AS(vm::assemble(state, "LOAD_CONST 12ab\n"),
+                               "line 1: invalid argument: 12ab", vm::invalid_instruction);
+        REQUIRE_THROWS_WITH_AS(vm::assemble(state, "\nLOAD_CONST 99999999999999999999\n"),
+                               "line 2: argument out of range: 99999999999999999999",
+                               vm::invalid_instruction);
+        REQUIRE_THROWS_WITH_AS(vm::assemble(state, "LOAD_CONST 1 2\n"),
+                               "line 1: more than one instruction argument: 2",
+                               vm::invalid_instruction);
+    }
+}
+
+
+TEST_CASE("vm_output") {
+    const std::string program = (
+        "LOAD_CONST -9000\n"
+        "WRITE\n"
+        "LOAD_CONST 33\n"
+        "WRITE_CHAR\n"
+        "EXIT\n");
+
+    SUBCASE("collected") {
+        vm::vm_state state = vm::create_vm();
+        auto code = vm::assemble(state, program);
+        CHECK_EQ(std::get<1>(vm::run(state, code)), "-9000!");
+
+        // output of earlier runs is kept
+        state.pc = 0;
+        CHECK_EQ(std::get<1>(vm::run(state, code)), "-9000!-9000!");
+    }
+    SUBCASE("stream") {
+        vm::vm_state state = vm::create_vm();
+        std::ostringstream stream;
+        state.output = vm::output_sink::to_stream(stream);
+        const auto& [tos, text] = vm::run(state, vm::assemble(state, program));
+        CHECK_EQ(tos, 33);
+        CHECK_EQ(text, "");
+        CHECK_EQ(stream.str(), "-9000!");
+    }
+    SUBCASE("buffer_threshold") {
+        vm::vm_state state = vm::create_vm();
+        std::string buffer;
+        state.output = vm::output_sink::to_buffer(buffer, 4);
+
+        state.output.write(int64_t{123});
+        CHECK_EQ(buffer, "");
+        CHECK_EQ(state.output.pending(), "123");
+        state.output.put('4');
+        CHECK_EQ(buffer, "1234");
+        CHECK_EQ(state.output.pending(), "");
+
+        vm::run(state, vm::assemble(state, program));
+        CHECK_EQ(buffer, "1234-9000!");
+    }
+    SUBCASE("fd") {
+        std::string path = (std::filesystem::temp_directory_path() / "test04_output.txt").string();
+        std::FILE* file = std::fopen(path.c_str(), "w");
+        REQUIRE(file != nullptr);
+
+        vm::vm_state state = vm::create_vm();
+        state.output = vm::output_sink::to_fd(fileno(file));
+        vm::run(state, vm::assemble(state, program));
+        std::fclose(file);
+
+        std::ifstream in{path};
+        std::string written{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+        CHECK_EQ(written, "-9000!");
+        std::filesystem::remove(path);
+    }
+    SUBCASE("failure") {
+        // output before a failing instruction still reaches the target, in every engine
+        const std::string failing = "LOAD_CONST 7\nWRITE\nLOAD_CONST 0\nDIV\nEXIT\n";
+        auto written_before = [&](const auto& run_engine) {
+            std::string buffer;
+            vm::vm_state state = vm::create_vm();
+            state.output = vm::output_sink::to_buffer(buffer);
+            CHECK_THROWS_AS(run_engine(state, vm::assemble(state, failing)), vm::div_by_zero);
+            // read while the vm still exists, its sink flushes when destroyed
+            return std::string{buffer};
+        };
+        CHECK_EQ(written_before([](vm::vm_state& vm, const vm::code_t& code) {
+            return vm::run(vm, code);
+        }), "7");
+        CHECK_EQ(written_before([](vm::vm_state& vm, const vm::code_t& code) {
+            return vm::run_threaded(vm, vm::compile_threaded(vm, code));
+        }), "7");
+        CHECK_EQ(written_before([](vm::vm_state& vm, const vm::code_t& code) {
+            return vm::step(vm, vm::compile_threaded(vm, code), 100);
+        }), "7");
+        CHECK_EQ(written_before([](vm::vm_state& vm, const vm::code_t& code) {
+            return vm::jit_program{vm, code}.run(vm);
+        }), "7");
+        CHECK_EQ(written_before([](vm::vm_state& vm, const vm::code_t& code) {
+            return vm::register_program{vm, code}.run(vm);
+        }), "7");
+    }
+    SUBCASE("destroyed") {
+        std::string buffer;
+        {
+            vm::output_sink sink = vm::output_sink::to_buffer(buffer);
+            sink.write("unflushed");
+            CHECK_EQ(buffer, "");
+        }
+        CHECK_EQ(buffer, "unflushed");
+    }
+}
+
+
+TEST_CASE("vm_batch") {
+    vm::vm_state state = vm::create_vm();
+
+    SUBCASE("shared_instructions") {
+        vm::vm_state copy = state;
+        CHECK_EQ(copy.instructions, state.instructions);
+
+        register_instruction(copy, "NOP", [](vm::vm_state&, const vm::item_t) { return true; });
+        CHECK_UNARY(copy.instructions != state.instructions);
+        CHECK_UNARY(copy.instructions->ids.contains("NOP"));
+        CHECK_UNARY_FALSE(state.instructions->ids.contains("NOP"));
+    }
+    SUBCASE("programs") {
+        std::vector<vm::code_t> programs;
+        for (int i = 0; i < 500; i++) {
+            programs.push_back(vm::assemble(state,
+                "LOAD_CONST " + std::to_string(i) + "\n"
+                "WRITE\n"
+                "LOAD_CONST " + std::to_string(i % 7) + "\n"
+                "DIV\n"
+                "EXIT\n"));
+        }
+
+        vm::batch_executor executor{state, 4};
+        CHECK_EQ(executor.threads(), 4);
+        auto results = executor.run(programs);
+        REQUIRE_EQ(results.size(), programs.size());
+        for (int i = 0; i < 500; i++) {
+            const auto& result = results[static_cast<size_t>(i)];
+            if (i % 7 == 0) {
+                CHECK_THROWS_AS(std::rethrow_exception(result.error), vm::div_by_zero);
+            }
+            else {
+                CHECK_UNARY_FALSE(result.error);
+                CHECK_EQ(result.tos, i / (i % 7));
+                CHECK_EQ(result.output, std::to_string(i));
+            }
+        }
+    }
+    SUBCASE("initial_stacks") {
+        auto code = vm::assemble(state,
+                                 "ADD\n"
+                                 "WRITE\n"
+                                 "EXIT\n");
+        std::vector<std::vector<vm::item_t>> stacks;
+        for (vm::item_t i = 0; i < 1000; i++) {
+            stacks.push_back({i, 2 * i});
+        }
+        stacks.push_back({1});
+
+        vm::batch_executor executor{state};
+        auto results = executor.run(code, stacks);
+        REQUIRE_EQ(results.size(), stacks.size());
+        for (size_t i = 0; i < 1000; i++) {
+            CHECK_EQ(results[i].tos, 3 * static_cast<vm::item_t>(i));
+            CHECK_EQ(results[i].output, std::to_string(3 * i));
+        }
+        CHECK_THROWS_AS(std::rethrow_exception(results.back().error), vm::vm_stackfail);
+    }
+}
+
+
+TEST_CASE("vm_profile") {
+    vm::vm_state state = vm::create_vm();
+    auto code = vm::assemble(state,
+                             "LOAD_CONST 3\n"
+                             "LOAD_CONST -1\n"
+                             "ADD\n"
+                             "DUP\n"
+                             "JMPZ 6\n"
+                             "JMP 1\n"
+                             "EXIT\n");
+
+    vm::profile report;
+    const auto& result = vm::run(state, code, report);
+    CHECK_EQ(std::get<0>(result), 0);
+
+    CHECK_EQ(report.instructions.at("LOAD_CONST").count, 4);
+    CHECK_EQ(report.instructions.at("ADD").count, 3);
+    CHECK_EQ(report.instructions.at("JMP").count, 2);
+    CHECK_EQ(report.instructions.at("EXIT").count, 1);
+    CHECK_UNARY_FALSE(report.instructions.contains("DIV"));
+    CHECK_EQ(report.hotness, (std::vector<size_t>{1, 3, 3, 3, 3, 2, 1}));
+
+    REQUIRE_EQ(report.branches.size(), 1);
+    const auto& branch = report.branches.at(4);
+    CHECK_EQ(branch.taken, 1);
+    CHECK_EQ(branch.not_taken, 2);
+
+    std::string json = report.to_json();
+    CHECK_EQ(json.front(), '{');
+    CHECK_EQ(json.back(), '}');
+    CHECK_UNARY(json.find("\"hotness\":[1,3,3,3,3,2,1]") != std::string::npos);
+    CHECK_UNARY(json.find("{\"pc\":4,\"taken\":1,\"not_taken\":2,") != std::string::npos);
+
+    // a jump to the next instruction is still taken
+    vm::vm_state next = vm::create_vm();
+    vm::profile next_report;
+    vm::run(next, vm::assemble(next, "LOAD_CONST 0\nJMPZ 2\nLOAD_CONST 1\nJMPZ 4\nLOAD_CONST 5\nEXIT\n"), next_report);
+    CHECK_EQ(next_report.branches.at(1).taken, 1);
+    CHECK_EQ(next_report.branches.at(1).not_taken, 0);
+    CHECK_EQ(next_report.branches.at(3).taken, 0);
+    CHECK_EQ(next_report.branches.at(3).not_taken, 1);
+
+    // a second run adds up, and failing runs are recorded too
+    state.pc = 0;
+    vm::run(state, code, report);
+    CHECK_EQ(report.instructions.at("ADD").count, 6);
+
+    vm::vm_state failing = vm::create_vm();
+    vm::profile failed;
+    CHECK_THROWS_AS(vm::run(failing, vm::assemble(failing, "LOAD_CONST 1\nLOAD_CONST 0\nDIV\n"), failed),
+                    vm::div_by_zero);
+    CHECK_EQ(failed.instructions.at("LOAD_CONST").count, 2);
+}
+
+
+TEST_CASE("vm_step") {
+    vm::vm_state state = vm::create_vm();
+    const std::string program = (
+        "LOAD_CONST 10\n"
+        "LOAD_CONST -1\n"
+        "ADD\n"
+        "DUP\n"
+        "WRITE\n"
+        "JMPZ 7\n"
+        "JMP 1\n"
+        "EXIT\n");
+    // 1 + 10 * 6 - 1 (no final JMP) + 1
+    constexpr size_t instructions = 61;
+    auto code = vm::compile_threaded(state, vm::assemble(state, program));
+    CHECK_EQ(code.block_length, (std::vector<size_t>{6, 5, 4, 3, 2, 1, 1, 1}));
+
+    SUBCASE("budgets") {
+        for (size_t budget : {1, 2, 3, 5, 7, 60, 61, 1000}) {
+            vm::vm_state vm = vm::create_vm();
+            size_t executed = 0;
+            size_t steps = 0;
+            vm::step_result result;
+            do {
+                result = vm::step(vm, code, budget);
+                CHECK_UNARY(result.executed <= budget);
+                executed += result.executed;
+                steps++;
+            } while (not result.exited);
+
+            CHECK_EQ(executed, instructions);
+            CHECK_EQ(steps, (instructions + budget - 1) / budget);
+            CHECK_EQ(std::get<0>(result.result), 0);
+            CHECK_EQ(std::get<1>(result.result), "9876543210");
+        }
+    }
+    SUBCASE("interleaved") {
+        std::vector<vm::vm_state> vms(3, state);
+        std::vector<bool> exited(vms.size());
+        size_t running = vms.size();
+        while (running > 0) {
+            for (size_t i = 0; i < vms.size(); i++) {
+                if (not exited[i] and vm::step(vms[i], code, 4).exited) {
+                    exited[i] = true;
+                    running--;
+                }
+            }
+        }
+        for (auto& vm : vms) {
+            CHECK_EQ(vm.output.result(), "9876543210");
+        }
+    }
+    SUBCASE("errors") {
+        auto failing = vm::compile_threaded(state, vm::assemble(state, "LOAD_CONST 1\nLOAD_CONST 0\nDIV\nJMP 0\n"));
+        vm::vm_state vm = state;
+        CHECK_UNARY_FALSE(vm::step(vm, failing, 2).exited);
+        CHECK_EQ(vm.pc, 2);
+        CHECK_THROWS_AS(vm::step(vm, failing, 2), vm::div_by_zero);
+        CHECK_EQ(vm.pc, 3);
+
+        // failing within a block that only partly fits into the budget
+        auto straight = vm::compile_threaded(state, vm::assemble(state, "LOAD_CONST 1\nLOAD_CONST 0\nDIV\nEXIT\n"));
+        vm::vm_state partial = state;
+        CHECK_THROWS_AS(vm::step(partial, straight, 3), vm::div_by_zero);
+        vm::vm_state whole = state;
+        CHECK_THROWS_AS(vm::step(whole, straight, 100), vm::div_by_zero);
+        CHECK_EQ(partial.pc, 3);
+        CHECK_EQ(partial.pc, whole.pc);
+    }
+}
+
+
+TEST_CASE("vm_snapshot") {
+    vm::vm_state state = vm::create_vm();
+    vm::run(state, vm::assemble(state,
+                                "LOAD_CONST 10\n"
+                                "LOAD_CONST 20\n"
+                                "WRITE\n"
+                                "EXIT\n"));
+
+    vm::vm_snapshot warm = vm::snapshot(state);
+    CHECK_EQ(warm.state().stack.size(), 2);
+    CHECK_UNARY(state.stack.shared());
+    CHECK_EQ(warm.state().stack.data(), std::as_const(state.stack).data());
+
+    // the original vm keeps running without changing the snapshot
+    state.stack.push(99);
+    state.output.put('!');
+    CHECK_EQ(warm.state().stack.size(), 2);
+    CHECK_EQ(warm.state().output.pending(), "20");
+
+    auto tail = vm::assemble(state,
+                             "ADD\n"
+                             "WRITE\n"
+                             "EXIT\n");
+
+    vm::vm_state first = vm::fork(warm);
+    vm::vm_state second = vm::fork(warm);
+    CHECK_EQ(std::as_const(first.stack).data(), std::as_const(second.stack).data());
+
+    first.stack.push(5);
+    CHECK_UNARY(std::as_const(first.stack).data() != std::as_const(second.stack).data());
+
+    first.pc = 0;
+    const auto& [first_tos, first_text] = vm::run(first, tail);
+    CHECK_EQ(first_tos, 25);
+    CHECK_EQ(first_text, "2025");
+
+    second.pc = 0;
+    const auto& [second_tos, second_text] = vm::run(second, tail);
+    CHECK_EQ(second_tos, 30);
+    CHECK_EQ(second_text, "2030");
+
+    // forks from a snapshot are not affected by the other forks
+    vm::vm_state third = vm::fork(warm);
+    CHECK_EQ(third.stack.size(), 2);
+    CHECK_EQ(third.stack.top(), 20);
+    CHECK_EQ(third.output.pending(), "20");
+
+    SUBCASE("output_target") {
+        std::string written;
+        vm::vm_state vm = vm::create_vm();
+        vm.output = vm::output_sink::to_buffer(written);
+        vm.output.write("prelude ");
+
+        vm::vm_snapshot prelude = vm::snapshot(vm);
+        CHECK(prelude.state().output.pending().empty());
+        CHECK_EQ(written, "prelude ");
+        for (vm::item_t value : {1, 2}) {
+            vm::vm_state forked = vm::fork(prelude);
+            forked.stack.push(value);
+            forked.pc = 0;
+            vm::run(forked, vm::assemble(forked, "WRITE\nEXIT\n"));
+        }
+        vm.output.flush();
+        CHECK_EQ(written, "prelude 12");
+    }
+}
+
+
+TEST_CASE("vm_memory") {
+    // fill an array with 1..10 and sum it up in another cell
+    const std::string program = (
+        "LOAD_CONST 11\n"
+        "ALLOC\n"
+        "POP\n"
+        "LOAD_CONST 10\n"
+        "DUP\n"
+        "DUP\n"
+        "STORE -1\n"
+        "LOAD_CONST -1\n"
+        "ADD\n"
+        "DUP\n"
+        "JMPZ 12\n"
+        "JMP 4\n"
+        "POP\n"
+        "LOAD_CONST 10\n"
+        "DUP\n"
+        "LOAD -1\n"
+        "LOAD_CONST 10\n"
+        "LOAD 0\n"
+        "ADD\n"
+        "LOAD_CONST 10\n"
+        "STORE 0\n"
+        "LOAD_CONST -1\n"
+        "ADD\n"
+        "DUP\n"
+        "JMPZ 26\n"
+        "JMP 14\n"
+        "LOAD_CONST 10\n"
+        "LOAD 0\n"
+        "EXIT\n");
+
+    SUBCASE("engines") {
+        vm::vm_state state = vm::create_vm();
+        auto code = vm::assemble(state, program);
+        CHECK_EQ(std::get<0>(vm::run(state, code)), 55);
+        CHECK_EQ(state.memory.size(), 11);
+        CHECK_EQ(state.memory.load(4), 5);
+
+        vm::vm_state threaded = vm::create_vm();
+        auto compiled = vm::compile_threaded(threaded, code);
+        CHECK_UNARY(compiled.verified);
+        CHECK_EQ(std::get<0>(vm::run_threaded(threaded, compiled)), 55);
+
+        vm::vm_state native = vm::create_vm();
+        vm::jit_program jitted{native, vm::optimize(native, code)};
+        CHECK_EQ(std::get<0>(jitted.run(native)), 55);
+    }
+    SUBCASE("bounds") {
+        vm::vm_state state = vm::create_vm();
+        auto segfaults = [&](const std::string& text) {
+            state.pc = 0;
+            state.stack.clear();
+            state.memory.clear();
+            CHECK_THROWS_AS(vm::run(state, vm::assemble(state, text)), vm::vm_segfault);
+        };
+        segfaults("LOAD_CONST 0\nLOAD 0\nEXIT\n");
+        segfaults("LOAD_CONST 4\nALLOC\nLOAD 4\nEXIT\n");
+        segfaults("LOAD_CONST 4\nALLOC\nLOAD -1\nEXIT\n");
+        segfaults("LOAD_CONST 1\nLOAD_CONST 4\nALLOC\nSTORE 9223372036854775807\nEXIT\n");
+        segfaults("LOAD_CONST -1\nALLOC\nEXIT\n");
+
+        // a failed STORE leaves the same stack in every engine
+        const std::string failed_store = "LOAD_CONST 7\nLOAD_CONST 1\nLOAD_CONST 4\nALLOC\nSTORE 9223372036854775807\nEXIT\n";
+        vm::vm_state reference = vm::create_vm();
+        CHECK_THROWS_AS(vm::run(reference, vm::assemble(reference, failed_store)), vm::vm_segfault);
+        CHECK_EQ(reference.stack.size(), 1);
+        CHECK_EQ(reference.pc, 5);
+
+        vm::vm_state native = vm::create_vm();
+        vm::jit_program jitted{native, vm::assemble(native, failed_store)};
+        CHECK_THROWS_AS(jitted.run(native), vm::vm_segfault);
+        CHECK_EQ(native.stack.size(), reference.stack.size());
+        CHECK_EQ(native.pc, reference.pc);
+
+        vm::vm_state small = vm::create_vm();
+        small.memory = vm::linear_memory{100};
+        CHECK_EQ(small.memory.allocate(60), 0);
+        CHECK_THROWS_AS(small.memory.allocate(41), vm::vm_segfault);
+        CHECK_EQ(small.memory.allocate(40), 60);
+    }
+    SUBCASE("pages") {
+        vm::linear_memory memory;
+        size_t first = memory.allocate(3);
+        size_t big = memory.allocate(3 * vm::linear_memory::page_size);
+        CHECK_EQ(first, 0);
+        CHECK_EQ(big, 3);
+        memory.store(big + vm::linear_memory::page_size, 42);
+
+        // copies share pages until they write
+        vm::linear_memory copy = memory;
+        copy.store(big + vm::linear_memory::page_size, 7);
+        CHECK_EQ(memory.load(big + vm::linear_memory::page_size), 42);
+        CHECK_EQ(copy.load(big + vm::linear_memory::page_size), 7);
+        CHECK_EQ(copy.load(big + 2 * vm::linear_memory::page_size), 0);
+    }
+}
+
+
+TEST_CASE("vm_trace") {
+    vm::vm_state state = vm::create_vm();
+
+    SUBCASE("crash") {
+        auto code = vm::assemble(state,
+                                 "LOAD_CONST 7\n"
+                                 "LOAD_CONST 0\n"
+                                 "DIV\n"
+                                 "EXIT\n");
+        vm::trace_buffer trace;
+        CHECK_THROWS_AS(vm::run(state, code, trace), vm::div_by_zero);
+        CHECK_EQ(trace.recorded(), 3);
+
+        auto entries = trace.entries();
+        REQUIRE_EQ(entries.size(), 3);
+        CHECK_EQ(entries[0].pc, 0);
+        CHECK_EQ(entries[0].tos, 0);
+        CHECK_EQ(entries[2].pc, 2);
+        CHECK_EQ(entries[2].op_id, code[2].first);
+        CHECK_EQ(entries[2].tos, 0);
+
+        std::ostringstream out;
+        trace.dump(out, state);
+        CHECK_EQ(out.str(), "pc=0 LOAD_CONST tos=0\npc=1 LOAD_CONST tos=7\npc=2 DIV tos=0\n");
+    }
+    SUBCASE("ring") {
+        auto code = vm::assemble(state,
+                                 "LOAD_CONST 100\n"
+                                 "LOAD_CONST -1\n"
+                                 "ADD\n"
+                                 "DUP\n"
+                                 "JMPZ 6\n"
+                                 "JMP 1\n"
+                                 "EXIT\n");
+        vm::trace_buffer trace{3};
+        CHECK_EQ(trace.capacity(), 4);
+        CHECK_EQ(std::get<0>(vm::run(state, code, trace)), 0);
+        CHECK_EQ(trace.recorded(), 501);
+
+        auto entries = trace.entries();
+        REQUIRE_EQ(entries.size(), 4);
+        CHECK_EQ(entries[0].pc, 2);
+        CHECK_EQ(entries[3].pc, 6);
+        CHECK_EQ(entries[3].tos, 0);
+    }
+}
+
+
+TEST_CASE("vm_call") {
+    vm::vm_state state = vm::create_vm();
+
+    SUBCASE("subroutine") {
+        auto code = vm::assemble(state,
+                                 "LOAD_CONST 20\n"
+                                 "CALL 4\n"
+                                 "WRITE\n"
+                                 "EXIT\n"
+                                 "LOAD_CONST 22\n"
+                                 "ADD\n"
+                                 "RET\n");
+        auto [tos, output] = vm::run(state, code);
+        CHECK_EQ(tos, 42);
+        CHECK_EQ(output, "42");
+        CHECK(state.calls.empty());
+
+        vm::vm_state threaded = vm::create_vm();
+        auto [threaded_tos, threaded_output] = vm::run_threaded(threaded, vm::compile_threaded(threaded, code));
+        CHECK_EQ(threaded_tos, 42);
+        CHECK_EQ(threaded_output, "42");
+    }
+    SUBCASE("recursion") {
+        // sum(n) = n == 0 ? 0 : n + sum(n - 1)
+        auto code = vm::assemble(state,
+                                 "LOAD_CONST 100\n"
+                                 "CALL 3\n"
+                                 "EXIT\n"
+                                 "DUP\n"
+                                 "JMPZ 10\n"
+                                 "DUP\n"
+                                 "LOAD_CONST -1\n"
+                                 "ADD\n"
+                                 "CALL 3\n"
+                                 "ADD\n"
+                                 "RET\n");
+        CHECK_EQ(code[8].first, state.instructions->ids.at("CALL"));
+        CHECK_EQ(std::get<0>(vm::run(state, code)), 5050);
+
+        vm::vm_state optimized = vm::create_vm();
+        CHECK_EQ(std::get<0>(vm::run_threaded(optimized, vm::compile_threaded(optimized, vm::optimize(optimized, code)))), 5050);
+
+        vm::vm_state shallow = vm::create_vm();
+        shallow.calls = vm::return_stack{8};
+        CHECK_THROWS_WITH_AS(vm::run(shallow, code), "call stack overflow!", vm::vm_stackfail);
+    }
+    SUBCASE("tail_call") {
+        // count(n) = n == 0 ? 0 : count(n - 1), deeper than the return stack
+        auto code = vm::assemble(state,
+                                 "LOAD_CONST 100000\n"
+                                 "CALL 3\n"
+                                 "EXIT\n"
+                                 "DUP\n"
+                                 "JMPZ 8\n"
+                                 "LOAD_CONST -1\n"
+                                 "ADD\n"
+                                 "CALL 3\n"
+                                 "RET\n");
+        CHECK_EQ(code[7].first, state.instructions->ids.at("JMP"));
+        CHECK_EQ(code[1].first, state.instructions->ids.at("CALL"));
+        CHECK_EQ(std::get<0>(vm::run(state, code)), 0);
+        CHECK(state.calls.empty());
+
+        vm::vm_state threaded = vm::create_vm();
+        CHECK_EQ(std::get<0>(vm::run_threaded(threaded, vm::compile_threaded(threaded, code))), 0);
+    }
+    SUBCASE("return_without_call") {
+        auto code = vm::assemble(state,
+                                 "LOAD_CONST 1\n"
+                                 "RET\n");
+        CHECK_THROWS_WITH_AS(vm::run(state, code), "return without call!", vm::vm_stackfail);
+        CHECK_FALSE(vm::verify(state, code).safe);
+    }
+}
+
+
+TEST_CASE("vm_lanes") {
+    vm::vm_state state = vm::create_vm();
+
+    // reference result of one lane
+    auto scalar = [&](const vm::code_t& code, std::vector<vm::item_t> stack) {
+        vm::vm_state vm = vm::create_vm();
+        for (vm::item_t item : stack) {
+            vm.stack.push(item);
+        }
+        return vm::run(vm, code);
+    };
+
+    SUBCASE("divergent") {
+        // a / b + 1, or a if b is zero
+        auto code = vm::assemble(state,
+                                 "DUP\n"
+                                 "JMPZ 6\n"
+                                 "DIV\n"
+                                 "LOAD_CONST 1\n"
+                                 "ADD\n"
+                                 "EXIT\n"
+                                 "ADD\n"
+                                 "EXIT\n");
+        vm::lane_program program{state, code, 2};
+        CHECK(program.is_vectorized());
+
+        std::vector<vm::item_t> inputs;
+        for (vm::item_t i = 0; i < 3000; i++) {
+            inputs.push_back(i * 7 - 1000);
+            inputs.push_back(i % 5 - 2);
+        }
+        auto results = program.run(inputs);
+        REQUIRE_EQ(results.size(), 3000);
+        for (size_t i = 0; i < results.size(); i++) {
+            CHECK_FALSE(results[i].error);
+            CHECK_EQ(results[i].tos, std::get<0>(scalar(code, {inputs[2 * i], inputs[2 * i + 1]})));
+        }
+    }
+    SUBCASE("div_by_zero") {
+        auto code = vm::assemble(state,
+                                 "DIV\n"
+                                 "EXIT\n");
+        vm::lane_program program{state, code, 2};
+        CHECK(program.is_vectorized());
+
+        auto results = program.run(std::vector<vm::item_t>{10, 2, 10, 0, 9, 3, 1, 0});
+        REQUIRE_EQ(results.size(), 4);
+        CHECK_EQ(results[0].tos, 5);
+        CHECK_THROWS_AS(std::rethrow_exception(results[1].error), vm::div_by_zero);
+        CHECK_EQ(results[2].tos, 3);
+        CHECK_THROWS_AS(std::rethrow_exception(results[3].error), vm::div_by_zero);
+
+        CHECK_THROWS_AS(program.run(std::vector<vm::item_t>{1, 2, 3}), std::invalid_argument);
+    }
+    SUBCASE("scalar_fallback") {
+        auto code = vm::assemble(state,
+                                 "LOAD_CONST 1\n"
+                                 "ADD\n"
+                                 "WRITE\n"
+                                 "EXIT\n");
+        vm::lane_program program{state, code, 1};
+        CHECK_FALSE(program.is_vectorized());
+
+        auto results = program.run(std::vector<vm::item_t>{1, 41});
+        REQUIRE_EQ(results.size(), 2);
+        CHECK_EQ(results[0].tos, 2);
+        CHECK_EQ(results[0].output, "2");
+        CHECK_EQ(results[1].tos, 42);
+        CHECK_EQ(results[1].output, "42");
+    }
+}
+
+
+TEST_CASE("vm_packed") {
+    vm::vm_state state = vm::create_vm();
+    auto code = vm::assemble(state,
+                             "LOAD_CONST 1000\n"
+                             "LOAD_CONST -1\n"
+                             "ADD\n"
+                             "DUP\n"
+                             "JMPZ 6\n"
+                             "JMP 1\n"
+                             "WRITE\n"
+                             "LOAD_CONST 42\n"
+                             "EXIT\n");
+
+    SUBCASE("int32") {
+        vm::packed_code_t packed = vm::pack<int32_t>(state, code);
+        CHECK_EQ(packed.size(), code.size());
+        CHECK_EQ(packed.bytes(), 5 * code.size());
+
+        vm::basic_vm_state<int32_t> narrow;
+        auto [tos, output] = vm::run_packed(narrow, packed);
+        CHECK_EQ(tos, 42);
+        CHECK_EQ(output, "0");
+        CHECK_EQ(narrow.pc, 9);
+    }
+    SUBCASE("int64") {
+        auto packed = vm::pack<int64_t>(state, code);
+        vm::vm_state wide = vm::create_vm();
+        CHECK_EQ(vm::run_packed(wide, packed), vm::run(state, code));
+    }
+    SUBCASE("errors") {
+        auto too_wide = vm::assemble(state,
+                                     "LOAD_CONST 4294967296\n"
+                                     "EXIT\n");
+        CHECK_THROWS_WITH_AS(vm::pack<int32_t>(state, too_wide), "argument out of range at pc=0", vm::invalid_instruction);
+        CHECK_NOTHROW(vm::pack<int64_t>(state, too_wide));
+
+        vm::register_instruction(state, "NOP", [](vm::vm_state&, const vm::item_t) { return true; });
+        auto custom = vm::assemble(state, "NOP\n");
+        CHECK_THROWS_WITH_AS(vm::pack<int32_t>(state, custom), "custom instruction can't be packed at pc=0", vm::invalid_instruction);
+
+        vm::basic_vm_state<int32_t> narrow;
+        auto fails = vm::pack<int32_t>(state, vm::assemble(state,
+                                                           "LOAD_CONST 1\n"
+                                                           "LOAD_CONST 0\n"
+                                                           "DIV\n"
+                                                           "EXIT\n"));
+        CHECK_THROWS_AS(vm::run_packed(narrow, fails), vm::div_by_zero);
+        CHECK_EQ(narrow.pc, 3);
+    }
+}
+
+
+namespace {
+
+constexpr char static_countdown[] =
+    "LOAD_CONST 100\n"
+    "LOAD_CONST -1\n"
+    "ADD\n"
+    "DUP\n"
+    "JMPZ 6\n"
+    "JMP 1\n"
+    "WRITE\n"
+    "\n"
+    "  LOAD_CONST_WRITE_CHAR +33\n"
+    "EXIT\n";
+
+constexpr auto static_countdown_code = vm::assemble<static_countdown>();
+
+
+/** program text of `LOAD_CONST 0` followed by `count` times `LOAD_CONST_ADD 1` */
+template<size_t count>
+struct static_straight_line {
+    static constexpr std::string_view first = "LOAD_CONST 0\n";
+    static constexpr std::string_view step = "LOAD_CONST_ADD 1\n";
+    static constexpr std::string_view last = "EXIT\n";
+
+    char chars[first.size() + count * step.size() + last.size() + 1]{};
+
+    consteval static_straight_line() {
+        size_t end = 0;
+        auto append = [&](std::string_view text) {
+            for (char c : text) {
+                chars[end++] = c;
+            }
+        };
+        append(first);
+        for (size_t i = 0; i < count; i++) {
+            append(step);
+        }
+        append(last);
+    }
+};
+
+constexpr static_straight_line<1000> static_long_block;
+
+} // namespace
+
+
+TEST_CASE("vm_static_program") {
+    vm::vm_state state = vm::create_vm();
+
+    SUBCASE("assemble") {
+        static_assert(static_countdown_code.size() == 9);
+        static_assert(static_countdown_code[1].code == vm::opcode::load_const);
+        static_assert(static_countdown_code[1].arg == -1);
+        static_assert(static_countdown_code[7].code == vm::opcode::load_const_write_char);
+        static_assert(static_countdown_code[7].arg == 33);
+        static_assert(vm::assemble<"LOAD_CONST -9223372036854775808\n">()[0].arg == std::numeric_limits<vm::item_t>::min());
+
+        // the compile-time names are the ones create_vm registers
+        CHECK_EQ(std::size(vm::builtin_names), state.instructions->builtin_opcodes.size());
+        for (const auto& [name, code] : vm::builtin_names) {
+            CHECK_EQ(state.instructions->builtin_opcodes.at(state.instructions->ids.at(std::string{name})), code);
+        }
+    }
+    SUBCASE("run") {
+        auto [tos, output] = vm::run<static_countdown_code>(state);
+        CHECK_EQ(tos, 33);
+        CHECK_EQ(output, "0!");
+        CHECK_EQ(state.pc, 9);
+
+        vm::vm_state reference = vm::create_vm();
+        CHECK_EQ(vm::run(reference, vm::assemble(reference, static_countdown)), (std::tuple{tos, output}));
+    }
+    SUBCASE("long_block") {
+        // one block of over a thousand instructions
+        constexpr auto code = vm::assemble<static_long_block.chars>();
+        static_assert(code.size() == 1002);
+        auto [tos, output] = vm::run<code>(state);
+        CHECK_EQ(tos, 1000);
+        CHECK_EQ(state.pc, 1002);
+    }
+    SUBCASE("call") {
+        constexpr auto code = vm::assemble<"LOAD_CONST 20\n"
+                                           "CALL 3\n"
+                                           "EXIT\n"
+                                           "LOAD_CONST 22\n"
+                                           "ADD\n"
+                                           "RET\n">();
+        CHECK_EQ(std::get<0>(vm::run<code>(state)), 42);
+    }
+    SUBCASE("errors") {
+        constexpr auto code = vm::assemble<"LOAD_CONST 1\n"
+                                           "LOAD_CONST 0\n"
+                                           "DIV\n"
+                                           "EXIT\n">();
+        CHECK_THROWS_AS(vm::run<code>(state), vm::div_by_zero);
+        CHECK_EQ(state.pc, 3);
+
+        constexpr auto runs_off = vm::assemble<"LOAD_CONST 1\n">();
+        vm::vm_state other = vm::create_vm();
+        CHECK_THROWS_AS(vm::run<runs_off>(other), vm::vm_segfault);
+    }
+}
+
+
+TEST_CASE("vm_registers") {
+    vm::vm_state state = vm::create_vm();
+
+    // register form and stack interpreter must agree
+    auto compare = [&](const vm::code_t& code) {
+        vm::register_program program{state, code};
+        CHECK(program.is_translated());
+
+        vm::vm_state reference = vm::create_vm();
+        auto expected = vm::run(reference, code);
+        vm::vm_state translated = vm::create_vm();
+        CHECK_EQ(program.run(translated), expected);
+        CHECK_EQ(translated.pc, reference.pc);
+        CHECK_EQ(translated.stack.size(), reference.stack.size());
+        return program.ops().size();
+    };
+
+    SUBCASE("countdown") {
+        auto code = vm::assemble(state,
+                                 "LOAD_CONST 1000\n"
+                                 "LOAD_CONST -1\n"
+                                 "ADD\n"
+                                 "DUP\n"
+                                 "JMPZ 6\n"
+                                 "JMP 1\n"
+                                 "EXIT\n");
+        // LOAD_CONST and DUP need no instruction of their own,
+        // only the loop entry moves the constant into the slot
+        CHECK_EQ(compare(code), 5);
+        auto optimized = vm::optimize(state, code);
+        CHECK(compare(optimized) <= optimized.size());
+
+        vm::register_program program{state, code};
+        vm::vm_state counted = vm::create_vm();
+        size_t dispatches = 0;
+        program.run(counted, dispatches);
+        CHECK_EQ(dispatches, 1 + 3 * 1000);
+    }
+    SUBCASE("shuffles") {
+        compare(vm::assemble(state,
+                             "LOAD_CONST 7\n"
+                             "DUP\n"
+                             "DUP\n"
+                             "ADD\n"
+                             "LOAD_CONST 3\n"
+                             "EQ\n"
+                             "LOAD_CONST 5\n"
+                             "EQ_JMPZ 10\n"
+                             "LOAD_CONST 1\n"
+                             "JMP 11\n"
+                             "LOAD_CONST 2\n"
+                             "WRITE\n"
+                             "POP\n"
+                             "LOAD_CONST_WRITE_CHAR 33\n"
+                             "POP\n"
+                             "DUP\n"
+                             "DUP_JMPZ 18\n"
+                             "LOAD_CONST_ADD 10\n"
+                             "EXIT\n"));
+    }
+    SUBCASE("many_registers") {
+        // more constants than fit into the registers on the native stack
+        std::string text = "LOAD_CONST 0\n";
+        for (int i = 1; i <= 100; i++) {
+            text += "LOAD_CONST " + std::to_string(i) + "\nADD\n";
+        }
+        text += "EXIT\n";
+        auto code = vm::assemble(state, text);
+        compare(code);
+        vm::vm_state vm = vm::create_vm();
+        CHECK_EQ(std::get<0>(vm::register_program{vm, code}.run(vm)), 5050);
+    }
+    SUBCASE("memory") {
+        compare(vm::assemble(state,
+                             "LOAD_CONST 4\n"
+                             "ALLOC\n"
+                             "LOAD_CONST 42\n"
+                             "LOAD_CONST 1\n"
+                             "STORE 2\n"
+                             "LOAD_CONST 3\n"
+                             "LOAD 0\n"
+                             "LOAD_CONST 8\n"
+                             "DIV\n"
+                             "EXIT\n"));
+    }
+    SUBCASE("entry_stack") {
+        auto code = vm::assemble(state,
+                                 "ADD\n"
+                                 "EXIT\n");
+        vm::register_program program{state, code, 2};
+        CHECK(program.is_translated());
+
+        vm::vm_state vm = vm::create_vm();
+        vm.stack.push(5);
+        vm.stack.push(20);
+        vm.stack.push(22);
+        CHECK_EQ(std::get<0>(program.run(vm)), 42);
+        CHECK_EQ(vm.stack.size(), 2);
+        CHECK_EQ(std::as_const(vm.stack).data()[0], 5);
+    }
+    SUBCASE("errors") {
+        auto code = vm::assemble(state,
+                                 "LOAD_CONST 1\n"
+                                 "LOAD_CONST 0\n"
+                                 "DIV\n"
+                                 "EXIT\n");
+        vm::register_program program{state, code};
+        CHECK(program.is_translated());
+        CHECK_THROWS_AS(program.run(state), vm::div_by_zero);
+        CHECK_EQ(state.pc, 3);
+        CHECK(state.stack.empty());
+
+        vm::register_instruction(state, "NOP", [](vm::vm_state&, const vm::item_t) { return true; });
+        vm::register_program custom{state, vm::assemble(state,
+                                                         "LOAD_CONST 1\n"
+                                                         "NOP\n"
+                                                         "EXIT\n")};
+        CHECK_FALSE(custom.is_translated());
+        vm::vm_state other = state;
+        other.pc = 0;
+        CHECK_EQ(std::get<0>(custom.run(other)), 1);
+    }
+}
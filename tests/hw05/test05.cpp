@@ -696,3 +696,345 @@ TEST_CASE("Transition from Invalid state") {
     }
   }
 }
+
+TEST_CASE("Lexing query text") {
+  GIVEN("the query 'select Col1,col_2 FROM MyTable ;'") {
+    const std::string query = "select Col1,col_2 FROM MyTable ;";
+    auto tokens = sql::tokenize(query);
+
+    THEN("Keywords are recognised regardless of case, with their offsets") {
+      REQUIRE_EQ(tokens.size(), 7);
+      CHECK_EQ(tokens[0].kind, sql::TokenKind::Select);
+      CHECK_EQ(tokens[0].text, "select");
+      CHECK_EQ(tokens[1].kind, sql::TokenKind::Identifier);
+      CHECK_EQ(tokens[1].offset, 7);
+      CHECK_EQ(tokens[2].kind, sql::TokenKind::Comma);
+      CHECK_EQ(tokens[2].offset, 11);
+      CHECK_EQ(tokens[3].text, "col_2");
+      CHECK_EQ(tokens[4].kind, sql::TokenKind::From);
+      CHECK_EQ(tokens[5].text, "MyTable");
+      CHECK_EQ(tokens[6].kind, sql::TokenKind::Semicolon);
+      CHECK_EQ(tokens[6].offset, 31);
+    }
+
+    THEN("Identifiers are slices of the source") {
+      CHECK_EQ(tokens[5].text.data(), query.data() + 23);
+    }
+
+    THEN("The converted tokens form a valid query") {
+      std::vector<sql::Token> converted;
+      for (const auto &token : tokens) {
+        converted.push_back(token.to_token());
+      }
+      CHECK_UNARY(is_token_of_type<sql::token::Identifier>(converted[1]));
+      CHECK_EQ(std::get<sql::token::Identifier>(converted[1].value()).name, "Col1");
+      CHECK_UNARY(sql::is_valid_sql_query(converted));
+    }
+  }
+
+  GIVEN("keywords that are only part of an identifier") {
+    auto tokens = sql::tokenize("SELECTED FROM_ fromage\tFrOm\n*");
+
+    THEN("They are identifiers") {
+      REQUIRE_EQ(tokens.size(), 5);
+      CHECK_EQ(tokens[0].kind, sql::TokenKind::Identifier);
+      CHECK_EQ(tokens[1].kind, sql::TokenKind::Identifier);
+      CHECK_EQ(tokens[2].kind, sql::TokenKind::Identifier);
+      CHECK_EQ(tokens[3].kind, sql::TokenKind::From);
+      CHECK_EQ(tokens[4].kind, sql::TokenKind::Asterisks);
+    }
+  }
+
+  GIVEN("empty or blank text") {
+    CHECK_UNARY(sql::tokenize("").empty());
+    CHECK_UNARY(sql::tokenize(" \n\t ").empty());
+  }
+
+  GIVEN("a character that doesn't start a token") {
+    sql::Lexer lexer{"SELECT 1col FROM t;"};
+    CHECK_EQ(lexer.next()->kind, sql::TokenKind::Select);
+
+    THEN("The error reports its offset") {
+      bool thrown = false;
+      try {
+        (void)lexer.next();
+      } catch (const sql::LexError &error) {
+        thrown = true;
+        CHECK_EQ(error.offset(), 7);
+        CHECK_EQ(std::string{error.what()}, "unexpected '1' at offset 7");
+      }
+      CHECK_UNARY(thrown);
+    }
+  }
+}
+
+template <std::size_t state> void check_table_row(const std::vector<sql::Token> &tokens) {
+  for (const auto &token : tokens) {
+    CHECK_EQ(sql::transition(std::variant_alternative_t<state, sql::State>{}, token).index(),
+             sql::dfa::table[state][static_cast<std::size_t>(token.kind())]);
+  }
+}
+
+template <std::size_t... states> void check_table_against_transitions(std::index_sequence<states...>) {
+  const std::vector<sql::Token> tokens = {
+      sql::Token{sql::token::Select{}},    sql::Token{sql::token::Identifier{"Name"}},
+      sql::Token{sql::token::From{}},      sql::Token{sql::token::Comma{}},
+      sql::Token{sql::token::Asterisks{}}, sql::Token{sql::token::Semicolon{}},
+  };
+  (check_table_row<states>(tokens), ...);
+}
+
+TEST_CASE("Transition table") {
+  GIVEN("every state and every token") {
+    THEN("The table agrees with the transition functions") {
+      check_table_against_transitions(std::make_index_sequence<sql::dfa::state_count>{});
+    }
+  }
+
+  GIVEN("a table-driven validator") {
+    sql::DfaValidator validator;
+    for (auto kind : {sql::TokenKind::Select, sql::TokenKind::Identifier, sql::TokenKind::Comma,
+                      sql::TokenKind::Identifier, sql::TokenKind::From, sql::TokenKind::Identifier}) {
+      CHECK_UNARY_FALSE(validator.is_valid());
+      validator.handle(kind);
+    }
+    validator.handle(sql::Token{sql::token::Semicolon{}});
+    CHECK_UNARY(validator.is_valid());
+
+    validator.handle(sql::TokenKind::Comma);
+    CHECK_UNARY(validator.is_invalid());
+    validator.handle(sql::TokenKind::Semicolon);
+    CHECK_UNARY(validator.is_invalid());
+  }
+}
+
+TEST_CASE("Streaming validation") {
+  GIVEN("the query 'select Col1, col2 FROM MyTable;' in two chunks") {
+    const std::string query = "select Col1, col2 FROM MyTable;";
+
+    THEN("Every split point gives a valid query") {
+      for (std::size_t split = 0; split <= query.size(); ++split) {
+        sql::StreamingValidator validator;
+        CHECK_UNARY(validator.feed(std::string_view{query}.substr(0, split)));
+        CHECK_UNARY(validator.feed(std::string_view{query}.substr(split)));
+        CHECK_UNARY(validator.finish());
+        CHECK_EQ(validator.offset(), query.size());
+      }
+    }
+
+    THEN("Byte-wise chunks give a valid query") {
+      sql::StreamingValidator validator;
+      for (char c : query) {
+        CHECK_UNARY(validator.feed(std::string_view{&c, 1}));
+      }
+      CHECK_UNARY(validator.finish());
+    }
+  }
+
+  GIVEN("a query without its semicolon") {
+    sql::StreamingValidator validator;
+    CHECK_UNARY(validator.feed("SELECT * FROM tab"));
+    CHECK_UNARY(validator.feed("le"));
+    CHECK_UNARY_FALSE(validator.finish());
+  }
+
+  GIVEN("a keyword split between chunks") {
+    sql::StreamingValidator validator;
+    CHECK_UNARY(validator.feed("SEL"));
+    CHECK_UNARY(validator.feed("ECT * FR"));
+    CHECK_UNARY(validator.feed("om a_very_long_table_name"));
+    CHECK_UNARY(validator.feed(";"));
+    CHECK_UNARY(validator.finish());
+  }
+
+  GIVEN("a query that goes wrong early") {
+    sql::StreamingValidator validator;
+
+    THEN("It is rejected at the offending token") {
+      CHECK_UNARY_FALSE(validator.feed("SELECT Col1 Col2 FROM t;"));
+      CHECK_UNARY(validator.is_invalid());
+      CHECK_EQ(validator.offset(), 12);
+      CHECK_UNARY_FALSE(validator.feed("more text"));
+      CHECK_UNARY_FALSE(validator.finish());
+    }
+  }
+
+  GIVEN("a character that doesn't start a token") {
+    sql::StreamingValidator validator;
+    CHECK_UNARY_FALSE(validator.feed("SELECT * FROM t?;"));
+    CHECK_EQ(validator.offset(), 15);
+    CHECK_UNARY_FALSE(validator.finish());
+  }
+
+  GIVEN("tokens arriving in ranges") {
+    std::vector<sql::Token> tokens;
+    tokens.emplace_back(sql::token::Select{});
+    tokens.emplace_back(sql::token::Asterisks{});
+    tokens.emplace_back(sql::token::From{});
+    tokens.emplace_back(sql::token::Identifier{"MYTABLE"});
+    tokens.emplace_back(sql::token::Semicolon{});
+
+    sql::StreamingValidator validator;
+    CHECK_UNARY(validator.feed(std::span{tokens}.first(2)));
+    CHECK_UNARY(validator.feed(std::span{tokens}.subspan(2)));
+    CHECK_UNARY(validator.finish());
+  }
+}
+
+TEST_CASE("Compact tokens") {
+  GIVEN("a symbol table") {
+    sql::SymbolTable symbols;
+
+    THEN("Equal names get the same symbol") {
+      auto first = symbols.intern("customers");
+      auto second = symbols.intern("orders");
+      CHECK_UNARY(first != second);
+      CHECK_EQ(symbols.intern(std::string{"customers"}), first);
+      CHECK_EQ(symbols.name(second), "orders");
+      CHECK_EQ(symbols.size(), 2);
+    }
+  }
+
+  GIVEN("the query 'SELECT id, name FROM people;'") {
+    sql::SymbolTable symbols;
+    auto tokens = sql::tokenize_compact("SELECT id, name FROM people;", symbols);
+
+    THEN("Identifiers are interned") {
+      REQUIRE_EQ(tokens.size(), 7);
+      CHECK_EQ(tokens[1].kind, sql::TokenKind::Identifier);
+      CHECK_EQ(symbols.name(tokens[3].symbol), "name");
+      CHECK_EQ(symbols.size(), 3);
+      CHECK_UNARY(sql::is_valid_sql_query(tokens));
+    }
+
+    THEN("They convert from and back to Tokens") {
+      std::vector<sql::Token> converted;
+      for (auto token : tokens) {
+        converted.push_back(sql::to_token(token, symbols));
+      }
+      CHECK_EQ(std::get<sql::token::Identifier>(converted[5].value()).name, "people");
+      CHECK_UNARY(sql::is_valid_sql_query(converted));
+
+      auto again = sql::compact(converted, symbols);
+      REQUIRE_EQ(again.size(), tokens.size());
+      for (std::size_t i = 0; i < tokens.size(); ++i) {
+        CHECK_EQ(again[i].kind, tokens[i].kind);
+        CHECK_EQ(again[i].symbol, tokens[i].symbol);
+      }
+    }
+  }
+
+  GIVEN("an invalid query") {
+    sql::SymbolTable symbols;
+    CHECK_UNARY_FALSE(sql::is_valid_sql_query(sql::tokenize_compact("SELECT Col1, * FROM t;", symbols)));
+  }
+}
+
+TEST_CASE("Executing queries") {
+  sql::Catalog catalog;
+  sql::Table &people = catalog.create_table("people");
+  people.add_column("id", (std::vector<std::int64_t>{1, 2, 3, 4, 5}));
+  people.add_column("name", std::vector<std::string>{"ada", "bob", "cy", "dee", "eve"});
+  people.add_column("height", std::vector<double>{1.6, 1.8, 1.7, 1.5, 1.9});
+
+  GIVEN("a table") {
+    THEN("Inconsistent columns are rejected") {
+      CHECK_THROWS_AS(people.add_column("id", std::vector<std::int64_t>{}), sql::QueryError);
+      CHECK_THROWS_AS(people.add_column("age", std::vector<std::int64_t>{1, 2}), sql::QueryError);
+      CHECK_THROWS_AS(catalog.create_table("people"), sql::QueryError);
+      CHECK_EQ(people.rows(), 5);
+    }
+  }
+
+  GIVEN("the query 'select height, id FROM people;'") {
+    const auto query = sql::parse_select("select height, id FROM people;");
+    CHECK_EQ(query.table, "people");
+    REQUIRE_EQ(query.columns.size(), 2);
+    CHECK_EQ(query.columns[0], "height");
+
+    sql::Executor executor{catalog, 2};
+    auto cursor = executor.execute(query);
+    CHECK_EQ(cursor.column_names(), (std::vector<std::string>{"height", "id"}));
+
+    THEN("The rows arrive in batches that point into the table") {
+      sql::Batch batch;
+      std::vector<std::int64_t> ids;
+      std::vector<std::size_t> sizes;
+      while (cursor.next(batch)) {
+        REQUIRE_EQ(batch.columns.size(), 2);
+        const auto heights = std::get<std::span<const double>>(batch.columns[0]);
+        CHECK_EQ(heights.data(), std::get<std::vector<double>>(people.column(2)).data() + batch.first_row);
+        for (auto id : std::get<std::span<const std::int64_t>>(batch.columns[1])) {
+          ids.push_back(id);
+        }
+        sizes.push_back(batch.rows);
+      }
+      CHECK_EQ(ids, (std::vector<std::int64_t>{1, 2, 3, 4, 5}));
+      CHECK_EQ(sizes, (std::vector<std::size_t>{2, 2, 1}));
+      CHECK_UNARY_FALSE(cursor.next(batch));
+    }
+  }
+
+  GIVEN("the query 'SELECT * FROM people;'") {
+    sql::Executor executor{catalog};
+    auto cursor = executor.execute("SELECT * FROM people;");
+    CHECK_EQ(cursor.column_names(), (std::vector<std::string>{"id", "name", "height"}));
+
+    sql::Batch batch;
+    REQUIRE(cursor.next(batch));
+    CHECK_EQ(batch.rows, 5);
+    CHECK_EQ(std::get<std::span<const std::string>>(batch.columns[1])[4], "eve");
+    CHECK_UNARY_FALSE(cursor.next(batch));
+  }
+
+  GIVEN("bad queries") {
+    sql::Executor executor{catalog};
+    CHECK_THROWS_AS((void)executor.execute("SELECT id name FROM people;"), sql::QueryError);
+    CHECK_THROWS_AS((void)executor.execute("SELECT * FROM nobody;"), sql::QueryError);
+    CHECK_THROWS_AS((void)executor.execute("SELECT id, age FROM people;"), sql::QueryError);
+    CHECK_THROWS_AS((void)executor.execute("SELECT id FROM people?;"), sql::LexError);
+  }
+}
+
+TEST_CASE("Streaming validation of text and tokens") {
+  std::vector<sql::Token> semicolon;
+  semicolon.emplace_back(sql::token::Semicolon{});
+
+  GIVEN("text ending in a table name, followed by a semicolon token") {
+    sql::StreamingValidator validator;
+    CHECK_UNARY(validator.feed("SELECT * FROM t"));
+    CHECK_UNARY(validator.feed(semicolon));
+    CHECK_UNARY(validator.finish());
+  }
+
+  GIVEN("a split within an identifier") {
+    std::vector<sql::Token> rest;
+    rest.emplace_back(sql::token::From{});
+    rest.emplace_back(sql::token::Identifier{"people"});
+    rest.emplace_back(sql::token::Semicolon{});
+
+    THEN("The text's part of the word is one identifier") {
+      sql::StreamingValidator validator;
+      CHECK_UNARY(validator.feed("SELECT na"));
+      CHECK_UNARY(validator.feed(rest));
+      CHECK_UNARY(validator.finish());
+    }
+
+    THEN("Text after the tokens starts a new word") {
+      sql::StreamingValidator validator;
+      CHECK_UNARY(validator.feed("SELECT id, na"));
+      CHECK_UNARY(validator.feed(std::span{rest}.first(1)));
+      CHECK_UNARY(validator.feed("peo"));
+      CHECK_UNARY(validator.feed("ple"));
+      CHECK_UNARY(validator.feed(std::span{rest}.subspan(2)));
+      CHECK_UNARY(validator.finish());
+    }
+  }
+
+  GIVEN("a keyword cut off before a token") {
+    sql::StreamingValidator validator;
+    CHECK_UNARY(validator.feed("SELECT * FR"));
+    CHECK_UNARY_FALSE(validator.feed(semicolon));
+    CHECK_UNARY_FALSE(validator.finish());
+  }
+}